@@ -0,0 +1,95 @@
+// Light to cluster assignment of LightClusters at 4 to 1024 lights, on one
+// thread and on the job system, against testing every light against every
+// cluster box.
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "job_system.hpp"
+#include "light_clusters.hpp"
+
+template <typename F> double bestOf(int runs, F &&f) {
+  double best = 1e30;
+  for (int run = 0; run < runs; ++run) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    best = ms < best ? ms : best;
+  }
+  return best;
+}
+
+const float FOVY = 0.785398f, ASPECT = 16.0f / 9.0f, NEAR = 0.1f, FAR = 100.0f;
+
+// every light against every cluster, the boxes rebuilt the same way
+static std::size_t bruteForce(const std::vector<LightSphere> &lights) {
+  const unsigned int X = LightClusters::TILES_X, Y = LightClusters::TILES_Y;
+  const unsigned int Z = LightClusters::SLICES;
+  const float tanY = std::tan(FOVY * 0.5f), tanX = tanY * ASPECT;
+  std::size_t total = 0;
+  for (unsigned int z = 0; z < Z; ++z) {
+    const float zn = NEAR * std::pow(FAR / NEAR, static_cast<float>(z) / Z);
+    const float zf =
+        NEAR * std::pow(FAR / NEAR, static_cast<float>(z + 1) / Z);
+    for (unsigned int y = 0; y < Y; ++y) {
+      for (unsigned int x = 0; x < X; ++x) {
+        const float x0 = (-1.0f + 2.0f * static_cast<float>(x) / X) * tanX;
+        const float x1 = (-1.0f + 2.0f * static_cast<float>(x + 1) / X) * tanX;
+        const float y0 = (-1.0f + 2.0f * static_cast<float>(y) / Y) * tanY;
+        const float y1 = (-1.0f + 2.0f * static_cast<float>(y + 1) / Y) * tanY;
+        for (const LightSphere &light : lights) {
+          const float dx =
+              std::max(std::min(x0 * zn, x0 * zf) - light.x, 0.0f) +
+              std::max(light.x - std::max(x1 * zn, x1 * zf), 0.0f);
+          const float dy =
+              std::max(std::min(y0 * zn, y0 * zf) - light.y, 0.0f) +
+              std::max(light.y - std::max(y1 * zn, y1 * zf), 0.0f);
+          const float dz = std::max(zn - light.depth, 0.0f) +
+                           std::max(light.depth - zf, 0.0f);
+          if (dx * dx + dy * dy + dz * dz <= light.radius * light.radius)
+            ++total;
+        }
+      }
+    }
+  }
+  return total;
+}
+
+int main() {
+  JobSystem jobs;
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+
+  std::printf("%8s %12s %12s %12s %10s %12s\n", "lights", "brute ms",
+              "serial ms", "jobs ms", "speedup", "per cluster");
+  for (std::size_t count : {4u, 64u, 256u, 1024u}) {
+    // spread through the first 30 units of the frustum, radius shrinking as
+    // the count grows so the lights per cluster stay comparable
+    std::vector<LightSphere> lights;
+    const float radius = 6.0f / std::cbrt(static_cast<float>(count));
+    for (std::size_t i = 0; i < count; ++i) {
+      const float depth = 1.0f + 29.0f * (unit(random) * 0.5f + 0.5f);
+      lights.push_back({unit(random) * depth * 0.7f,
+                        unit(random) * depth * 0.4f, depth, radius});
+    }
+
+    LightClusters clusters;
+    clusters.setProjection(FOVY, ASPECT, NEAR, FAR);
+    std::size_t expected = 0;
+    double bruteMs = bestOf(5, [&] { expected = bruteForce(lights); });
+    double serialMs = bestOf(20, [&] { clusters.assign(lights, nullptr); });
+    double jobsMs = bestOf(20, [&] { clusters.assign(lights, &jobs); });
+
+    const std::size_t assigned = clusters.indices().size();
+    std::printf("%8zu %12.3f %12.3f %12.3f %9.2fx %12.2f%s\n", count, bruteMs,
+                serialMs, jobsMs, bruteMs / jobsMs,
+                static_cast<double>(assigned) / LightClusters::COUNT,
+                assigned == expected ? "" : "  MISMATCH");
+  }
+}
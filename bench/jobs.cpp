@@ -0,0 +1,69 @@
+// Fork/join overhead of the job system and parallelFor scaling over cores.
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <thread>
+#include <vector>
+
+#include "job_system.hpp"
+
+static double elapsedMs(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// arithmetic heavy enough that memory bandwidth doesn't cap the scaling
+static float kernel(std::size_t i) {
+  float x = static_cast<float>(i % 1024) * 0.001f;
+  for (int k = 0; k < 64; ++k)
+    x = std::sin(x) * 0.5f + std::cos(x) * 0.5f;
+  return x;
+}
+
+int main() {
+  const unsigned int cores = std::max(1u, std::thread::hardware_concurrency());
+
+  std::printf("fork/join overhead, %u workers\n", JobSystem::defaultWorkers());
+  std::printf("%10s %12s %12s\n", "jobs", "total ms", "ns/job");
+  {
+    JobSystem jobs;
+    for (std::size_t count : {1000u, 10000u, 100000u}) {
+      auto start = std::chrono::steady_clock::now();
+      JobCounter counter;
+      for (std::size_t i = 0; i < count; ++i)
+        jobs.submit([] {}, &counter);
+      jobs.wait(counter);
+      double ms = elapsedMs(start);
+      std::printf("%10zu %12.3f %12.1f\n", count, ms,
+                  ms * 1.0e6 / static_cast<double>(count));
+    }
+  }
+
+  const std::size_t elements = 1 << 20;
+  std::vector<float> output(elements);
+  std::printf("\nparallelFor scaling, %zu elements\n", elements);
+  std::printf("%10s %12s %12s\n", "threads", "ms", "speedup");
+  double serialMs = 0.0;
+  for (unsigned int threads = 1; threads <= cores; ++threads) {
+    // the calling thread joins in while waiting, so it counts as one
+    JobSystem jobs(threads - 1);
+    double best = 1e30;
+    for (int run = 0; run < 5; ++run) {
+      auto start = std::chrono::steady_clock::now();
+      jobs.parallelFor(0, elements, 4096,
+                       [&](std::size_t first, std::size_t last) {
+                         for (std::size_t i = first; i < last; ++i)
+                           output[i] = kernel(i);
+                       });
+      best = std::min(best, elapsedMs(start));
+    }
+    if (threads == 1)
+      serialMs = best;
+    std::printf("%10u %12.3f %11.2fx\n", threads, best, serialMs / best);
+  }
+
+  volatile float sink = output[elements / 2];
+  (void)sink;
+}
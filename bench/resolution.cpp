@@ -0,0 +1,52 @@
+// ResolutionController against a simulated GPU whose frame time grows with
+// the pixel count, with noise and a load that jumps up and back down. Prints
+// the scale over time and how often the controller reversed direction.
+
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "resolution_controller.hpp"
+
+int main() {
+  ResolutionController controller({.targetMs = 16.6,
+                                   .minScale = 0.5,
+                                   .maxScale = 1.0});
+  std::mt19937 random(3);
+  std::normal_distribution<double> noise(0.0, 0.6);
+
+  // GPU results arrive this many frames late, like GpuTimer's
+  const std::size_t LATENCY = 3;
+  std::vector<double> inFlight;
+  int lastDirection = 0;
+  unsigned int changes = 0, reversals = 0;
+  double lastScale = controller.scale();
+
+  std::printf("%6s %8s %10s %10s\n", "frame", "scale", "gpu ms", "smoothed");
+  for (int frame = 0; frame < 1200; ++frame) {
+    // full resolution costs 24 ms, then 14 ms, then 30 ms, then 24 ms
+    const double fullMs = frame < 300   ? 24.0
+                          : frame < 600 ? 14.0
+                          : frame < 900 ? 30.0
+                                        : 24.0;
+    const double scale = controller.scale();
+    inFlight.push_back(1.5 + (fullMs - 1.5) * scale * scale + noise(random));
+    if (inFlight.size() <= LATENCY)
+      continue;
+    const double measured = inFlight.front();
+    inFlight.erase(inFlight.begin());
+
+    if (controller.update(measured)) {
+      const int direction = controller.scale() > lastScale ? 1 : -1;
+      reversals += lastDirection != 0 && direction != lastDirection;
+      lastDirection = direction;
+      lastScale = controller.scale();
+      ++changes;
+      std::printf("%6d %8.3f %10.2f %10.2f\n", frame, controller.scale(),
+                  measured, controller.smoothedMs());
+    }
+  }
+  // three load changes need at least two reversals
+  std::printf("%u changes, %u reversals\n", changes, reversals);
+}
@@ -0,0 +1,66 @@
+// Batched TransformSystem::update() against composing each transform with
+// plain glm calls, at 1k to 1M transforms.
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include "transform_system.hpp"
+
+template <typename F> double bestOf(int runs, F &&f) {
+  double best = 1e30;
+  for (int run = 0; run < runs; ++run) {
+    auto start = std::chrono::steady_clock::now();
+    f();
+    double ms = std::chrono::duration<double, std::milli>(
+                    std::chrono::steady_clock::now() - start)
+                    .count();
+    best = ms < best ? ms : best;
+  }
+  return best;
+}
+
+int main() {
+  std::printf("%10s %12s %12s %8s\n", "transforms", "glm ms", "batched ms",
+              "speedup");
+  for (std::size_t count : {1000u, 10000u, 100000u, 1000000u}) {
+    TransformSystem system;
+    std::vector<glm::vec3> positions, scales;
+    std::vector<glm::quat> rotations;
+    for (std::size_t i = 0; i < count; ++i) {
+      float f = static_cast<float>(i);
+      positions.push_back(glm::vec3(f, 0.5f * f, -f));
+      rotations.push_back(
+          glm::angleAxis(0.01f * f, glm::normalize(glm::vec3(1.0f, f, 2.0f))));
+      scales.push_back(glm::vec3(1.0f + 0.001f * f, 2.0f, 0.5f));
+      system.add(positions.back(), rotations.back(), scales.back());
+    }
+
+    std::vector<glm::mat4> world(count);
+    std::vector<glm::mat3> normal(count);
+    const int runs = count >= 1000000 ? 5 : 20;
+
+    double glmMs = bestOf(runs, [&] {
+      for (std::size_t i = 0; i < count; ++i) {
+        glm::mat4 model = glm::translate(glm::mat4(1.0f), positions[i]) *
+                          glm::mat4_cast(rotations[i]);
+        model = glm::scale(model, scales[i]);
+        world[i] = model;
+        normal[i] = glm::transpose(glm::inverse(glm::mat3(model)));
+      }
+    });
+    double batchedMs = bestOf(runs, [&] { system.update(); });
+
+    // keep the results observable so neither loop is optimized away
+    volatile float sink = world[count / 2][3].x + normal[count / 2][0].x +
+                          system.instances[count / 2].model[3].x;
+    (void)sink;
+
+    std::printf("%10zu %12.3f %12.3f %7.2fx\n", count, glmMs, batchedMs,
+                glmMs / batchedMs);
+  }
+}
@@ -0,0 +1,25 @@
+#version 330 core
+layout (points) in;
+layout (points, max_vertices = 1) out;
+
+in mat4 vModel[];
+in mat3x4 vNormal[];
+in vec4 vSphere[];
+
+// captured by transform feedback for every visible instance
+out mat4 instanceModel;
+out mat3x4 instanceNormal;
+
+// frustum planes, xyz = inward normal, w = distance
+uniform vec4 planes[6];
+
+void main() {
+  for (int i = 0; i < 6; ++i) {
+    if (dot(planes[i].xyz, vSphere[0].xyz) + planes[i].w < -vSphere[0].w)
+      return;
+  }
+  instanceModel  = vModel[0];
+  instanceNormal = vNormal[0];
+  EmitVertex();
+  EndPrimitive();
+}
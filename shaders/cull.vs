@@ -0,0 +1,14 @@
+#version 330 core
+layout (location = 0) in mat4 aModel;
+layout (location = 4) in mat3x4 aNormal;
+layout (location = 7) in vec4 aSphere;
+
+out mat4 vModel;
+out mat3x4 vNormal;
+out vec4 vSphere;
+
+void main() {
+  vModel  = aModel;
+  vNormal = aNormal;
+  vSphere = aSphere;
+}
@@ -0,0 +1,59 @@
+#version 330 core
+
+// ambient and the key light for every covered pixel of the G-buffer
+out vec4 FragColor;
+
+struct Light {
+  vec3 position;
+
+  vec3 ambient;
+  vec3 diffuse;
+  vec3 specular;
+
+  float constant;
+  float linear;
+  float quadratic;
+};
+
+uniform vec3 viewPos;
+uniform Light light;
+
+uniform sampler2D gAlbedoSpec;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+// tangents of the half field of view, viewport origin and size
+uniform vec2 tanHalfFov;
+uniform vec4 viewport;
+uniform mat4 inverseView;
+
+// directional sun with cascaded shadows
+#include "sun_light.glsl"
+
+void main() {
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  float depth = texelFetch(gDepth, pixel, 0).r;
+  if (depth <= 0.0f) {
+    // nothing was drawn here
+    FragColor = vec4(0.1f, 0.1f, 0.1f, 1.0f);
+    return;
+  }
+  vec2 ndc = (gl_FragCoord.xy - viewport.xy) / viewport.zw * 2.0f - 1.0f;
+  vec3 FragPos = vec3(inverseView * vec4(ndc * tanHalfFov * depth, -depth, 1.0f));
+  vec4 albedoSpec = texelFetch(gAlbedoSpec, pixel, 0);
+  vec3 normal = texelFetch(gNormal, pixel, 0).xyz;
+
+  // same terms as the forward shader.fs
+  vec3 lightDir = normalize(light.position - FragPos);
+  vec3 ambient = light.ambient * albedoSpec.rgb;
+  vec3 diffuse = light.diffuse * albedoSpec.rgb;
+  vec3  reflectDir = reflect(-lightDir, normal);
+  vec3  viewDir    = normalize(viewPos - FragPos);
+  float spec       = pow(max(dot(viewDir, reflectDir), 0.0f), 32.0f);
+  vec3 specular   = light.specular * spec * albedoSpec.a;
+  float d           = length(light.position - FragPos);
+  float attenuation = 1.0f / (light.constant + light.linear * d + light.quadratic * d * d);
+
+  vec3 sun = sunLight(FragPos, normal, viewDir, albedoSpec.rgb,
+                     vec3(albedoSpec.a));
+  FragColor = vec4(ambient + (diffuse + specular) * attenuation + sun, 1.0f);
+}
@@ -0,0 +1,17 @@
+#version 330 core
+
+// depth prepass, must compute gl_Position exactly like shader.vs
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 model;
+// camera, latched right before the draws, see camera_latch.hpp
+layout (std140) uniform Camera {
+  mat4 view;
+  mat4 projection;
+};
+
+invariant gl_Position;
+
+void main() {
+  gl_Position = projection * view * model * vec4(aPos, 1.0f);
+}
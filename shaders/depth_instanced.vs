@@ -0,0 +1,19 @@
+#version 330 core
+
+// depth prepass, must compute gl_Position exactly like instanced.vs
+layout (location = 0) in vec3 aPos;
+layout (location = 7) in mat4 aInstanceModel;
+
+uniform mat4 model;
+// camera, latched right before the draws, see camera_latch.hpp
+layout (std140) uniform Camera {
+  mat4 view;
+  mat4 projection;
+};
+
+invariant gl_Position;
+
+void main() {
+  mat4 world = aInstanceModel * model;
+  gl_Position = projection * view * world * vec4(aPos, 1.0f);
+}
@@ -0,0 +1,10 @@
+#version 330 core
+
+// window depth of the triangle, 0.5 unless set
+uniform float screenDepth = 0.5f;
+
+// one triangle covering the screen, no vertex buffer needed
+void main() {
+  vec2 position = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+  gl_Position = vec4(position * 2.0f - 1.0f, screenDepth * 2.0f - 1.0f, 1.0f);
+}
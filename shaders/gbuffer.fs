@@ -0,0 +1,29 @@
+#version 330 core
+
+// geometry pass of the deferred path, see deferred.hpp
+layout (location = 0) out vec4 gAlbedoSpec;
+layout (location = 1) out vec4 gNormal;
+layout (location = 2) out float gDepth;
+
+in vec3 Normal;
+in vec3 FragPos;
+in vec2 TexCoords;
+
+// camera, latched right before the draws, see camera_latch.hpp
+layout (std140) uniform Camera {
+  mat4 view;
+  mat4 projection;
+};
+
+uniform sampler2D texture_diffuse1;
+uniform sampler2D texture_specular1;
+
+void main() {
+  // specular intensity rides along in alpha
+  gAlbedoSpec = vec4(texture(texture_diffuse1, TexCoords).rgb,
+                     texture(texture_specular1, TexCoords).r);
+  // world space, like the lighting in deferred.fs
+  gNormal = vec4(normalize(Normal), 0.0f);
+  // linear view depth, position is rebuilt from it and the pixel's ray
+  gDepth = -(view * vec4(FragPos, 1.0f)).z;
+}
@@ -0,0 +1,33 @@
+#version 330 core
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 7) in mat4 aInstanceModel;
+layout (location = 11) in mat3 aInstanceNormal;
+
+out vec3 Normal;
+out vec3 FragPos;
+out vec2 TexCoords;
+
+uniform mat4 model;
+// camera, latched right before the draws, see camera_latch.hpp
+layout (std140) uniform Camera {
+  mat4 view;
+  mat4 projection;
+};
+// inverse transpose of model, computed on the CPU
+uniform mat3 normalMatrix;
+
+// the depth prepass computes the same positions, see depth_instanced.vs
+invariant gl_Position;
+
+void main() {
+  // instance placement applied on top of the mesh's node transform
+  mat4 world = aInstanceModel * model;
+  gl_Position = projection * view * world * vec4(aPos, 1.0f);
+
+  Normal = aInstanceNormal * normalMatrix * aNormal;
+  FragPos = vec3(world * vec4(aPos, 1.0f));
+  TexCoords = aTexCoords;
+}
@@ -0,0 +1,44 @@
+#version 330 core
+
+// one point light added to the pixels its volume covers
+out vec4 FragColor;
+
+flat in vec4 Sphere;
+flat in vec3 Color;
+
+uniform vec3 viewPos;
+
+uniform sampler2D gAlbedoSpec;
+uniform sampler2D gNormal;
+uniform sampler2D gDepth;
+uniform vec2 tanHalfFov;
+uniform vec4 viewport;
+uniform mat4 inverseView;
+
+void main() {
+  ivec2 pixel = ivec2(gl_FragCoord.xy);
+  float depth = texelFetch(gDepth, pixel, 0).r;
+  if (depth <= 0.0f)
+    discard;
+  vec2 ndc = (gl_FragCoord.xy - viewport.xy) / viewport.zw * 2.0f - 1.0f;
+  vec3 FragPos = vec3(inverseView * vec4(ndc * tanHalfFov * depth, -depth, 1.0f));
+
+  vec3 toLight = Sphere.xyz - FragPos;
+  float d = length(toLight);
+  if (d >= Sphere.w)
+    discard;
+  vec4 albedoSpec = texelFetch(gAlbedoSpec, pixel, 0);
+  vec3 normal = texelFetch(gNormal, pixel, 0).xyz;
+
+  // same falloff and terms as the clustered lights in shader.fs
+  float window = clamp(1.0f - pow(d / Sphere.w, 4.0f), 0.0f, 1.0f);
+  float attenuation = window * window / (1.0f + d * d);
+  vec3 lightDir = toLight / max(d, 1e-4f);
+  vec3 viewDir = normalize(viewPos - FragPos);
+
+  float diff = max(dot(lightDir, normal), 0.0f);
+  vec3 reflectDir = reflect(-lightDir, normal);
+  float spec = pow(max(dot(viewDir, reflectDir), 0.0f), 32.0f);
+  FragColor = vec4((diff * albedoSpec.rgb + spec * albedoSpec.a) * Color *
+                       attenuation, 1.0f);
+}
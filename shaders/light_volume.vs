@@ -0,0 +1,18 @@
+#version 330 core
+
+// a sphere around each point light, one instance per light
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec4 aSphere;
+layout (location = 2) in vec3 aColor;
+
+flat out vec4 Sphere;
+flat out vec3 Color;
+
+uniform mat4 view;
+uniform mat4 projection;
+
+void main() {
+  Sphere = aSphere;
+  Color = aColor;
+  gl_Position = projection * view * vec4(aSphere.xyz + aPos * aSphere.w, 1.0f);
+}
@@ -0,0 +1,12 @@
+#version 330 core
+
+// turns the mesh of every pixel into a depth, so each mesh's resolve pass
+// only runs on its own pixels through GL_EQUAL
+uniform usampler2D visibilityIds;
+
+void main() {
+  uint id = texelFetch(visibilityIds, ivec2(gl_FragCoord.xy), 0).y;
+  if (id == 0u)
+    discard;
+  gl_FragDepth = float((id >> 24) + 1u) / 256.0f;
+}
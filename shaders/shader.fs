@@ -23,6 +23,57 @@ uniform Light light;
 uniform sampler2D texture_diffuse1;
 uniform sampler2D texture_specular1;
 
+// clustered point lights, see clustered_lighting.hpp
+// two texels per light: position and radius, then color
+uniform samplerBuffer clusterLights;
+// per cluster: first entry in clusterIndices and light count
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+// viewport x, y, width, height
+uniform vec4 clusterViewport;
+// near, far, slice scale and bias
+uniform vec4 clusterDepth;
+
+const uvec3 CLUSTER_TILES = uvec3(16u, 9u, 24u);
+
+// directional sun with cascaded shadows
+#include "sun_light.glsl"
+
+vec3 pointLights(vec3 normal, vec3 viewDir, vec3 albedo, vec3 specularColor) {
+  // view depth back from the depth buffer value
+  float ndc = gl_FragCoord.z * 2.0f - 1.0f;
+  float zNear = clusterDepth.x, zFar = clusterDepth.y;
+  float depth = 2.0f * zNear * zFar / (zFar + zNear - ndc * (zFar - zNear));
+
+  vec2 tile = (gl_FragCoord.xy - clusterViewport.xy) / clusterViewport.zw;
+  uvec3 cluster = uvec3(clamp(tile, 0.0f, 0.999f) * vec2(CLUSTER_TILES.xy),
+                        clamp(log(depth) * clusterDepth.z + clusterDepth.w,
+                              0.0f, float(CLUSTER_TILES.z - 1u)));
+  int index = int((cluster.z * CLUSTER_TILES.y + cluster.y) * CLUSTER_TILES.x +
+                  cluster.x);
+  uvec2 range = texelFetch(clusterGrid, index).xy;
+
+  vec3 result = vec3(0.0f);
+  for (uint i = 0u; i < range.y; ++i) {
+    int light = int(texelFetch(clusterIndices, int(range.x + i)).x);
+    vec4 sphere = texelFetch(clusterLights, 2 * light);
+    vec3 color = texelFetch(clusterLights, 2 * light + 1).rgb;
+
+    vec3 toLight = sphere.xyz - FragPos;
+    float d = length(toLight);
+    // falls smoothly to zero at the radius
+    float window = clamp(1.0f - pow(d / sphere.w, 4.0f), 0.0f, 1.0f);
+    float attenuation = window * window / (1.0f + d * d);
+    vec3 lightDir = toLight / max(d, 1e-4f);
+
+    float diff = max(dot(lightDir, normal), 0.0f);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0f), 32.0f);
+    result += (diff * albedo + spec * specularColor) * color * attenuation;
+  }
+  return result;
+}
+
 void main() {
   vec3 lightDir = normalize(light.position - FragPos);
   // ambient shading
@@ -40,5 +91,12 @@ void main() {
   float d           = length(light.position - FragPos);
   float attenuation = 1.0f / (light.constant + light.linear * d + light.quadratic * d * d);
 
-  FragColor = vec4(ambient + (diffuse + specular) * attenuation, 1.0f);
+  vec3 points = pointLights(normal, viewDir,
+                            texture(texture_diffuse1, TexCoords).rgb,
+                            texture(texture_specular1, TexCoords).rgb);
+  vec3 sun = sunLight(FragPos, normal, viewDir,
+                     texture(texture_diffuse1, TexCoords).rgb,
+                     texture(texture_specular1, TexCoords).rgb);
+  FragColor = vec4(ambient + (diffuse + specular) * attenuation + points + sun,
+                   1.0f);
 }
\ No newline at end of file
@@ -9,13 +9,21 @@ out vec3 FragPos;
 out vec2 TexCoords;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+// camera, latched right before the draws, see camera_latch.hpp
+layout (std140) uniform Camera {
+  mat4 view;
+  mat4 projection;
+};
+// inverse transpose of model, computed on the CPU
+uniform mat3 normalMatrix;
+
+// the depth prepass computes the same positions, see depth.vs
+invariant gl_Position;
 
 void main() {
   gl_Position = projection * view * model * vec4(aPos, 1.0f);
 
-  Normal = mat3(transpose(inverse(model))) * aNormal;
+  Normal = normalMatrix * aNormal;
   FragPos = vec3(model * vec4(aPos, 1.0f));
   TexCoords = aTexCoords;
 }
\ No newline at end of file
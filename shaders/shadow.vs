@@ -0,0 +1,19 @@
+#version 330 core
+
+// shadow cascade pass, positions only, see shadow_cascades.hpp
+layout (location = 0) in vec3 aPos;
+
+uniform mat4 model;
+uniform mat4 lightViewProjection;
+// seven texels per caster, the model matrix columns come first
+uniform samplerBuffer casterTransforms;
+uniform int casterBase;
+
+void main() {
+  int base = 7 * (casterBase + gl_InstanceID);
+  mat4 instance = mat4(texelFetch(casterTransforms, base),
+                       texelFetch(casterTransforms, base + 1),
+                       texelFetch(casterTransforms, base + 2),
+                       texelFetch(casterTransforms, base + 3));
+  gl_Position = lightViewProjection * instance * model * vec4(aPos, 1.0f);
+}
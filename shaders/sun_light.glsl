@@ -0,0 +1,34 @@
+// directional sun with cascaded shadows, see shadow_cascades.hpp. Shared
+// by shader.fs, deferred.fs and visibility_resolve.fs through the
+// #include of the Shader loader, see shader.hpp
+uniform vec3 sunDirection;
+uniform vec3 sunColor;
+uniform sampler2DArrayShadow shadowMap;
+uniform mat4 cascadeMatrices[3];
+// world size of a shadow map texel in each cascade
+uniform vec3 cascadeTexels;
+
+// 0 in shadow to 1 lit, from the first cascade that covers position
+float sunShadow(vec3 position, vec3 normal) {
+  for (int i = 0; i < 3; ++i) {
+    // pushed off the surface by a texel or so against acne
+    vec3 offset = position + normal * 1.5f * cascadeTexels[i];
+    vec3 coords = (cascadeMatrices[i] * vec4(offset, 1.0f)).xyz * 0.5f + 0.5f;
+    if (all(greaterThan(coords, vec3(0.0f))) &&
+        all(lessThan(coords, vec3(1.0f))))
+      return texture(shadowMap, vec4(coords.xy, float(i), coords.z));
+  }
+  return 1.0f;
+}
+
+vec3 sunLight(vec3 position, vec3 normal, vec3 viewDir, vec3 albedo,
+              vec3 specularColor) {
+  vec3 lightDir = -sunDirection;
+  float diff = max(dot(lightDir, normal), 0.0f);
+  if (diff <= 0.0f)
+    return vec3(0.0f);
+  vec3 reflectDir = reflect(-lightDir, normal);
+  float spec = pow(max(dot(viewDir, reflectDir), 0.0f), 32.0f);
+  return (diff * albedo + spec * specularColor) * sunColor *
+         sunShadow(position, normal);
+}
@@ -0,0 +1,20 @@
+#version 330 core
+
+// batch rendered views, see tools/batch_render.cpp: the diffuse texture lit
+// by a light at the eye, so every pose shows the side it looks at
+in vec3 Normal;
+in vec3 FragPos;
+in vec2 TexCoords;
+out vec4 FragColor;
+
+uniform vec3 viewPos;
+uniform sampler2D texture_diffuse1;
+
+void main() {
+  vec3 albedo = texture(texture_diffuse1, TexCoords).rgb;
+  vec3 normal = normalize(Normal);
+  vec3 viewDir = normalize(viewPos - FragPos);
+  // lit from both sides, thin meshes are seen from behind too
+  float diff = abs(dot(normal, viewDir));
+  FragColor = vec4(albedo * (0.25f + 0.75f * diff), 1.0f);
+}
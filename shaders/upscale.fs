@@ -0,0 +1,36 @@
+#version 330 core
+
+// bilinear upscale of the dynamic resolution target with contrast adaptive
+// sharpening, see dynamic_resolution.hpp
+out vec4 FragColor;
+
+uniform sampler2D source;
+// fraction of the source texture holding the frame
+uniform vec2 sourceScale;
+uniform vec4 viewport;
+// 0 to 1
+uniform float sharpness;
+
+void main() {
+  vec2 texel = 1.0f / vec2(textureSize(source, 0));
+  // stay inside the frame, the rest of the texture holds older ones
+  vec2 lo = 0.5f * texel, hi = sourceScale - 0.5f * texel;
+  vec2 uv = (gl_FragCoord.xy - viewport.xy) / viewport.zw * sourceScale;
+
+  vec3 center = texture(source, clamp(uv, lo, hi)).rgb;
+  vec3 north = texture(source, clamp(uv + vec2(0.0f, texel.y), lo, hi)).rgb;
+  vec3 south = texture(source, clamp(uv - vec2(0.0f, texel.y), lo, hi)).rgb;
+  vec3 east = texture(source, clamp(uv + vec2(texel.x, 0.0f), lo, hi)).rgb;
+  vec3 west = texture(source, clamp(uv - vec2(texel.x, 0.0f), lo, hi)).rgb;
+
+  // sharpen less where the neighbourhood already has contrast, so edges
+  // don't ring and flat areas don't pick up noise
+  vec3 low = min(center, min(min(north, south), min(east, west)));
+  vec3 high = max(center, max(max(north, south), max(east, west)));
+  vec3 amount = sqrt(clamp(min(low, 1.0f - high) / max(high, 1e-4f), 0.0f,
+                           1.0f));
+  vec3 weight = -amount * mix(0.125f, 0.2f, sharpness);
+  vec3 color = (center + (north + south + east + west) * weight) /
+               (1.0f + 4.0f * weight);
+  FragColor = vec4(clamp(color, 0.0f, 1.0f), 1.0f);
+}
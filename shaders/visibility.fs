@@ -0,0 +1,12 @@
+#version 330 core
+
+// triangle within the mesh, then mesh and instance + 1, 0 marks no geometry
+layout (location = 0) out uvec2 Id;
+
+flat in int Instance;
+
+uniform uint meshIndex;
+
+void main() {
+  Id = uvec2(uint(gl_PrimitiveID), (meshIndex << 24) | uint(Instance + 1));
+}
@@ -0,0 +1,22 @@
+#version 330 core
+
+// ID pass of the visibility buffer, positions only, see visibility.hpp
+layout (location = 0) in vec3 aPos;
+
+flat out int Instance;
+
+uniform mat4 model;
+uniform mat4 view;
+uniform mat4 projection;
+// seven texels per instance, the model matrix columns come first
+uniform samplerBuffer instanceTransforms;
+
+void main() {
+  int base = 7 * gl_InstanceID;
+  mat4 instance = mat4(texelFetch(instanceTransforms, base),
+                       texelFetch(instanceTransforms, base + 1),
+                       texelFetch(instanceTransforms, base + 2),
+                       texelFetch(instanceTransforms, base + 3));
+  gl_Position = projection * view * instance * model * vec4(aPos, 1.0f);
+  Instance = gl_InstanceID;
+}
@@ -0,0 +1,157 @@
+#version 330 core
+
+// Shades the pixels of one mesh from the visibility buffer: the triangle is
+// fetched by its ID, intersected with the pixel's ray and its attributes
+// interpolated, then lit like shader.fs
+out vec4 FragColor;
+
+struct Light {
+  vec3 position;
+
+  vec3 ambient;
+  vec3 diffuse;
+  vec3 specular;
+
+  float constant;
+  float linear;
+  float quadratic;
+};
+
+uniform vec3 viewPos;
+uniform Light light;
+
+uniform sampler2D texture_diffuse1;
+uniform sampler2D texture_specular1;
+
+uniform usampler2D visibilityIds;
+// two texels per vertex: position and u, normal and v
+uniform samplerBuffer vertices;
+// indices of all meshes, already offset to the mesh's first vertex
+uniform usamplerBuffer indices;
+uniform samplerBuffer instanceTransforms;
+// first index of the mesh being resolved and its node transforms
+uniform int firstIndex;
+uniform mat4 model;
+uniform mat3 normalMatrix;
+
+uniform mat4 view;
+uniform mat4 inverseViewProjection;
+uniform vec4 viewport;
+
+// clustered point lights, see clustered_lighting.hpp
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+uniform vec4 clusterViewport;
+uniform vec4 clusterDepth;
+
+const uvec3 CLUSTER_TILES = uvec3(16u, 9u, 24u);
+
+// directional sun with cascaded shadows
+#include "sun_light.glsl"
+
+// as in shader.fs, with the view depth passed in instead of read from
+// gl_FragCoord.z, which here is the material depth
+vec3 pointLights(vec3 FragPos, float depth, vec3 normal, vec3 viewDir,
+                 vec3 albedo, vec3 specularColor) {
+  vec2 tile = (gl_FragCoord.xy - clusterViewport.xy) / clusterViewport.zw;
+  uvec3 cluster = uvec3(clamp(tile, 0.0f, 0.999f) * vec2(CLUSTER_TILES.xy),
+                        clamp(log(depth) * clusterDepth.z + clusterDepth.w,
+                              0.0f, float(CLUSTER_TILES.z - 1u)));
+  int index = int((cluster.z * CLUSTER_TILES.y + cluster.y) * CLUSTER_TILES.x +
+                  cluster.x);
+  uvec2 range = texelFetch(clusterGrid, index).xy;
+
+  vec3 result = vec3(0.0f);
+  for (uint i = 0u; i < range.y; ++i) {
+    int light = int(texelFetch(clusterIndices, int(range.x + i)).x);
+    vec4 sphere = texelFetch(clusterLights, 2 * light);
+    vec3 color = texelFetch(clusterLights, 2 * light + 1).rgb;
+
+    vec3 toLight = sphere.xyz - FragPos;
+    float d = length(toLight);
+    float window = clamp(1.0f - pow(d / sphere.w, 4.0f), 0.0f, 1.0f);
+    float attenuation = window * window / (1.0f + d * d);
+    vec3 lightDir = toLight / max(d, 1e-4f);
+
+    float diff = max(dot(lightDir, normal), 0.0f);
+    vec3 reflectDir = reflect(-lightDir, normal);
+    float spec = pow(max(dot(viewDir, reflectDir), 0.0f), 32.0f);
+    result += (diff * albedo + spec * specularColor) * color * attenuation;
+  }
+  return result;
+}
+
+// barycentric coordinates of the triangle where the ray through ndc
+// crosses its plane, may lie outside for the neighbouring pixels
+vec3 barycentrics(vec2 ndc, vec3 p0, vec3 p1, vec3 p2) {
+  vec4 far = inverseViewProjection * vec4(ndc, 1.0f, 1.0f);
+  vec3 direction = far.xyz / far.w - viewPos;
+  vec3 e1 = p1 - p0, e2 = p2 - p0;
+  vec3 h = cross(direction, e2);
+  float a = dot(e1, h);
+  vec3 s = viewPos - p0;
+  float u = dot(s, h) / a;
+  float v = dot(direction, cross(s, e1)) / a;
+  return vec3(1.0f - u - v, u, v);
+}
+
+void main() {
+  uvec2 id = texelFetch(visibilityIds, ivec2(gl_FragCoord.xy), 0).xy;
+  int base = 7 * (int(id.y & 0xffffffu) - 1);
+  mat4 instance = mat4(texelFetch(instanceTransforms, base),
+                       texelFetch(instanceTransforms, base + 1),
+                       texelFetch(instanceTransforms, base + 2),
+                       texelFetch(instanceTransforms, base + 3));
+  mat3 instanceNormal = mat3(texelFetch(instanceTransforms, base + 4).xyz,
+                             texelFetch(instanceTransforms, base + 5).xyz,
+                             texelFetch(instanceTransforms, base + 6).xyz);
+  mat4 world = instance * model;
+  mat3 worldNormal = instanceNormal * normalMatrix;
+
+  vec3 p[3], n[3];
+  vec2 uv[3];
+  for (int i = 0; i < 3; ++i) {
+    int vertex = int(texelFetch(indices, firstIndex + 3 * int(id.x) + i).x);
+    vec4 a = texelFetch(vertices, 2 * vertex);
+    vec4 b = texelFetch(vertices, 2 * vertex + 1);
+    p[i] = vec3(world * vec4(a.xyz, 1.0f));
+    n[i] = b.xyz;
+    uv[i] = vec2(a.w, b.w);
+  }
+
+  // the neighbouring pixels' rays give the texture coordinate derivatives
+  // that quad shading would have had
+  vec2 ndc = (gl_FragCoord.xy - viewport.xy) / viewport.zw * 2.0f - 1.0f;
+  vec2 step = 2.0f / viewport.zw;
+  vec3 b = barycentrics(ndc, p[0], p[1], p[2]);
+  vec3 bx = barycentrics(ndc + vec2(step.x, 0.0f), p[0], p[1], p[2]);
+  vec3 by = barycentrics(ndc + vec2(0.0f, step.y), p[0], p[1], p[2]);
+  vec2 TexCoords = b.x * uv[0] + b.y * uv[1] + b.z * uv[2];
+  vec2 dx = bx.x * uv[0] + bx.y * uv[1] + bx.z * uv[2] - TexCoords;
+  vec2 dy = by.x * uv[0] + by.y * uv[1] + by.z * uv[2] - TexCoords;
+  vec3 FragPos = b.x * p[0] + b.y * p[1] + b.z * p[2];
+  vec3 normal = normalize(worldNormal * (b.x * n[0] + b.y * n[1] + b.z * n[2]));
+
+  vec3 albedo = textureGrad(texture_diffuse1, TexCoords, dx, dy).rgb;
+  vec3 specularColor = textureGrad(texture_specular1, TexCoords, dx, dy).rgb;
+
+  // same terms as shader.fs
+  vec3 lightDir = normalize(light.position - FragPos);
+  vec3 ambient = light.ambient * albedo;
+  float diff    = max(dot(lightDir, normal), 0.0f);
+  vec3  diffuse = light.diffuse * albedo;
+  vec3  reflectDir = reflect(-lightDir, normal);
+  vec3  viewDir    = normalize(viewPos - FragPos);
+  float spec       = pow(max(dot(viewDir, reflectDir), 0.0f), 32.0f);
+  vec3 specular   = light.specular * spec * specularColor;
+  float d           = length(light.position - FragPos);
+  float attenuation = 1.0f / (light.constant + light.linear * d + light.quadratic * d * d);
+
+  float depth = -(view * vec4(FragPos, 1.0f)).z;
+  vec3 points = pointLights(FragPos, depth, normal, viewDir, albedo,
+                            specularColor);
+  vec3 sun = sunLight(FragPos, normal, viewDir, albedo, specularColor);
+  FragColor = vec4(ambient + (diffuse + specular) * attenuation + points + sun,
+                   1.0f);
+}
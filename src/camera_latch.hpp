@@ -0,0 +1,109 @@
+#ifndef CAMERA_LATCH_HPP
+#define CAMERA_LATCH_HPP
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <functional>
+
+#include "camera.hpp"
+#include "deletion_queue.hpp"
+#include "input_queue.hpp"
+#include "monotonic_clock.hpp"
+#include "shader.hpp"
+
+// Camera matrices in a uniform buffer, written right before the draws that
+// read them instead of when the frame starts. Culling, shadows and draw
+// recording use the camera sampled at the start of the frame, then latch()
+// turns it by the mouse motion queued meanwhile and uploads the
+// result. Recorded draws only reference the buffer, so lists built on other
+// threads pick up the late camera without being recorded again. Only the
+// rotation is latched, it moves the most pixels per frame. Culling used the
+// earlier camera, so turning fast can show an object at the screen edge a
+// frame late.
+class CameraLatch {
+public:
+  // uniform buffer binding of the Camera block
+  static constexpr GLuint BINDING = 0;
+
+  // one latch, for measuring what it gained
+  struct Sample {
+    // when the frame sampled its camera and when it was latched
+    std::uint64_t frameNs, latchNs;
+    // arrival of the newest mouse motion latched, 0 if there was none
+    std::uint64_t inputNs;
+    // how far the latch turned the camera
+    float degrees;
+  };
+  // called by every latch, e.g. to feed frame statistics
+  std::function<void(const Sample &)> hook;
+  // without it latch() uploads the frame's camera unchanged
+  bool enabled = true;
+
+  CameraLatch() {
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::mat4), nullptr,
+                 GL_DYNAMIC_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    glBindBufferBase(GL_UNIFORM_BUFFER, BINDING, buffer);
+  }
+
+  CameraLatch(const CameraLatch &) = delete;
+  CameraLatch &operator=(const CameraLatch &) = delete;
+
+  ~CameraLatch() { retireGLObject(GLObject::Buffer, buffer); }
+
+  // read the Camera block of shader from the latched buffer
+  static void attach(const Shader &shader) {
+    const GLuint block = glGetUniformBlockIndex(shader.ID, "Camera");
+    if (block != GL_INVALID_INDEX)
+      glUniformBlockBinding(shader.ID, block, BINDING);
+  }
+
+  // the camera the frame is built with
+  void beginFrame(const Camera &camera, const glm::mat4 &projection) {
+    frameCamera = camera;
+    frameProjection = projection;
+    frameNs = monotonicNanoseconds();
+  }
+
+  // apply mouse motion the frame's camera hasn't seen, total minus what the
+  // snapshot consumed, upload the matrices and return the view
+  glm::mat4 latch(const MouseTotal &total, double consumedX,
+                  double consumedY) {
+    const float mouseX = static_cast<float>(total.x - consumedX);
+    const float mouseY = static_cast<float>(total.y - consumedY);
+    const bool moved = enabled && (mouseX != 0.0f || mouseY != 0.0f);
+    Camera camera = frameCamera;
+    if (moved)
+      camera.ProcessMouseMovement(mouseX, mouseY);
+    const glm::mat4 view = camera.GetViewMatrix();
+
+    glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4), &view[0][0]);
+    glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), sizeof(glm::mat4),
+                    &frameProjection[0][0]);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+
+    if (hook) {
+      const float cosine =
+          std::clamp(glm::dot(camera.Front, frameCamera.Front), -1.0f, 1.0f);
+      hook({frameNs, monotonicNanoseconds(), moved ? total.ns : 0,
+            glm::degrees(std::acos(cosine))});
+    }
+    return view;
+  }
+
+private:
+  unsigned int buffer;
+  Camera frameCamera;
+  glm::mat4 frameProjection{1.0f};
+  std::uint64_t frameNs = 0;
+};
+
+#endif
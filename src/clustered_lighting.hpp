@@ -0,0 +1,173 @@
+#ifndef CLUSTERED_LIGHTING_HPP
+#define CLUSTERED_LIGHTING_HPP
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "deletion_queue.hpp"
+#include "job_system.hpp"
+#include "light_clusters.hpp"
+#include "shader.hpp"
+
+// a point light, its influence ends at radius
+struct PointLight {
+  glm::vec3 position;
+  float radius;
+  glm::vec3 color;
+};
+
+// Feeds many point lights to shader.fs by clusters. Every frame update()
+// assigns the lights to the clusters of the current view on the CPU and
+// uploads three buffer textures, GL 3.3 having no storage buffers: the
+// lights (position and radius, color), each cluster's first index and count,
+// and the index list. The fragment shader finds its cluster from
+// gl_FragCoord and its depth, and shades only the lights listed there.
+class ClusteredLighting {
+public:
+  // texture units of the buffer textures, clear of the material textures
+  static constexpr GLint FIRST_UNIT = 8;
+
+  ClusteredLighting() {
+    glGenBuffers(3, buffers);
+    glGenTextures(3, textures);
+    const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R32UI};
+    for (int i = 0; i < 3; ++i) {
+      glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+      glBufferData(GL_TEXTURE_BUFFER, 16, nullptr, GL_STREAM_DRAW);
+      glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+      glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+    }
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  }
+
+  ClusteredLighting(const ClusteredLighting &) = delete;
+  ClusteredLighting &operator=(const ClusteredLighting &) = delete;
+
+  ~ClusteredLighting() {
+    for (int i = 0; i < 3; ++i) {
+      retireGLObject(GLObject::Texture, textures[i]);
+      retireGLObject(GLObject::Buffer, buffers[i]);
+    }
+  }
+
+  // assign lights to the clusters of this view and upload the result
+  void update(const std::vector<PointLight> &lights, const glm::mat4 &view,
+              float fovy, float aspect, float near, float far,
+              JobSystem *jobs = nullptr) {
+    nearPlane = near;
+    farPlane = far;
+    clusters.setProjection(fovy, aspect, near, far);
+
+    spheres.resize(lights.size());
+    texels.resize(2 * lights.size());
+    for (std::size_t i = 0; i < lights.size(); ++i) {
+      const PointLight &light = lights[i];
+      glm::vec3 center = glm::vec3(view * glm::vec4(light.position, 1.0f));
+      spheres[i] = {center.x, center.y, -center.z, light.radius};
+      texels[2 * i] = glm::vec4(light.position, light.radius);
+      texels[2 * i + 1] = glm::vec4(light.color, 0.0f);
+    }
+    clusters.assign(spheres, jobs);
+
+    upload(0, texels.data(), texels.size() * sizeof(glm::vec4));
+    const std::vector<std::uint32_t> &grid = clusters.clusterGrid();
+    upload(1, grid.data(), grid.size() * sizeof(std::uint32_t));
+    const std::vector<std::uint32_t> &indices = clusters.indices();
+    upload(2, indices.data(), indices.size() * sizeof(std::uint32_t));
+  }
+
+  // bind the buffer textures and grid parameters, shader must be in use
+  void bind(Shader &shader) const {
+    const char *samplers[3] = {"clusterLights", "clusterGrid",
+                               "clusterIndices"};
+    for (int i = 0; i < 3; ++i) {
+      glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(FIRST_UNIT + i));
+      glBindTexture(GL_TEXTURE_BUFFER, textures[i]);
+      shader.setInt(samplers[i], FIRST_UNIT + i);
+    }
+    glActiveTexture(GL_TEXTURE0);
+
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    shader.setVec4("clusterViewport",
+                   glm::vec4(static_cast<float>(viewport[0]),
+                             static_cast<float>(viewport[1]),
+                             static_cast<float>(viewport[2]),
+                             static_cast<float>(viewport[3])));
+    shader.setVec4("clusterDepth",
+                   glm::vec4(nearPlane, farPlane, clusters.sliceScale(),
+                             clusters.sliceBias()));
+  }
+
+  // light references over all clusters in the last update()
+  std::size_t assignments() const { return clusters.indices().size(); }
+
+private:
+  LightClusters clusters;
+  std::vector<LightSphere> spheres;
+  std::vector<glm::vec4> texels;
+  float nearPlane = 0.1f, farPlane = 100.0f;
+  unsigned int buffers[3], textures[3];
+
+  // orphan the old contents, the GPU may still be shading with them
+  void upload(int i, const void *data, std::size_t size) {
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+    glBufferData(GL_TEXTURE_BUFFER,
+                 static_cast<GLsizeiptr>(std::max<std::size_t>(size, 16)),
+                 nullptr, GL_STREAM_DRAW);
+    if (size > 0)
+      glBufferSubData(GL_TEXTURE_BUFFER, 0, static_cast<GLsizeiptr>(size),
+                      data);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  }
+};
+
+// count lights, the first at seeds and the rest scattered through the box
+// from min to max with radii that shrink as the box fills up
+inline std::vector<PointLight>
+scatterLights(std::size_t count, const std::vector<glm::vec3> &seeds,
+              const glm::vec3 &min, const glm::vec3 &max) {
+  std::mt19937 random(7);
+  std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+  const float radius = std::max(
+      2.0f * glm::length(max - min) /
+          std::cbrt(static_cast<float>(std::max<std::size_t>(count, 1))),
+      1.0f);
+
+  std::vector<PointLight> lights;
+  for (std::size_t i = 0; i < count; ++i) {
+    glm::vec3 position =
+        i < seeds.size()
+            ? seeds[i]
+            : min + (max - min) * glm::vec3(unit(random), unit(random),
+                                            unit(random));
+    glm::vec3 color =
+        glm::normalize(glm::vec3(unit(random), unit(random), unit(random)) +
+                       0.2f);
+    lights.push_back({position, radius, color});
+  }
+  return lights;
+}
+
+// move lights around their rest positions
+inline void orbitLights(const std::vector<PointLight> &rest,
+                        std::vector<PointLight> &lights, float time) {
+  lights = rest;
+  for (std::size_t i = 0; i < lights.size(); ++i) {
+    const float phase = time + static_cast<float>(i) * 0.7f;
+    const glm::vec3 offset(std::cos(phase), 0.3f * std::sin(2.0f * phase),
+                           std::sin(phase));
+    lights[i].position += offset * (0.25f * rest[i].radius);
+  }
+}
+
+#endif
@@ -0,0 +1,272 @@
+#ifndef DEFERRED_HPP
+#define DEFERRED_HPP
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "clustered_lighting.hpp"
+#include "deletion_queue.hpp"
+#include "shader.hpp"
+
+// Deferred alternative to the forward shader.fs. The geometry pass writes
+// albedo with specular intensity, world space normals and linear view depth
+// into a G-buffer (the scene is drawn with shaders/gbuffer.fs in place of
+// shader.fs). shade() then lights it: a full screen pass adds ambient and
+// the key light, and every point light draws the back faces of a sphere
+// around itself, passing the depth test only where the scene lies inside
+// the sphere's depth range, so each light only costs the pixels it can
+// reach. Light accumulates additively into a half float target sharing the
+// G-buffer's depth, which is finally blitted to the output framebuffer.
+class DeferredRenderer {
+public:
+  // ambient and key light pass, takes the same light uniforms as shader.fs
+  Shader screenShader;
+
+  DeferredRenderer()
+      : screenShader("shaders/fullscreen.vs", "shaders/deferred.fs"),
+        volumeShader("shaders/light_volume.vs", "shaders/light_volume.fs") {
+    glGenFramebuffers(1, &gbuffer);
+    glGenFramebuffers(1, &lighting);
+    glGenTextures(3, targets);
+    glGenTextures(1, &accumulation);
+    glGenRenderbuffers(1, &depth);
+    glGenVertexArrays(1, &screenVAO);
+    setupSphere();
+    glGenBuffers(1, &lightBuffer);
+    glBindVertexArray(sphereVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, lightBuffer);
+    glEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, sizeof(PointLight),
+                          (void *)0);
+    glVertexAttribDivisor(1, 1);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(PointLight),
+                          (void *)offsetof(PointLight, color));
+    glVertexAttribDivisor(2, 1);
+    glBindVertexArray(0);
+  }
+
+  DeferredRenderer(const DeferredRenderer &) = delete;
+  DeferredRenderer &operator=(const DeferredRenderer &) = delete;
+
+  ~DeferredRenderer() {
+    retireGLObject(GLObject::VertexArray, screenVAO);
+    retireGLObject(GLObject::VertexArray, sphereVAO);
+    retireGLObject(GLObject::Buffer, sphereVBO);
+    retireGLObject(GLObject::Buffer, sphereEBO);
+    retireGLObject(GLObject::Buffer, lightBuffer);
+    for (unsigned int target : targets)
+      retireGLObject(GLObject::Texture, target);
+    retireGLObject(GLObject::Texture, accumulation);
+    glDeleteRenderbuffers(1, &depth);
+    glDeleteFramebuffers(1, &gbuffer);
+    glDeleteFramebuffers(1, &lighting);
+  }
+
+  // used and allocated size, see DynamicResolution::allocatedWidth()
+  void resize(int width, int height, int allocatedWidth, int allocatedHeight) {
+    this->width = width;
+    this->height = height;
+    if (allocatedWidth == this->allocatedWidth &&
+        allocatedHeight == this->allocatedHeight)
+      return;
+    this->allocatedWidth = allocatedWidth;
+    this->allocatedHeight = allocatedHeight;
+
+    const GLenum formats[3] = {GL_RGBA8, GL_RGBA16F, GL_R32F};
+    const GLenum layouts[3] = {GL_RGBA, GL_RGBA, GL_RED};
+    for (int i = 0; i < 3; ++i)
+      allocateTarget(targets[i], formats[i], layouts[i]);
+    allocateTarget(accumulation, GL_RGBA16F, GL_RGBA);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, allocatedWidth,
+                          allocatedHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, gbuffer);
+    for (int i = 0; i < 3; ++i)
+      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i,
+                             GL_TEXTURE_2D, targets[i], 0);
+    const GLenum attachments[3] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1,
+                                   GL_COLOR_ATTACHMENT2};
+    glDrawBuffers(3, attachments);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, depth);
+    checkFramebuffer("GBUFFER");
+
+    glBindFramebuffer(GL_FRAMEBUFFER, lighting);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           accumulation, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, depth);
+    checkFramebuffer("LIGHTING");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  // bind and clear the G-buffer, the scene draws into it next
+  void beginGeometry() {
+    glBindFramebuffer(GL_FRAMEBUFFER, gbuffer);
+    glViewport(0, 0, width, height);
+    // depth 0 marks pixels nothing covers
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  }
+
+  // light the G-buffer into output, left bound. screenShader must have its
+  // light uniforms set already
+  void shade(const std::vector<PointLight> &lights, const glm::mat4 &view,
+             const glm::mat4 &projection, const glm::vec3 &viewPos,
+             GLuint output = 0) {
+    glBindFramebuffer(GL_FRAMEBUFFER, lighting);
+    for (int i = 0; i < 3; ++i) {
+      glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(i));
+      glBindTexture(GL_TEXTURE_2D, targets[i]);
+    }
+
+    // ambient and key light, overwrites every pixel
+    glDisable(GL_DEPTH_TEST);
+    screenShader.use();
+    setShared(screenShader, view, projection, viewPos);
+    glBindVertexArray(screenVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+
+    if (!lights.empty()) {
+      glBindBuffer(GL_ARRAY_BUFFER, lightBuffer);
+      glBufferData(GL_ARRAY_BUFFER,
+                   static_cast<GLsizeiptr>(lights.size() * sizeof(PointLight)),
+                   lights.data(), GL_STREAM_DRAW);
+      glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+      // back faces behind the scene, clamped so volumes reaching past the
+      // far plane still cover what they light
+      volumeShader.use();
+      setShared(volumeShader, view, projection, viewPos);
+      volumeShader.setMat4("view", view);
+      volumeShader.setMat4("projection", projection);
+      glEnable(GL_DEPTH_TEST);
+      glDepthFunc(GL_GEQUAL);
+      glDepthMask(GL_FALSE);
+      glEnable(GL_DEPTH_CLAMP);
+      glEnable(GL_CULL_FACE);
+      glCullFace(GL_FRONT);
+      glEnable(GL_BLEND);
+      glBlendFunc(GL_ONE, GL_ONE);
+      glBindVertexArray(sphereVAO);
+      glDrawElementsInstanced(GL_TRIANGLES, sphereIndices, GL_UNSIGNED_SHORT,
+                              0, static_cast<GLsizei>(lights.size()));
+      glDisable(GL_BLEND);
+      glCullFace(GL_BACK);
+      glDisable(GL_CULL_FACE);
+      glDisable(GL_DEPTH_CLAMP);
+      glDepthMask(GL_TRUE);
+      glDepthFunc(GL_LESS);
+    }
+    glEnable(GL_DEPTH_TEST);
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, lighting);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, output);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, output);
+  }
+
+private:
+  Shader volumeShader;
+  // size in use and allocated
+  int width = 0, height = 0;
+  int allocatedWidth = 0, allocatedHeight = 0;
+  // albedo and specular, world space normal, linear view depth
+  unsigned int targets[3];
+  unsigned int gbuffer, lighting, accumulation, depth;
+  unsigned int screenVAO, sphereVAO, sphereVBO, sphereEBO, lightBuffer;
+  GLsizei sphereIndices = 0;
+
+  void allocateTarget(unsigned int texture, GLenum format, GLenum layout) {
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, static_cast<GLint>(format), allocatedWidth,
+                 allocatedHeight, 0, layout, GL_FLOAT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+  }
+
+  static void checkFramebuffer(const char *name) {
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      throw std::runtime_error(
+          std::string("DEFERRED::FRAMEBUFFER_INCOMPLETE ") + name);
+  }
+
+  // what both lighting passes need to rebuild positions from the G-buffer
+  void setShared(Shader &shader, const glm::mat4 &view,
+                 const glm::mat4 &projection, const glm::vec3 &viewPos) {
+    shader.setInt("gAlbedoSpec", 0);
+    shader.setInt("gNormal", 1);
+    shader.setInt("gDepth", 2);
+    shader.setVec3("viewPos", viewPos);
+    shader.setMat4("inverseView", glm::inverse(view));
+    shader.setVec2("tanHalfFov", glm::vec2(1.0f / projection[0][0],
+                                           1.0f / projection[1][1]));
+    shader.setVec4("viewport", glm::vec4(0.0f, 0.0f, static_cast<float>(width),
+                                         static_cast<float>(height)));
+  }
+
+  // unit sphere, pushed out so its flat faces still enclose the sphere
+  void setupSphere() {
+    const unsigned int stacks = 12, slices = 16;
+    const float pi = 3.14159265f;
+    const float grow = 1.0f / (std::cos(pi / stacks) * std::cos(pi / slices));
+    std::vector<glm::vec3> vertices;
+    for (unsigned int i = 0; i <= stacks; ++i) {
+      const float phi = pi * static_cast<float>(i) / stacks;
+      for (unsigned int j = 0; j <= slices; ++j) {
+        const float theta = 2.0f * pi * static_cast<float>(j) / slices;
+        vertices.push_back(grow * glm::vec3(std::sin(phi) * std::cos(theta),
+                                            std::cos(phi),
+                                            std::sin(phi) * std::sin(theta)));
+      }
+    }
+    // counter clockwise seen from outside
+    std::vector<unsigned short> indices;
+    for (unsigned int i = 0; i < stacks; ++i) {
+      for (unsigned int j = 0; j < slices; ++j) {
+        const unsigned short a =
+            static_cast<unsigned short>(i * (slices + 1) + j);
+        const unsigned short b = static_cast<unsigned short>(a + slices + 1);
+        indices.insert(indices.end(),
+                       {a, static_cast<unsigned short>(a + 1), b,
+                        static_cast<unsigned short>(a + 1),
+                        static_cast<unsigned short>(b + 1), b});
+      }
+    }
+    sphereIndices = static_cast<GLsizei>(indices.size());
+
+    glGenVertexArrays(1, &sphereVAO);
+    glGenBuffers(1, &sphereVBO);
+    glGenBuffers(1, &sphereEBO);
+    glBindVertexArray(sphereVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
+    glBufferData(GL_ARRAY_BUFFER,
+                 static_cast<GLsizeiptr>(vertices.size() * sizeof(glm::vec3)),
+                 vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 static_cast<GLsizeiptr>(indices.size() *
+                                         sizeof(unsigned short)),
+                 indices.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3),
+                          (void *)0);
+    glBindVertexArray(0);
+  }
+};
+
+#endif
@@ -0,0 +1,163 @@
+#ifndef DELETION_QUEUE_HPP
+#define DELETION_QUEUE_HPP
+
+#include <glad/glad.h>
+
+#include <atomic>
+#include <cstddef>
+#include <deque>
+#include <vector>
+
+#include "mpsc_queue.hpp"
+
+// kinds of GL objects that can be retired
+enum class GLObject { Buffer, Texture, VertexArray, Program };
+
+inline void deleteGLObjects(GLObject type, const std::vector<GLuint> &ids) {
+  if (ids.empty())
+    return;
+  const GLsizei count = static_cast<GLsizei>(ids.size());
+  switch (type) {
+  case GLObject::Buffer:
+    glDeleteBuffers(count, ids.data());
+    break;
+  case GLObject::Texture:
+    glDeleteTextures(count, ids.data());
+    break;
+  case GLObject::VertexArray:
+    glDeleteVertexArrays(count, ids.data());
+    break;
+  case GLObject::Program:
+    // no batched form for programs
+    for (GLuint id : ids)
+      glDeleteProgram(id);
+    break;
+  }
+}
+
+// Defers deleting GL objects until the GPU is done with them. Any thread may
+// retire() an object; the render thread calls frame() once per frame after
+// its draws, which fences everything retired since the previous call (a
+// draw earlier this frame may still use it) and deletes, one batched call
+// per object type, every earlier group whose fence has passed. While a queue
+// is installed, retireGLObject() routes through it.
+class DeletionQueue {
+public:
+  DeletionQueue() = default;
+
+  DeletionQueue(const DeletionQueue &) = delete;
+  DeletionQueue &operator=(const DeletionQueue &) = delete;
+
+  // on the render thread, everything still pending is deleted right away
+  ~DeletionQueue() {
+    if (installed().load(std::memory_order_acquire) == this)
+      uninstall();
+    while (!pending.empty()) {
+      glDeleteSync(pending.front().fence);
+      deleteBatch(pending.front());
+      pending.pop_front();
+    }
+    Batch batch;
+    takeRetired(batch);
+    deleteBatch(batch);
+  }
+
+  // make this the queue retireGLObject() uses
+  void install() { installed().store(this, std::memory_order_release); }
+  void uninstall() { installed().store(nullptr, std::memory_order_release); }
+  static DeletionQueue *current() {
+    return installed().load(std::memory_order_acquire);
+  }
+
+  // any thread, the object must not be used by draws issued after this
+  void retire(GLObject type, GLuint id) {
+    if (id != 0)
+      retired.push({type, id});
+  }
+
+  // render thread, returns how many objects were deleted
+  std::size_t frame() {
+    std::size_t deleted = 0;
+    while (!pending.empty() &&
+           glClientWaitSync(pending.front().fence, 0, 0) !=
+               GL_TIMEOUT_EXPIRED) {
+      glDeleteSync(pending.front().fence);
+      deleted += deleteBatch(pending.front());
+      pending.pop_front();
+    }
+
+    Batch batch;
+    if (takeRetired(batch)) {
+      batch.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      pending.push_back(std::move(batch));
+    }
+    return deleted;
+  }
+
+  // groups still waiting on their fence
+  std::size_t backlog() const { return pending.size(); }
+
+private:
+  struct Retired {
+    GLObject type = GLObject::Buffer;
+    GLuint id = 0;
+  };
+  struct Batch {
+    GLsync fence = nullptr;
+    std::vector<GLuint> buffers, textures, vertexArrays, programs;
+  };
+
+  MpscQueue<Retired> retired;
+  std::deque<Batch> pending;
+
+  static std::atomic<DeletionQueue *> &installed() {
+    static std::atomic<DeletionQueue *> queue{nullptr};
+    return queue;
+  }
+
+  bool takeRetired(Batch &batch) {
+    bool any = false;
+    Retired object;
+    while (retired.pop(object)) {
+      any = true;
+      switch (object.type) {
+      case GLObject::Buffer:
+        batch.buffers.push_back(object.id);
+        break;
+      case GLObject::Texture:
+        batch.textures.push_back(object.id);
+        break;
+      case GLObject::VertexArray:
+        batch.vertexArrays.push_back(object.id);
+        break;
+      case GLObject::Program:
+        batch.programs.push_back(object.id);
+        break;
+      }
+    }
+    return any;
+  }
+
+  static std::size_t deleteBatch(const Batch &batch) {
+    // vertex arrays first, they reference the buffers
+    deleteGLObjects(GLObject::VertexArray, batch.vertexArrays);
+    deleteGLObjects(GLObject::Buffer, batch.buffers);
+    deleteGLObjects(GLObject::Texture, batch.textures);
+    deleteGLObjects(GLObject::Program, batch.programs);
+    return batch.vertexArrays.size() + batch.buffers.size() +
+           batch.textures.size() + batch.programs.size();
+  }
+};
+
+// hand id to the installed deletion queue, or delete it right away when
+// there is none, which is only valid on the context thread
+inline void retireGLObject(GLObject type, GLuint id) {
+  if (id == 0)
+    return;
+  if (DeletionQueue *queue = DeletionQueue::current())
+    queue->retire(type, id);
+  else
+    deleteGLObjects(type, {id});
+}
+
+#endif
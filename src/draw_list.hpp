@@ -0,0 +1,214 @@
+#ifndef DRAW_LIST_HPP
+#define DRAW_LIST_HPP
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "frustum.hpp"
+#include "gpu_resources.hpp"
+#include "job_system.hpp"
+#include "model.hpp"
+#include "shader.hpp"
+#include "transform_system.hpp"
+
+// one draw with everything but the GL names resolved up front, replaying it
+// is a handful of GL calls and a handle lookup when the mesh changes
+struct DrawCommand {
+  // material in the high bits, mesh in the low bits
+  std::uint32_t key;
+  unsigned int material;
+  MeshHandle mesh;
+  glm::mat4 model;
+  glm::mat3 normal;
+};
+
+// Draws recorded by one thread. Recording touches no GL state, so any number
+// of lists can be filled at the same time.
+class CommandList {
+public:
+  std::vector<DrawCommand> commands;
+
+  std::size_t size() const { return commands.size(); }
+  void clear() { commands.clear(); }
+  void push(const DrawCommand &command) { commands.push_back(command); }
+
+  // group draws that share state so replay rebinds as little as possible
+  void sort() {
+    std::stable_sort(commands.begin(), commands.end(),
+                     [](const DrawCommand &a, const DrawCommand &b) {
+                       return a.key < b.key;
+                     });
+  }
+};
+
+// Draws many instances of a model one draw call each. Culling, composing
+// node transforms and resolving textures and uniforms happen in record(),
+// which splits the instances into slices and fills one CommandList per slice
+// on the job system. submit() runs on the GL thread and merges the lists by
+// replaying them in slice order, binding textures and VAOs only on change.
+class DrawList {
+public:
+  DrawList(Model &model, Shader &shader)
+      : model(model), shader(shader), sliceCount(1) {
+    modelLocation = glGetUniformLocation(shader.ID, "model");
+    normalLocation = glGetUniformLocation(shader.ID, "normalMatrix");
+    resolveMaterials();
+
+    glm::vec3 center = (model.aabbMin + model.aabbMax) * 0.5f;
+    bounds = glm::vec4(center, glm::length(model.aabbMax - center));
+  }
+
+  DrawList(const DrawList &) = delete;
+  DrawList &operator=(const DrawList &) = delete;
+
+  // number of slices recorded in parallel, at least one
+  void setSlices(unsigned int count) { sliceCount = std::max(count, 1u); }
+  unsigned int slices() const { return sliceCount; }
+
+  // cull instances against viewProjection and record the survivors
+  void record(const std::vector<InstanceData> &instances,
+              const glm::mat4 &viewProjection, JobSystem &jobs) {
+    model.nodes.update();
+    Frustum frustum(viewProjection);
+
+    lists.resize(sliceCount);
+    const std::size_t grain =
+        std::max<std::size_t>((instances.size() + sliceCount - 1) / sliceCount,
+                              1);
+    for (CommandList &list : lists)
+      list.clear();
+    jobs.parallelFor(0, instances.size(), grain,
+                     [&](std::size_t first, std::size_t last) {
+                       recordSlice(lists[first / grain], instances, frustum,
+                                   first, last);
+                     });
+  }
+
+  // replay the recorded draws, shader must be in use. Draws of meshes that
+  // were destroyed since recording fail their lookup and are skipped
+  void submit() {
+    unsigned int material = ~0u;
+    MeshHandle mesh;
+    MeshRecord record{0, 0};
+    for (const CommandList &list : lists) {
+      for (const DrawCommand &command : list.commands) {
+        if (command.mesh != mesh) {
+          mesh = command.mesh;
+          if (!gpuResources().meshes.get(mesh, record))
+            record = {0, 0};
+          glBindVertexArray(record.vao);
+        }
+        if (record.count == 0)
+          continue;
+        if (command.material != material) {
+          material = command.material;
+          bindMaterial(materials[material]);
+        }
+        glUniformMatrix4fv(modelLocation, 1, GL_FALSE,
+                           glm::value_ptr(command.model));
+        glUniformMatrix3fv(normalLocation, 1, GL_FALSE,
+                           glm::value_ptr(command.normal));
+        glDrawElements(GL_TRIANGLES, record.count, GL_UNSIGNED_INT, 0);
+      }
+    }
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  // draws recorded by the last record()
+  std::size_t size() const {
+    std::size_t count = 0;
+    for (const CommandList &list : lists)
+      count += list.size();
+    return count;
+  }
+
+private:
+  // texture for unit i and the sampler uniform that reads it
+  struct TextureBinding {
+    int location;
+    TextureHandle texture;
+
+    bool operator<(const TextureBinding &other) const {
+      return location != other.location
+                 ? location < other.location
+                 : texture.value < other.texture.value;
+    }
+  };
+  using Material = std::vector<TextureBinding>;
+
+  Model &model;
+  Shader &shader;
+  int modelLocation, normalLocation;
+  // object space bounding sphere of the model
+  glm::vec4 bounds;
+  // distinct texture sets and the one each mesh uses
+  std::vector<Material> materials;
+  std::vector<unsigned int> meshMaterial;
+  unsigned int sliceCount;
+  std::vector<CommandList> lists;
+
+  void resolveMaterials() {
+    std::map<Material, unsigned int> known;
+    for (const Mesh &mesh : model.meshList()) {
+      std::vector<std::string> names = mesh.samplerNames();
+      Material material;
+      for (std::size_t i = 0; i < mesh.textures.size(); ++i)
+        material.push_back(
+            {glGetUniformLocation(shader.ID, names[i].c_str()),
+             mesh.textures[i].handle});
+      auto [it, added] = known.try_emplace(
+          material, static_cast<unsigned int>(materials.size()));
+      if (added)
+        materials.push_back(material);
+      meshMaterial.push_back(it->second);
+    }
+  }
+
+  void bindMaterial(const Material &material) {
+    for (std::size_t i = 0; i < material.size(); ++i) {
+      glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(i));
+      glUniform1i(material[i].location, static_cast<GLint>(i));
+      glBindTexture(GL_TEXTURE_2D, textureId(material[i].texture));
+    }
+  }
+
+  void recordSlice(CommandList &list,
+                   const std::vector<InstanceData> &instances,
+                   const Frustum &frustum, std::size_t first,
+                   std::size_t last) {
+    const std::vector<Mesh> &meshes = model.meshList();
+    for (std::size_t i = first; i < last; ++i) {
+      const InstanceData &instance = instances[i];
+      float scale = std::max({glm::length(glm::vec3(instance.model[0])),
+                              glm::length(glm::vec3(instance.model[1])),
+                              glm::length(glm::vec3(instance.model[2]))});
+      glm::vec3 center =
+          glm::vec3(instance.model * glm::vec4(glm::vec3(bounds), 1.0f));
+      if (!frustum.intersectsSphere(center, bounds.w * scale))
+        continue;
+
+      const glm::mat3 normal = normalMatrix(instance);
+      for (std::size_t m = 0; m < meshes.size(); ++m) {
+        const Mesh &mesh = meshes[m];
+        list.push({.key = meshMaterial[m] << 16 |
+                          static_cast<std::uint32_t>(m & 0xffff),
+                   .material = meshMaterial[m],
+                   .mesh = mesh.handle,
+                   .model = instance.model * model.nodes.world[mesh.node],
+                   .normal = normal * model.nodes.normal[mesh.node]});
+      }
+    }
+    list.sort();
+  }
+};
+
+#endif
@@ -0,0 +1,168 @@
+#ifndef DYNAMIC_RESOLUTION_HPP
+#define DYNAMIC_RESOLUTION_HPP
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "deletion_queue.hpp"
+#include "gpu_timer.hpp"
+#include "resolution_controller.hpp"
+#include "shader.hpp"
+
+// Renders the frame into an offscreen target at a fraction of the window's
+// size, chosen by a ResolutionController from the measured GPU frame time,
+// then upscales it to the output framebuffer with a sharpening filter. The
+// target is allocated for the largest scale and smaller frames only use its
+// lower left corner, so scale changes cost no reallocation. Disabled, the
+// frame goes straight to the output framebuffer and is only timed.
+class DynamicResolution {
+public:
+  using Settings = ResolutionController::Settings;
+
+  // how much of the lost detail the upscale puts back, 0 to 1
+  float sharpness = 0.5f;
+  bool enabled;
+  // framebuffer frames are presented from, the window's by default
+  GLuint output = 0;
+
+  DynamicResolution(Settings settings, bool enabled)
+      : enabled(enabled), settings(settings), controller(settings),
+        upscaleShader("shaders/fullscreen.vs", "shaders/upscale.fs") {
+    glGenFramebuffers(1, &framebuffer);
+    glGenTextures(1, &color);
+    glGenRenderbuffers(1, &depth);
+    glGenVertexArrays(1, &screenVAO);
+  }
+
+  DynamicResolution(const DynamicResolution &) = delete;
+  DynamicResolution &operator=(const DynamicResolution &) = delete;
+
+  ~DynamicResolution() {
+    retireGLObject(GLObject::Texture, color);
+    retireGLObject(GLObject::VertexArray, screenVAO);
+    glDeleteRenderbuffers(1, &depth);
+    glDeleteFramebuffers(1, &framebuffer);
+  }
+
+  // start a frame for a window framebuffer of width by height: bind the
+  // target to render into and set the viewport to the part in use
+  void begin(int width, int height) {
+    windowWidth = width;
+    windowHeight = height;
+    const double scale = enabled ? controller.scale() : 1.0;
+    renderWidth = std::max(1, static_cast<int>(std::lround(width * scale)));
+    renderHeight = std::max(1, static_cast<int>(std::lround(height * scale)));
+
+    frameTimer.begin();
+    if (!enabled) {
+      glBindFramebuffer(GL_FRAMEBUFFER, output);
+      glViewport(0, 0, width, height);
+      return;
+    }
+    allocate();
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glViewport(0, 0, renderWidth, renderHeight);
+  }
+
+  // upscale into the output framebuffer and feed the controller the
+  // oldest finished GPU frame time. Returns whether the scale changed
+  bool end() {
+    if (enabled) {
+      glBindFramebuffer(GL_FRAMEBUFFER, output);
+      glViewport(0, 0, windowWidth, windowHeight);
+      glDisable(GL_DEPTH_TEST);
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, color);
+      upscaleShader.use();
+      upscaleShader.setInt("source", 0);
+      // the part of the target holding this frame, in texture coordinates
+      upscaleShader.setVec2(
+          "sourceScale",
+          glm::vec2(static_cast<float>(renderWidth) /
+                        static_cast<float>(targetWidth),
+                    static_cast<float>(renderHeight) /
+                        static_cast<float>(targetHeight)));
+      upscaleShader.setVec4(
+          "viewport", glm::vec4(0.0f, 0.0f, static_cast<float>(windowWidth),
+                                static_cast<float>(windowHeight)));
+      upscaleShader.setFloat("sharpness", sharpness);
+      glBindVertexArray(screenVAO);
+      glDrawArrays(GL_TRIANGLES, 0, 3);
+      glBindVertexArray(0);
+      glEnable(GL_DEPTH_TEST);
+    }
+    frameTimer.end();
+
+    double ms;
+    if (!frameTimer.result(ms))
+      return false;
+    lastMs = ms;
+    return enabled && controller.update(ms);
+  }
+
+  // framebuffer the scene renders into this frame
+  GLuint target() const { return enabled ? framebuffer : output; }
+  int width() const { return renderWidth; }
+  int height() const { return renderHeight; }
+  // size for other scene targets to allocate: the largest scale, or the
+  // window when disabled. Targets such as the G-buffer and the visibility
+  // IDs are allocated this large and render width() by height() into their
+  // lower left corner, so scale changes don't reallocate them either. Their
+  // passes address texels by pixel, so the corner needs no scaled texture
+  // coordinates
+  int allocatedWidth() const { return enabled ? targetWidth : windowWidth; }
+  int allocatedHeight() const { return enabled ? targetHeight : windowHeight; }
+  double scale() const { return enabled ? controller.scale() : 1.0; }
+  // latest GPU frame time, upscale included
+  double gpuMs() const { return lastMs; }
+
+private:
+  Settings settings;
+  ResolutionController controller;
+  Shader upscaleShader;
+  GpuTimer frameTimer;
+  unsigned int framebuffer, color, depth, screenVAO;
+  int windowWidth = 0, windowHeight = 0;
+  int renderWidth = 0, renderHeight = 0;
+  // allocated size, the window at the largest scale
+  int targetWidth = 0, targetHeight = 0;
+  double lastMs = 0.0;
+
+  void allocate() {
+    const int width = std::max(
+        1, static_cast<int>(std::lround(windowWidth * settings.maxScale)));
+    const int height = std::max(
+        1, static_cast<int>(std::lround(windowHeight * settings.maxScale)));
+    if (width == targetWidth && height == targetHeight)
+      return;
+    targetWidth = width;
+    targetHeight = height;
+
+    glBindTexture(GL_TEXTURE_2D, color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA,
+                 GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           color, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, depth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      throw std::runtime_error("DYNAMIC_RESOLUTION::FRAMEBUFFER_INCOMPLETE");
+  }
+};
+
+#endif
@@ -0,0 +1,73 @@
+#ifndef FRAGMENT_COUNTER_HPP
+#define FRAGMENT_COUNTER_HPP
+
+#include <glad/glad.h>
+
+#include <array>
+
+// Counts fragment shader invocations between begin() and end() with a
+// pipeline statistics query (GL 4.6 or ARB_pipeline_statistics_query), or
+// the samples passing the depth test where those are missing, which is the
+// same number unless the shader discards or early depth testing is off.
+// Like GpuTimer, results are collected a few frames late from a ring.
+// Occlusion queries can't nest, so the samples fallback must not be running
+// while OcclusionCuller issues its queries.
+class FragmentCounter {
+public:
+  static constexpr std::size_t LATENCY = 4;
+
+  FragmentCounter()
+      : target(GLAD_GL_VERSION_4_6 || GLAD_GL_ARB_pipeline_statistics_query
+                   ? GL_FRAGMENT_SHADER_INVOCATIONS
+                   : GL_SAMPLES_PASSED),
+        head(0), tail(0) {
+    glGenQueries(static_cast<GLsizei>(LATENCY), queries.data());
+  }
+
+  FragmentCounter(const FragmentCounter &) = delete;
+  FragmentCounter &operator=(const FragmentCounter &) = delete;
+
+  ~FragmentCounter() {
+    glDeleteQueries(static_cast<GLsizei>(LATENCY), queries.data());
+  }
+
+  // true when counting invocations, false for depth test samples
+  bool invocations() const { return target != GL_SAMPLES_PASSED; }
+
+  void begin() {
+    // drop the oldest count if nobody collected it in time
+    if (head - tail == LATENCY)
+      ++tail;
+    glBeginQuery(target, queries[head % LATENCY]);
+  }
+
+  void end() {
+    glEndQuery(target);
+    ++head;
+  }
+
+  // fetch the oldest finished count, if there is one
+  bool result(double &count) {
+    if (tail == head)
+      return false;
+
+    GLuint query = queries[tail % LATENCY];
+    GLint available = 0;
+    glGetQueryObjectiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+      return false;
+
+    GLuint64 value;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &value);
+    count = static_cast<double>(value);
+    ++tail;
+    return true;
+  }
+
+private:
+  GLenum target;
+  std::array<GLuint, LATENCY> queries;
+  std::size_t head, tail;
+};
+
+#endif
@@ -0,0 +1,150 @@
+#ifndef FRAME_PACER_HPP
+#define FRAME_PACER_HPP
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <stdexcept>
+#include <thread>
+
+#include "monotonic_clock.hpp"
+#include "options.hpp"
+#include "render_context.hpp"
+
+// Decides when the next frame may start. Three things hold it back:
+// - the swap interval, set once for the current context;
+// - a fence per frame in flight, so the CPU gets at most framesInFlight
+//   frames ahead of the GPU instead of however far the driver queues;
+// - an optional frame rate limit, slept towards and then spun out, since
+//   sleeping alone overshoots by a scheduler tick.
+class FramePacer {
+public:
+  struct Settings {
+    SwapMode swap = SwapMode::Vsync;
+    // frames per second, 0 for unlimited
+    double fpsLimit = 0.0;
+    unsigned int framesInFlight = 2;
+  };
+
+  static constexpr unsigned int MAX_FRAMES_IN_FLIGHT = 3;
+  // bounds of the time left to spin rather than sleep, adapted to how late
+  // sleeps actually wake up
+  static constexpr std::uint64_t MIN_SPIN_NS = 200000, MAX_SPIN_NS = 4000000;
+
+  explicit FramePacer(Settings settings)
+      : settings(settings), start(monotonicNanoseconds()), last(start),
+        deadline(start) {
+    if (settings.framesInFlight < 1 ||
+        settings.framesInFlight > MAX_FRAMES_IN_FLIGHT)
+      throw std::runtime_error("FRAME_PACER::INVALID_FRAMES_IN_FLIGHT");
+  }
+
+  FramePacer(const FramePacer &) = delete;
+  FramePacer &operator=(const FramePacer &) = delete;
+
+  ~FramePacer() {
+    for (GLsync fence : fences)
+      if (fence)
+        glDeleteSync(fence);
+  }
+
+  // set the swap interval of context, which must be current. Adaptive vsync
+  // needs the swap control tear extension and falls back to plain vsync
+  // without it. Returns the mode in effect
+  SwapMode applySwapInterval(RenderContext &context) {
+    SwapMode mode = settings.swap;
+    if (mode == SwapMode::Adaptive &&
+        !context.extensionSupported("WGL_EXT_swap_control_tear") &&
+        !context.extensionSupported("GLX_EXT_swap_control_tear"))
+      mode = SwapMode::Vsync;
+    context.setSwapInterval(mode == SwapMode::Off     ? 0
+                            : mode == SwapMode::Vsync ? 1
+                                                      : -1);
+    return mode;
+  }
+
+  // wait until the next frame may start and time it. Call before sampling
+  // input, so the wait doesn't add to its latency
+  void beginFrame() {
+    const std::uint64_t waitStart = monotonicNanoseconds();
+    // the frame framesInFlight back must be done on the GPU
+    GLsync &fence = fences[slot];
+    if (fence) {
+      GLenum status;
+      do
+        status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                  1000000000);
+      while (status == GL_TIMEOUT_EXPIRED);
+      glDeleteSync(fence);
+      fence = nullptr;
+    }
+    const std::uint64_t fenceEnd = monotonicNanoseconds();
+    fenceNs = fenceEnd - waitStart;
+
+    limitNs = 0;
+    if (settings.fpsLimit > 0.0) {
+      const auto period = static_cast<std::uint64_t>(1e9 / settings.fpsLimit);
+      // keep the average rate exact, but don't race to catch up after a
+      // long frame
+      deadline += period;
+      if (deadline + period < fenceEnd)
+        deadline = fenceEnd;
+      waitUntil(deadline);
+      limitNs = monotonicNanoseconds() - fenceEnd;
+    }
+
+    const std::uint64_t now = monotonicNanoseconds();
+    deltaNs = now - last;
+    last = now;
+  }
+
+  // fence this frame's commands, after the swap
+  void endFrame() {
+    fences[slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot = (slot + 1) % settings.framesInFlight;
+  }
+
+  // time between the starts of the last two frames
+  std::uint64_t deltaNanoseconds() const { return deltaNs; }
+  double deltaSeconds() const { return static_cast<double>(deltaNs) * 1e-9; }
+  // time since the pacer was created, at the start of this frame
+  double seconds() const { return static_cast<double>(last - start) * 1e-9; }
+  // how long beginFrame waited on the GPU and on the frame rate limit
+  double fenceMs() const { return static_cast<double>(fenceNs) * 1e-6; }
+  double limitMs() const { return static_cast<double>(limitNs) * 1e-6; }
+
+private:
+  Settings settings;
+  std::array<GLsync, MAX_FRAMES_IN_FLIGHT> fences{};
+  unsigned int slot = 0;
+  std::uint64_t start, last, deadline;
+  std::uint64_t deltaNs = 0, fenceNs = 0, limitNs = 0;
+  std::uint64_t spinNs = 2000000;
+
+  // sleep while the deadline is far, spin out the rest
+  void waitUntil(std::uint64_t until) {
+    for (;;) {
+      const std::uint64_t now = monotonicNanoseconds();
+      if (now >= until)
+        return;
+      const std::uint64_t left = until - now;
+      if (left <= spinNs) {
+        std::this_thread::yield();
+        continue;
+      }
+      const std::uint64_t request = left - spinNs;
+      std::this_thread::sleep_for(std::chrono::nanoseconds(request));
+      // spin for a little more than the worst recent oversleep, decaying
+      // slowly so one late wake up doesn't cost spinning forever
+      const std::uint64_t slept = monotonicNanoseconds() - now;
+      const std::uint64_t late = slept > request ? slept - request : 0;
+      spinNs = std::clamp(std::max(late + late / 4, spinNs - spinNs / 64),
+                          MIN_SPIN_NS, MAX_SPIN_NS);
+    }
+  }
+};
+
+#endif
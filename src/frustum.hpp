@@ -0,0 +1,49 @@
+#ifndef FRUSTUM_HPP
+#define FRUSTUM_HPP
+
+#include <glm/glm.hpp>
+
+// view frustum as six inward facing planes (xyz = normal, w = distance),
+// extracted from a combined projection * view matrix
+struct Frustum {
+  glm::vec4 planes[6];
+
+  Frustum(const glm::mat4 &viewProjection) {
+    const glm::mat4 &m = viewProjection;
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    planes[0] = row3 + row0; // left
+    planes[1] = row3 - row0; // right
+    planes[2] = row3 + row1; // bottom
+    planes[3] = row3 - row1; // top
+    planes[4] = row3 + row2; // near
+    planes[5] = row3 - row2; // far
+
+    for (glm::vec4 &plane : planes)
+      plane = plane / glm::length(glm::vec3(plane));
+  }
+
+  bool intersectsSphere(const glm::vec3 &center, float radius) const {
+    for (const glm::vec4 &plane : planes)
+      if (glm::dot(glm::vec3(plane), center) + plane.w < -radius)
+        return false;
+    return true;
+  }
+
+  bool intersectsBox(const glm::vec3 &aabbMin, const glm::vec3 &aabbMax) const {
+    for (const glm::vec4 &plane : planes) {
+      // the box corner furthest along the plane normal
+      glm::vec3 corner(plane.x >= 0.0f ? aabbMax.x : aabbMin.x,
+                       plane.y >= 0.0f ? aabbMax.y : aabbMin.y,
+                       plane.z >= 0.0f ? aabbMax.z : aabbMin.z);
+      if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+        return false;
+    }
+    return true;
+  }
+};
+
+#endif
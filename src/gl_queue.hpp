@@ -0,0 +1,128 @@
+#ifndef GL_QUEUE_HPP
+#define GL_QUEUE_HPP
+
+#include <glad/glad.h>
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <string>
+#include <thread>
+#include <utility>
+#include <variant>
+
+#include "deletion_queue.hpp"
+#include "image.hpp"
+#include "job_system.hpp"
+#include "mpsc_queue.hpp"
+#include "upload_scheduler.hpp"
+
+// Lets any thread ask for GL work without owning the context. Work items go
+// into a lock-free queue and run on the render thread when it calls drain()
+// at a point of its choosing each frame. Deletes and calls run right away in
+// the order they were queued; buffer and texture creation is handed to an
+// UploadScheduler that spreads it over frames within a budget. Objects made
+// on behalf of another thread come back through a callback that runs during
+// a later drain(), so it can safely make further GL calls.
+class GLQueue {
+public:
+  using Created = UploadScheduler::Created;
+
+  // the constructing thread is the one that drains
+  GLQueue() : renderThread(std::this_thread::get_id()) {}
+
+  bool onRenderThread() const {
+    return std::this_thread::get_id() == renderThread;
+  }
+
+  // new buffer holding size bytes of data, which must stay valid until
+  // created runs
+  void createBuffer(const void *data, std::size_t size, GLenum usage,
+                    Created created,
+                    std::shared_ptr<const UploadPriority> priority = nullptr) {
+    commands.push(CreateBuffer{data, size, usage, std::move(created),
+                               std::move(priority)});
+  }
+
+  // new texture from a decoded image, the queue frees the image afterwards
+  void uploadTexture(Image image, std::string path, Created created,
+                     std::shared_ptr<const UploadPriority> priority = nullptr) {
+    commands.push(UploadTexture{image, std::move(path), std::move(created),
+                                std::move(priority)});
+  }
+
+  // retire through the installed deletion queue when there is one, which
+  // takes any thread itself
+  void deleteObject(GLObject type, unsigned int id) {
+    if (id == 0)
+      return;
+    if (DeletionQueue *deletions = DeletionQueue::current())
+      deletions->retire(type, id);
+    else
+      commands.push(DeleteObject{type, id});
+  }
+
+  // anything else that needs the context, e.g. building a VAO
+  void call(Job job) { commands.push(Call{std::move(job)}); }
+
+  // render thread: take everything queued so far and upload within budget,
+  // returns how many items were taken
+  std::size_t drain() {
+    std::size_t count = 0;
+    Command command;
+    while (commands.pop(command)) {
+      std::visit([this](auto &item) { run(item); }, command);
+      ++count;
+    }
+    scheduler.run();
+    return count;
+  }
+
+  UploadScheduler &uploads() { return scheduler; }
+
+private:
+  struct CreateBuffer {
+    const void *data;
+    std::size_t size;
+    GLenum usage;
+    Created created;
+    std::shared_ptr<const UploadPriority> priority;
+  };
+  struct UploadTexture {
+    Image image;
+    std::string path;
+    Created created;
+    std::shared_ptr<const UploadPriority> priority;
+  };
+  struct DeleteObject {
+    GLObject type;
+    unsigned int id;
+  };
+  struct Call {
+    Job job;
+  };
+  using Command = std::variant<std::monostate, CreateBuffer, UploadTexture,
+                               DeleteObject, Call>;
+
+  std::thread::id renderThread;
+  MpscQueue<Command> commands;
+  UploadScheduler scheduler;
+
+  void run(std::monostate &) {}
+
+  void run(CreateBuffer &item) {
+    scheduler.addBuffer(item.data, item.size, item.usage,
+                        std::move(item.created), std::move(item.priority));
+  }
+
+  void run(UploadTexture &item) {
+    scheduler.addTexture(item.image, std::move(item.path),
+                         std::move(item.created), std::move(item.priority));
+  }
+
+  void run(DeleteObject &item) { deleteGLObjects(item.type, {item.id}); }
+
+  void run(Call &item) { item.job(); }
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef GPU_RESOURCES_HPP
+#define GPU_RESOURCES_HPP
+
+#include <glad/glad.h>
+
+#include "handle_table.hpp"
+
+// what a handle resolves to, small enough to copy on every lookup
+struct TextureRecord {
+  GLuint id;
+};
+struct MeshRecord {
+  GLuint vao;
+  GLsizei count;
+};
+struct ProgramRecord {
+  GLuint id;
+};
+
+using TextureHandle = Handle<TextureRecord>;
+using MeshHandle = Handle<MeshRecord>;
+using ProgramHandle = Handle<ProgramRecord>;
+
+// Process wide registry of the GL objects that draws refer to. Owners
+// (Model for textures, Mesh for its vertex array, Shader for its program)
+// register an object when they create it and release the handle before
+// retiring the object, so a handle kept past its owner resolves to nothing
+// rather than to a deleted or recycled GL name.
+struct GpuResources {
+  HandleTable<TextureRecord> textures;
+  HandleTable<MeshRecord> meshes;
+  HandleTable<ProgramRecord> programs;
+};
+
+inline GpuResources &gpuResources() {
+  static GpuResources resources;
+  return resources;
+}
+
+inline TextureHandle registerTexture(GLuint id) {
+  return gpuResources().textures.insert({id});
+}
+// texture name behind handle, 0 once it has been released
+inline GLuint textureId(TextureHandle handle) {
+  TextureRecord record{0};
+  return gpuResources().textures.get(handle, record) ? record.id : 0;
+}
+// invalidate handle and return the texture it named, for the caller to
+// delete, 0 if it was already released
+inline GLuint releaseTexture(TextureHandle handle) {
+  TextureRecord record{0};
+  gpuResources().textures.remove(handle, &record);
+  return record.id;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef GPU_TIMER_HPP
+#define GPU_TIMER_HPP
+
+#include <glad/glad.h>
+
+#include <array>
+
+// Measures GPU time between begin() and end() with GL_TIMESTAMP queries.
+// Results are collected a few frames late from a ring of query pairs so that
+// reading them never stalls the pipeline, and timestamps (unlike
+// GL_TIME_ELAPSED) can be nested inside other timers.
+class GpuTimer {
+public:
+  static constexpr std::size_t LATENCY = 4;
+
+  GpuTimer() : head(0), tail(0) {
+    glGenQueries(static_cast<GLsizei>(2 * LATENCY), queries.data());
+  }
+
+  GpuTimer(const GpuTimer &) = delete;
+  GpuTimer &operator=(const GpuTimer &) = delete;
+
+  ~GpuTimer() {
+    glDeleteQueries(static_cast<GLsizei>(2 * LATENCY), queries.data());
+  }
+
+  void begin() {
+    // drop the oldest measurement if nobody collected it in time
+    if (head - tail == LATENCY)
+      ++tail;
+    glQueryCounter(queries[2 * (head % LATENCY)], GL_TIMESTAMP);
+  }
+
+  void end() {
+    glQueryCounter(queries[2 * (head % LATENCY) + 1], GL_TIMESTAMP);
+    ++head;
+  }
+
+  // fetch the oldest finished measurement in milliseconds, if there is one
+  bool result(double &ms) {
+    if (tail == head)
+      return false;
+
+    const std::size_t slot = 2 * (tail % LATENCY);
+    GLint available = 0;
+    glGetQueryObjectiv(queries[slot + 1], GL_QUERY_RESULT_AVAILABLE,
+                       &available);
+    if (!available)
+      return false;
+
+    GLuint64 start, stop;
+    glGetQueryObjectui64v(queries[slot], GL_QUERY_RESULT, &start);
+    glGetQueryObjectui64v(queries[slot + 1], GL_QUERY_RESULT, &stop);
+    ms = static_cast<double>(stop - start) / 1.0e6;
+    ++tail;
+    return true;
+  }
+
+private:
+  std::array<GLuint, 2 * LATENCY> queries;
+  std::size_t head, tail;
+};
+
+#endif
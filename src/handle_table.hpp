@@ -0,0 +1,171 @@
+#ifndef HANDLE_TABLE_HPP
+#define HANDLE_TABLE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+// 32-bit reference into a HandleTable<T>: slot index in the low bits, the
+// slot's generation at insertion in the high bits. Zero is never valid.
+template <typename T> struct Handle {
+  static constexpr unsigned int INDEX_BITS = 20;
+  static constexpr std::uint32_t INDEX_MASK = (1u << INDEX_BITS) - 1;
+
+  std::uint32_t value = 0;
+
+  std::uint32_t index() const { return value & INDEX_MASK; }
+  std::uint32_t generation() const { return value >> INDEX_BITS; }
+  explicit operator bool() const { return value != 0; }
+  bool operator==(const Handle &) const = default;
+};
+
+// Pooled storage for small records addressed by generational handles. Inserting
+// and removing take a lock, looking up doesn't: every slot carries a generation
+// that is odd while the slot is live and bumped on removal and on reuse, so a
+// handle to a removed record no longer matches and get() fails instead of
+// returning whatever took its place. get() copies the record out word by word
+// and checks the generation again afterwards, which catches a removal racing
+// with the copy. Slots live in fixed chunks that never move, so lookups stay
+// valid while the table grows.
+template <typename T> class HandleTable {
+  static_assert(std::is_trivially_copyable_v<T> &&
+                    sizeof(T) % sizeof(std::uint32_t) == 0,
+                "records are copied while other threads may replace them");
+
+public:
+  using HandleType = Handle<T>;
+
+  HandleTable() {
+    for (std::atomic<Slot *> &chunk : chunks)
+      chunk.store(nullptr, std::memory_order_relaxed);
+  }
+
+  HandleTable(const HandleTable &) = delete;
+  HandleTable &operator=(const HandleTable &) = delete;
+
+  ~HandleTable() {
+    for (std::atomic<Slot *> &chunk : chunks)
+      delete[] chunk.load(std::memory_order_relaxed);
+  }
+
+  HandleType insert(const T &value) {
+    std::lock_guard<std::mutex> lock(mutex);
+    std::uint32_t index;
+    if (!freeSlots.empty()) {
+      index = freeSlots.back();
+      freeSlots.pop_back();
+    } else {
+      index = slotCount++;
+      if (index > HandleType::INDEX_MASK)
+        throw std::runtime_error("HANDLE_TABLE::FULL");
+      if (index % CHUNK_SIZE == 0)
+        chunks[index / CHUNK_SIZE].store(new Slot[CHUNK_SIZE],
+                                         std::memory_order_release);
+    }
+
+    Slot &target = slot(index);
+    const std::uint32_t generation =
+        (target.generation.load(std::memory_order_relaxed) + 1) &
+        GENERATION_MASK;
+    // readers that still match the old generation see the change below
+    std::atomic_thread_fence(std::memory_order_release);
+    target.store(value);
+    target.generation.store(generation, std::memory_order_release);
+    ++live;
+    return {generation << HandleType::INDEX_BITS | index};
+  }
+
+  // drop the record, copying it to removed first, false if already gone
+  bool remove(HandleType handle, T *removed = nullptr) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (!valid(handle))
+      return false;
+    Slot &target = slot(handle.index());
+    if (removed)
+      target.load(*removed);
+    target.generation.store((handle.generation() + 1) & GENERATION_MASK,
+                            std::memory_order_release);
+    freeSlots.push_back(handle.index());
+    --live;
+    return true;
+  }
+
+  // lock-free, false for a stale or null handle
+  bool get(HandleType handle, T &out) const {
+    const Slot *target = find(handle);
+    if (!target)
+      return false;
+    target->load(out);
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return target->generation.load(std::memory_order_relaxed) ==
+           handle.generation();
+  }
+
+  bool valid(HandleType handle) const { return find(handle) != nullptr; }
+
+  std::size_t size() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return live;
+  }
+
+private:
+  static constexpr std::uint32_t CHUNK_SIZE = 1024;
+  static constexpr std::uint32_t GENERATION_MASK =
+      (1u << (32 - HandleType::INDEX_BITS)) - 1;
+
+  static constexpr std::size_t WORDS = sizeof(T) / sizeof(std::uint32_t);
+
+  struct Slot {
+    // even while free, so a fresh slot never matches
+    std::atomic<std::uint32_t> generation{0};
+    // the record, as words that may be read while being overwritten
+    std::atomic<std::uint32_t> value[WORDS] = {};
+
+    void store(const T &record) {
+      std::uint32_t words[WORDS];
+      std::memcpy(words, &record, sizeof(T));
+      for (std::size_t i = 0; i < WORDS; ++i)
+        value[i].store(words[i], std::memory_order_relaxed);
+    }
+    void load(T &record) const {
+      std::uint32_t words[WORDS];
+      for (std::size_t i = 0; i < WORDS; ++i)
+        words[i] = value[i].load(std::memory_order_relaxed);
+      std::memcpy(&record, words, sizeof(T));
+    }
+  };
+
+  std::array<std::atomic<Slot *>, (HandleType::INDEX_MASK + 1) / CHUNK_SIZE>
+      chunks;
+  mutable std::mutex mutex;
+  std::vector<std::uint32_t> freeSlots;
+  std::uint32_t slotCount = 0;
+  std::size_t live = 0;
+
+  Slot &slot(std::uint32_t index) {
+    return chunks[index / CHUNK_SIZE].load(std::memory_order_relaxed)
+        [index % CHUNK_SIZE];
+  }
+
+  const Slot *find(HandleType handle) const {
+    if (!handle)
+      return nullptr;
+    const Slot *chunk = chunks[handle.index() / CHUNK_SIZE].load(
+        std::memory_order_acquire);
+    if (!chunk)
+      return nullptr;
+    const Slot &target = chunk[handle.index() % CHUNK_SIZE];
+    if (target.generation.load(std::memory_order_acquire) !=
+        handle.generation())
+      return nullptr;
+    return &target;
+  }
+};
+
+#endif
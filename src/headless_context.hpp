@@ -0,0 +1,186 @@
+#ifndef HEADLESS_CONTEXT_HPP
+#define HEADLESS_CONTEXT_HPP
+
+#include <glad/glad.h>
+
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+#include <atomic>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+
+#include "render_context.hpp"
+
+// A GL 3.3 core context without any window system, through EGL. Frames go
+// to a framebuffer object of a fixed size instead of a window. The display
+// is the first that works of Mesa's surfaceless platform (which includes
+// llvmpipe on machines without a GPU), the first EGL device (headless
+// NVIDIA drivers) and the default display.
+class HeadlessContext : public RenderContext {
+public:
+  // share, if given, lends its display and shares objects with the new
+  // context. A width of 0 makes no framebuffer, as for shared contexts
+  HeadlessContext(int width, int height,
+                  const HeadlessContext *share = nullptr)
+      : width(width), height(height) {
+    if (share) {
+      display = share->display;
+      config = share->config;
+    } else {
+      display = platformDisplay();
+      if (display == EGL_NO_DISPLAY ||
+          !eglInitialize(display, nullptr, nullptr))
+        throw std::runtime_error("HEADLESS::NO_DISPLAY");
+      ownsDisplay = true;
+      if (!hasExtension(eglQueryString(display, EGL_EXTENSIONS),
+                        "EGL_KHR_surfaceless_context"))
+        throw std::runtime_error("HEADLESS::NO_SURFACELESS_CONTEXT");
+      const EGLint configAttributes[] = {EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                                         EGL_NONE};
+      EGLint count = 0;
+      if (!eglChooseConfig(display, configAttributes, &config, 1, &count) ||
+          count == 0)
+        throw std::runtime_error("HEADLESS::NO_CONFIG");
+    }
+    // per thread, and this thread is the one creating contexts
+    if (!eglBindAPI(EGL_OPENGL_API))
+      throw std::runtime_error("HEADLESS::NO_OPENGL_API");
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION,
+        3,
+        EGL_CONTEXT_MINOR_VERSION,
+        3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK,
+        EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_NONE};
+    context = eglCreateContext(display, config,
+                               share ? share->context : EGL_NO_CONTEXT,
+                               contextAttributes);
+    if (context == EGL_NO_CONTEXT) {
+      if (ownsDisplay)
+        eglTerminate(display);
+      throw std::runtime_error("HEADLESS::CONTEXT_CREATION_FAILED");
+    }
+  }
+
+  HeadlessContext(const HeadlessContext &) = delete;
+  HeadlessContext &operator=(const HeadlessContext &) = delete;
+
+  // the framebuffer goes with the context, shared contexts have to be
+  // destroyed first
+  ~HeadlessContext() override {
+    eglDestroyContext(display, context);
+    if (ownsDisplay)
+      eglTerminate(display);
+  }
+
+  void makeCurrent() override {
+    eglBindAPI(EGL_OPENGL_API);
+    if (!eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context))
+      throw std::runtime_error("HEADLESS::MAKE_CURRENT_FAILED");
+  }
+  void release() override {
+    eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  }
+
+  // also creates the framebuffer, which needs the functions loaded
+  bool loadGL() override {
+    if (!gladLoadGLLoader(reinterpret_cast<GLADloadproc>(eglGetProcAddress)))
+      return false;
+    if (width > 0 && fbo == 0)
+      createFramebuffer();
+    return true;
+  }
+
+  GLuint framebuffer() const override { return fbo; }
+  void framebufferSize(int &w, int &h) const override {
+    w = width;
+    h = height;
+  }
+  // nothing to swap, but the commands should be on their way
+  void present() override { glFlush(); }
+  void setSwapInterval(int) override {}
+  bool extensionSupported(const char *) const override { return false; }
+
+  bool shouldClose() const override {
+    return closing.load(std::memory_order_relaxed);
+  }
+  void requestClose() override {
+    closing.store(true, std::memory_order_relaxed);
+  }
+
+  std::unique_ptr<RenderContext> createShared() override {
+    return std::make_unique<HeadlessContext>(0, 0, this);
+  }
+
+private:
+  EGLDisplay display = EGL_NO_DISPLAY;
+  EGLConfig config = nullptr;
+  EGLContext context = EGL_NO_CONTEXT;
+  bool ownsDisplay = false;
+  int width, height;
+  GLuint fbo = 0, color = 0, depth = 0;
+  std::atomic<bool> closing{false};
+
+  // whether a space separated extension list has name
+  static bool hasExtension(const char *extensions, const char *name) {
+    if (!extensions)
+      return false;
+    const std::size_t length = std::strlen(name);
+    for (const char *p = extensions; (p = std::strstr(p, name)); p += length)
+      if ((p == extensions || p[-1] == ' ') &&
+          (p[length] == ' ' || p[length] == '\0'))
+        return true;
+    return false;
+  }
+
+  static EGLDisplay platformDisplay() {
+    const char *client = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+    auto getPlatformDisplay = reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(
+        eglGetProcAddress("eglGetPlatformDisplayEXT"));
+    if (getPlatformDisplay &&
+        hasExtension(client, "EGL_MESA_platform_surfaceless")) {
+      EGLDisplay display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA,
+                                              EGL_DEFAULT_DISPLAY, nullptr);
+      if (display != EGL_NO_DISPLAY)
+        return display;
+    }
+    auto queryDevices = reinterpret_cast<PFNEGLQUERYDEVICESEXTPROC>(
+        eglGetProcAddress("eglQueryDevicesEXT"));
+    if (getPlatformDisplay && queryDevices &&
+        hasExtension(client, "EGL_EXT_platform_device")) {
+      EGLDeviceEXT device;
+      EGLint count = 0;
+      if (queryDevices(1, &device, &count) && count > 0) {
+        EGLDisplay display =
+            getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, nullptr);
+        if (display != EGL_NO_DISPLAY)
+          return display;
+      }
+    }
+    return eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  }
+
+  void createFramebuffer() {
+    glGenRenderbuffers(1, &color);
+    glBindRenderbuffer(GL_RENDERBUFFER, color);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+    glGenRenderbuffers(1, &depth);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, width, height);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glGenFramebuffers(1, &fbo);
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                              GL_RENDERBUFFER, color);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT,
+                              GL_RENDERBUFFER, depth);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      throw std::runtime_error("HEADLESS::FRAMEBUFFER_INCOMPLETE");
+  }
+};
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef IMAGE_HPP
+#define IMAGE_HPP
+
+#include <glad/glad.h>
+
+#include <iostream>
+#include <string>
+
+#include "stb_image.hpp"
+
+// decoded image, CPU side only so it can be produced on any thread
+struct Image {
+  int width = 0, height = 0, components = 0;
+  unsigned char *data = nullptr;
+};
+
+inline Image loadImage(const std::string &path) {
+  Image image;
+  image.data = stbi_load(path.c_str(), &image.width, &image.height,
+                         &image.components, 0);
+  return image;
+}
+
+inline void freeImage(Image &image) {
+  stbi_image_free(image.data);
+  image.data = nullptr;
+}
+
+// pixel format of image for glTexImage2D, 0 if it has none
+inline GLenum imageFormat(const Image &image) {
+  if (image.components == 1)
+    return GL_RED;
+  else if (image.components == 3)
+    return GL_RGB;
+  else if (image.components == 4)
+    return GL_RGBA;
+  return 0;
+}
+
+// filtering and wrapping every model texture uses
+inline void setTextureParameters() {
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+}
+
+inline void uploadTexture(unsigned int textureID, const Image &image,
+                          const std::string &path) {
+  if (image.data) {
+    GLenum format = imageFormat(image);
+    if (format == 0)
+      std::cerr << "Invalid image format for image: " << path << std::endl;
+
+    glBindTexture(GL_TEXTURE_2D, textureID);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format,
+                 GL_UNSIGNED_BYTE, image.data);
+    glGenerateMipmap(GL_TEXTURE_2D);
+    setTextureParameters();
+  } else {
+    std::cerr << "Texture failed to load at path: " << path << std::endl;
+  }
+}
+
+#endif
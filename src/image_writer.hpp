@@ -0,0 +1,104 @@
+#ifndef IMAGE_WRITER_HPP
+#define IMAGE_WRITER_HPP
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+// Encoders for 8 bit RGBA pixels as glReadPixels returns them, rows bottom
+// up. Plain functions of their arguments, so any thread can run them.
+// Both return false when the file couldn't be written.
+
+namespace image_writer_detail {
+
+inline void putBigEndian(std::vector<unsigned char> &out, std::uint32_t value) {
+  for (int shift = 24; shift >= 0; shift -= 8)
+    out.push_back(static_cast<unsigned char>(value >> shift));
+}
+
+// length, type, data and the CRC of type and data
+inline void putChunk(std::vector<unsigned char> &out, const char *type,
+                     const unsigned char *data, std::uint32_t length) {
+  putBigEndian(out, length);
+  const std::size_t start = out.size();
+  out.insert(out.end(), type, type + 4);
+  out.insert(out.end(), data, data + length);
+  const uLong crc = crc32(0L, out.data() + start, length + 4);
+  putBigEndian(out, static_cast<std::uint32_t>(crc));
+}
+
+inline bool writeFile(const std::string &path, const unsigned char *data,
+                      std::size_t size) {
+  std::FILE *file = std::fopen(path.c_str(), "wb");
+  if (!file)
+    return false;
+  const bool written = std::fwrite(data, 1, size, file) == size;
+  return std::fclose(file) == 0 && written;
+}
+
+} // namespace image_writer_detail
+
+// level is zlib's, the fastest by default: thumbnails are written by the
+// thousand and rarely read
+inline bool writePng(const std::string &path, int width, int height,
+                     const unsigned char *rgba, int level = Z_BEST_SPEED) {
+  using namespace image_writer_detail;
+  const std::size_t stride = static_cast<std::size_t>(width) * 4;
+  // each row top down, after a filter byte of 0, unfiltered
+  std::vector<unsigned char> rows((stride + 1) *
+                                  static_cast<std::size_t>(height));
+  for (int y = 0; y < height; ++y) {
+    unsigned char *row = rows.data() + static_cast<std::size_t>(y) *
+                                           (stride + 1);
+    row[0] = 0;
+    const unsigned char *source =
+        rgba + static_cast<std::size_t>(height - 1 - y) * stride;
+    std::copy(source, source + stride, row + 1);
+  }
+  uLongf compressedSize = compressBound(static_cast<uLong>(rows.size()));
+  std::vector<unsigned char> compressed(compressedSize);
+  if (compress2(compressed.data(), &compressedSize, rows.data(),
+                static_cast<uLong>(rows.size()), level) != Z_OK)
+    return false;
+
+  static const unsigned char SIGNATURE[] = {0x89, 'P',  'N',  'G',
+                                            '\r', '\n', 0x1a, '\n'};
+  std::vector<unsigned char> out(SIGNATURE, SIGNATURE + sizeof(SIGNATURE));
+  out.reserve(compressedSize + 64);
+  std::vector<unsigned char> header;
+  putBigEndian(header, static_cast<std::uint32_t>(width));
+  putBigEndian(header, static_cast<std::uint32_t>(height));
+  // 8 bits per channel, RGBA, deflate, adaptive filtering, no interlace
+  header.insert(header.end(), {8, 6, 0, 0, 0});
+  putChunk(out, "IHDR", header.data(),
+           static_cast<std::uint32_t>(header.size()));
+  putChunk(out, "IDAT", compressed.data(),
+           static_cast<std::uint32_t>(compressedSize));
+  putChunk(out, "IEND", nullptr, 0);
+  return writeFile(path, out.data(), out.size());
+}
+
+// binary PPM, alpha dropped. Larger files but next to no encoding time
+inline bool writePpm(const std::string &path, int width, int height,
+                     const unsigned char *rgba) {
+  using namespace image_writer_detail;
+  const std::string header = "P6\n" + std::to_string(width) + " " +
+                             std::to_string(height) + "\n255\n";
+  std::vector<unsigned char> out(header.begin(), header.end());
+  out.reserve(out.size() + static_cast<std::size_t>(width) *
+                               static_cast<std::size_t>(height) * 3);
+  for (int y = height - 1; y >= 0; --y) {
+    const unsigned char *pixel =
+        rgba + static_cast<std::size_t>(y) * static_cast<std::size_t>(width) *
+                   4;
+    for (int x = 0; x < width; ++x, pixel += 4)
+      out.insert(out.end(), pixel, pixel + 3);
+  }
+  return writeFile(path, out.data(), out.size());
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef INPUT_QUEUE_HPP
+#define INPUT_QUEUE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+// one input event, stamped with monotonicNanoseconds() when it arrived
+struct InputEvent {
+  enum class Type : std::uint8_t { Key, Mouse, Scroll };
+  Type type = Type::Mouse;
+  std::uint64_t ns = 0;
+  // Key: a Camera_Movement going down or up
+  int key = 0;
+  bool down = false;
+  // Mouse: motion, Scroll: y offset
+  float x = 0.0f, y = 0.0f;
+};
+
+// mouse motion queued since startup, see InputQueue::mouseTotal()
+struct MouseTotal {
+  double x = 0.0, y = 0.0;
+  // arrival of the newest motion, 0 before the first
+  std::uint64_t ns = 0;
+};
+
+// Lock-free ring of input events from the thread running the GLFW callbacks
+// to the one stepping the simulation, one producer and one consumer. Events
+// that don't fit are dropped and counted rather than blocking the producer.
+// The running total of mouse motion can be read from any thread, so the
+// renderer can see motion the consumer hasn't got to yet.
+class InputQueue {
+public:
+  // a few seconds of an 8 kHz mouse, power of two
+  static constexpr std::size_t CAPACITY = 32768;
+
+  // producer only
+  void push(const InputEvent &event) {
+    const std::size_t t = tail.load(std::memory_order_relaxed);
+    if (t - head.load(std::memory_order_acquire) == CAPACITY) {
+      droppedEvents.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    events[t & (CAPACITY - 1)] = event;
+    // only motion the consumer will see, or the totals drift from its own.
+    // x and y may tear by one event for readers, harmless for a camera
+    if (event.type == InputEvent::Type::Mouse) {
+      totalX.store(totalX.load(std::memory_order_relaxed) + event.x,
+                   std::memory_order_relaxed);
+      totalY.store(totalY.load(std::memory_order_relaxed) + event.y,
+                   std::memory_order_relaxed);
+      totalNs.store(event.ns, std::memory_order_relaxed);
+    }
+    tail.store(t + 1, std::memory_order_release);
+  }
+
+  // consumer only, false once the queue is empty
+  bool pop(InputEvent &event) {
+    const std::size_t h = head.load(std::memory_order_relaxed);
+    if (h == tail.load(std::memory_order_acquire))
+      return false;
+    event = events[h & (CAPACITY - 1)];
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+
+  MouseTotal mouseTotal() const {
+    return {totalX.load(std::memory_order_relaxed),
+            totalY.load(std::memory_order_relaxed),
+            totalNs.load(std::memory_order_relaxed)};
+  }
+
+  std::size_t dropped() const {
+    return droppedEvents.load(std::memory_order_relaxed);
+  }
+
+private:
+  std::array<InputEvent, CAPACITY> events;
+  // apart, so producer and consumer don't share a cache line
+  alignas(64) std::atomic<std::size_t> head{0};
+  alignas(64) std::atomic<std::size_t> tail{0};
+  alignas(64) std::atomic<double> totalX{0.0}, totalY{0.0};
+  std::atomic<std::uint64_t> totalNs{0};
+  std::atomic<std::size_t> droppedEvents{0};
+};
+
+#endif
@@ -0,0 +1,296 @@
+#ifndef INSTANCE_CULLING_HPP
+#define INSTANCE_CULLING_HPP
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "frustum.hpp"
+#include "job_system.hpp"
+#include "model.hpp"
+#include "options.hpp"
+#include "shader.hpp"
+#include "stream_buffer.hpp"
+#include "transform_system.hpp"
+
+// culling input, one per instance
+struct InstanceBounds {
+  InstanceData instance;
+  // world space bounding sphere, xyz = center, w = radius
+  glm::vec4 sphere;
+};
+
+// Frustum culls many instances of one model and draws the survivors.
+//
+// CullMode::CPU tests every bounding sphere on the CPU and uploads the
+// compacted transforms. CullMode::GPU runs the same test in a geometry shader
+// with rasterization disabled and captures the visible transforms with
+// transform feedback. On GL 4.x the captured count is written straight into
+// the indirect draw commands through a query buffer; on GL 3.3 it has to be
+// read back before an instanced draw. The CPU path writes the survivors
+// straight into a StreamBuffer region, which the draw then reads.
+class InstanceCuller {
+public:
+  InstanceCuller(Model &model, const std::vector<InstanceData> &transforms)
+      : model(model),
+        cullShader("shaders/cull.vs", nullptr, "shaders/cull.gs",
+                   {"instanceModel", "instanceNormal"}),
+        stream(GL_ARRAY_BUFFER,
+               std::max<std::size_t>(transforms.size(), 1) *
+                   sizeof(InstanceData)),
+        visibleCount(0) {
+    computeBounds(transforms);
+
+    useIndirect = (GLAD_GL_VERSION_4_0 || GLAD_GL_ARB_draw_indirect) &&
+                  (GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_query_buffer_object);
+
+    setupBuffers();
+    model.setInstanceBuffer(visibleBuffer);
+  }
+
+  InstanceCuller(const InstanceCuller &) = delete;
+  InstanceCuller &operator=(const InstanceCuller &) = delete;
+
+  ~InstanceCuller() {
+    glDeleteVertexArrays(1, &boundsVAO);
+    glDeleteBuffers(1, &boundsBuffer);
+    glDeleteBuffers(1, &visibleBuffer);
+    glDeleteBuffers(1, &indirectBuffer);
+    glDeleteQueries(1, &query);
+  }
+
+  // replace the transforms of moving instances, the count must not change
+  void update(const std::vector<InstanceData> &transforms) {
+    computeBounds(transforms);
+    glBindBuffer(GL_ARRAY_BUFFER, boundsBuffer);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceBounds),
+                 nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_ARRAY_BUFFER, 0,
+                    instances.size() * sizeof(InstanceBounds),
+                    instances.data());
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+  }
+
+  // the CPU path splits the instances across jobs when given a job system
+  void cull(const glm::mat4 &viewProjection, CullMode mode,
+            JobSystem *jobs = nullptr) {
+    this->mode = mode;
+    Frustum frustum(viewProjection);
+    if (mode == CullMode::CPU)
+      cullCPU(frustum, jobs);
+    else
+      cullGPU(frustum);
+  }
+
+  void Draw(Shader &shader) {
+    if (mode == CullMode::GPU && useIndirect) {
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+      model.DrawIndirect(shader);
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    } else if (visibleCount > 0) {
+      model.DrawInstanced(shader, visibleCount);
+    }
+    // the region written by cullCPU() may be reused once this draw is done
+    stream.endFrame();
+  }
+
+  // the same instances as Draw(), depth only. Call before Draw(), which
+  // ends the frame's use of the streamed instances
+  void DrawDepth(Shader &shader) {
+    if (mode == CullMode::GPU && useIndirect) {
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+      model.DrawDepthIndirect(shader);
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    } else if (visibleCount > 0) {
+      model.DrawDepthInstanced(shader, visibleCount);
+    }
+  }
+
+  std::size_t size() const { return instances.size(); }
+
+  // number of instances that survived the last cull, unknown to the CPU when
+  // the GPU feeds the count to an indirect draw
+  bool visibleKnown() const { return mode == CullMode::CPU || !useIndirect; }
+  unsigned int visibleInstances() const { return visibleCount; }
+
+  // buffer the CPU path streams visible instances through
+  const StreamBuffer &streamBuffer() const { return stream; }
+
+private:
+  Model &model;
+  Shader cullShader;
+  StreamBuffer stream;
+  std::vector<InstanceBounds> instances;
+  // per job survivors of the parallel CPU path
+  std::vector<std::vector<InstanceData>> chunks;
+  CullMode mode = CullMode::GPU;
+  bool useIndirect;
+  // whether the meshes read instances from stream rather than visibleBuffer
+  bool streaming = false;
+  unsigned int visibleCount;
+  std::size_t commandCount = 0;
+
+  unsigned int boundsVAO, boundsBuffer, visibleBuffer, indirectBuffer, query;
+
+  void computeBounds(const std::vector<InstanceData> &transforms) {
+    // bounding sphere of the model in object space
+    glm::vec3 center = (model.aabbMin + model.aabbMax) * 0.5f;
+    float radius = glm::length(model.aabbMax - center);
+
+    instances.resize(transforms.size());
+    for (std::size_t i = 0; i < transforms.size(); ++i) {
+      const glm::mat4 &transform = transforms[i].model;
+      float scale = std::max({glm::length(glm::vec3(transform[0])),
+                              glm::length(glm::vec3(transform[1])),
+                              glm::length(glm::vec3(transform[2]))});
+      instances[i] = {
+          transforms[i],
+          glm::vec4(glm::vec3(transform * glm::vec4(center, 1.0f)),
+                    radius * scale)};
+    }
+  }
+
+  void cullCPU(const Frustum &frustum, JobSystem *jobs) {
+    const std::size_t grain = 16384;
+    chunks.resize((instances.size() + grain - 1) / grain);
+
+    auto cullRange = [&](std::size_t first, std::size_t last) {
+      std::vector<InstanceData> &out = chunks[first / grain];
+      out.clear();
+      for (std::size_t i = first; i < last; ++i)
+        if (frustum.intersectsSphere(glm::vec3(instances[i].sphere),
+                                     instances[i].sphere.w))
+          out.push_back(instances[i].instance);
+    };
+    if (jobs) {
+      jobs->parallelFor(0, instances.size(), grain, cullRange);
+    } else {
+      for (std::size_t first = 0; first < instances.size(); first += grain)
+        cullRange(first, std::min(first + grain, instances.size()));
+    }
+
+    std::size_t count = 0;
+    for (const std::vector<InstanceData> &chunk : chunks)
+      count += chunk.size();
+    visibleCount = static_cast<unsigned int>(count);
+
+    // merge the survivors straight into this frame's region
+    stream.beginFrame();
+    GLintptr offset = 0;
+    char *out = static_cast<char *>(
+        stream.allocate(count * sizeof(InstanceData), offset));
+    if (out) {
+      for (const std::vector<InstanceData> &chunk : chunks) {
+        if (chunk.empty())
+          continue;
+        std::memcpy(out, chunk.data(), chunk.size() * sizeof(InstanceData));
+        out += chunk.size() * sizeof(InstanceData);
+      }
+      stream.commit();
+    }
+    // the region moves every frame, point the instance attributes at it
+    model.setInstanceBuffer(stream.buffer(),
+                            static_cast<std::size_t>(offset));
+    streaming = true;
+  }
+
+  void cullGPU(const Frustum &frustum) {
+    if (streaming) {
+      model.setInstanceBuffer(visibleBuffer);
+      streaming = false;
+    }
+    cullShader.use();
+    for (int i = 0; i < 6; ++i)
+      cullShader.setVec4("planes[" + std::to_string(i) + "]",
+                         frustum.planes[i]);
+
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, visibleBuffer);
+    glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, query);
+    glBeginTransformFeedback(GL_POINTS);
+    glBindVertexArray(boundsVAO);
+    glDrawArrays(GL_POINTS, 0, static_cast<GLsizei>(instances.size()));
+    glBindVertexArray(0);
+    glEndTransformFeedback();
+    glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDisable(GL_RASTERIZER_DISCARD);
+
+    if (useIndirect) {
+      // the GPU copies the count into every command's instanceCount
+      glBindBuffer(GL_QUERY_BUFFER, indirectBuffer);
+      for (std::size_t i = 0; i < commandCount; ++i)
+        glGetQueryObjectuiv(
+            query, GL_QUERY_RESULT,
+            (GLuint *)(i * sizeof(DrawElementsIndirectCommand) +
+                       offsetof(DrawElementsIndirectCommand, instanceCount)));
+      glBindBuffer(GL_QUERY_BUFFER, 0);
+    } else {
+      // GL 3.3 has no way to source a draw count from a buffer
+      glGetQueryObjectuiv(query, GL_QUERY_RESULT, &visibleCount);
+    }
+  }
+
+  void setupBuffers() {
+    glGenQueries(1, &query);
+
+    // culling input, the model and normal matrices at attributes 0 to 6 and
+    // the sphere at 7
+    glGenVertexArrays(1, &boundsVAO);
+    glGenBuffers(1, &boundsBuffer);
+    glBindVertexArray(boundsVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, boundsBuffer);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceBounds),
+                 instances.data(), GL_STATIC_DRAW);
+    for (unsigned int i = 0; i < 8; ++i) {
+      glEnableVertexAttribArray(i);
+      glVertexAttribPointer(i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceBounds),
+                            (void *)(i * sizeof(glm::vec4)));
+    }
+    glBindVertexArray(0);
+
+    // compacted transforms captured by the GPU path
+    glGenBuffers(1, &visibleBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, visibleBuffer);
+    glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceData),
+                 nullptr, GL_DYNAMIC_COPY);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    glGenBuffers(1, &indirectBuffer);
+    if (useIndirect) {
+      std::vector<DrawElementsIndirectCommand> commands =
+          model.indirectCommands();
+      commandCount = commands.size();
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, indirectBuffer);
+      glBufferData(GL_DRAW_INDIRECT_BUFFER,
+                   commands.size() * sizeof(DrawElementsIndirectCommand),
+                   commands.data(), GL_DYNAMIC_DRAW);
+      glBindBuffer(GL_DRAW_INDIRECT_BUFFER, 0);
+    }
+  }
+};
+
+// instance positions laid out on a cube shaped grid around the origin
+inline std::vector<glm::vec3> instanceGrid(unsigned int count, float spacing) {
+  std::vector<glm::vec3> positions;
+  positions.reserve(count);
+  const unsigned int side = static_cast<unsigned int>(
+      std::ceil(std::cbrt(static_cast<double>(count))));
+  const float offset = static_cast<float>(side - 1) * spacing * 0.5f;
+  for (unsigned int i = 0; i < count; ++i) {
+    glm::vec3 position(static_cast<float>(i % side),
+                       static_cast<float>(i / side % side),
+                       static_cast<float>(i / (side * side)));
+    positions.push_back(position * spacing - offset);
+  }
+  return positions;
+}
+
+#endif
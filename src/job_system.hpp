@@ -0,0 +1,282 @@
+#ifndef JOB_SYSTEM_HPP
+#define JOB_SYSTEM_HPP
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using Job = std::function<void()>;
+
+// Number of jobs still outstanding in a group. Waiting on a counter helps run
+// other jobs instead of blocking, and jobs submitted "after" a counter start
+// once it drops to zero.
+class JobCounter {
+public:
+  JobCounter() : pending(0) {}
+
+  JobCounter(const JobCounter &) = delete;
+  JobCounter &operator=(const JobCounter &) = delete;
+
+  bool done() const { return pending.load(std::memory_order_acquire) == 0; }
+
+private:
+  friend class JobSystem;
+
+  struct Continuation {
+    Job job;
+    JobCounter *counter;
+  };
+
+  std::atomic<int> pending;
+  std::mutex mutex;
+  std::vector<Continuation> continuations;
+};
+
+// Work stealing scheduler. Every worker owns a deque: it pushes and pops its
+// own jobs at the back (newest first, still warm in cache) while idle workers
+// steal from the front of the others. Threads outside the pool submit into a
+// shared slot. GL work must stay on the context thread, so jobs submitted
+// with submitMain() are queued until that thread calls runMainThreadJobs().
+class JobSystem {
+public:
+  explicit JobSystem(unsigned int workers = defaultWorkers())
+      : mainThread(std::this_thread::get_id()), queued(0), stopping(false) {
+    // slot 0 is shared by every thread that isn't a worker
+    for (unsigned int i = 0; i <= workers; ++i)
+      queues.push_back(std::make_unique<WorkQueue>());
+    for (unsigned int i = 1; i <= workers; ++i)
+      threads.emplace_back([this, i] { workerLoop(i); });
+  }
+
+  JobSystem(const JobSystem &) = delete;
+  JobSystem &operator=(const JobSystem &) = delete;
+
+  ~JobSystem() {
+    {
+      std::lock_guard<std::mutex> lock(sleepMutex);
+      stopping = true;
+    }
+    wake.notify_all();
+    for (std::thread &thread : threads)
+      thread.join();
+  }
+
+  static unsigned int defaultWorkers() {
+    unsigned int cores = std::thread::hardware_concurrency();
+    return cores > 1 ? cores - 1 : 1;
+  }
+
+  unsigned int workerCount() const {
+    return static_cast<unsigned int>(threads.size());
+  }
+
+  // run job on any thread, counter (if any) is decremented once it finishes
+  void submit(Job job, JobCounter *counter = nullptr) {
+    if (counter)
+      counter->pending.fetch_add(1, std::memory_order_relaxed);
+    push({std::move(job), counter});
+  }
+
+  // run job once dependency has no jobs left
+  void submitAfter(JobCounter &dependency, Job job,
+                   JobCounter *counter = nullptr) {
+    if (counter)
+      counter->pending.fetch_add(1, std::memory_order_relaxed);
+    {
+      std::lock_guard<std::mutex> lock(dependency.mutex);
+      if (!dependency.done()) {
+        dependency.continuations.push_back({std::move(job), counter});
+        return;
+      }
+    }
+    push({std::move(job), counter});
+  }
+
+  // run job on the thread that created the job system, for GL calls
+  void submitMain(Job job, JobCounter *counter = nullptr) {
+    if (counter)
+      counter->pending.fetch_add(1, std::memory_order_relaxed);
+    std::lock_guard<std::mutex> lock(mainMutex);
+    mainJobs.push_back({std::move(job), counter});
+  }
+
+  // keep counter from reaching zero while work tracked outside the job
+  // system is in flight, every retain() must be paired with a release()
+  void retain(JobCounter &counter) {
+    counter.pending.fetch_add(1, std::memory_order_relaxed);
+  }
+  void release(JobCounter &counter) { finish(counter); }
+
+  // called by the main thread at a point where GL work is safe
+  std::size_t runMainThreadJobs() {
+    std::vector<Task> jobs;
+    {
+      std::lock_guard<std::mutex> lock(mainMutex);
+      jobs.swap(mainJobs);
+    }
+    for (Task &task : jobs)
+      run(task);
+    return jobs.size();
+  }
+
+  // run one queued job on the calling thread, false if there was none
+  bool runOne() {
+    Task task;
+    if (!take(localIndex(), task))
+      return false;
+    run(task);
+    return true;
+  }
+
+  // help out with queued jobs until counter reaches zero
+  void wait(JobCounter &counter) {
+    const bool onMain = std::this_thread::get_id() == mainThread;
+    while (!counter.done()) {
+      Task task;
+      if (take(localIndex(), task))
+        run(task);
+      else if (!(onMain && runMainThreadJobs()))
+        std::this_thread::yield();
+    }
+    // the last finisher may still hold the lock, let it go before the
+    // caller is free to destroy the counter
+    std::lock_guard<std::mutex> lock(counter.mutex);
+  }
+
+  // split [begin, end) into chunks of at most grain and call f(first, last)
+  // on each in parallel, returning once all of them are done
+  template <typename F>
+  void parallelFor(std::size_t begin, std::size_t end, std::size_t grain,
+                   F &&f) {
+    if (begin >= end)
+      return;
+    grain = std::max<std::size_t>(grain, 1);
+    JobCounter counter;
+    for (std::size_t first = begin; first < end; first += grain) {
+      std::size_t last = std::min(first + grain, end);
+      submit([&f, first, last] { f(first, last); }, &counter);
+    }
+    wait(counter);
+  }
+
+private:
+  struct Task {
+    Job job;
+    JobCounter *counter = nullptr;
+  };
+
+  struct alignas(64) WorkQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  std::thread::id mainThread;
+  std::vector<std::unique_ptr<WorkQueue>> queues;
+  std::vector<std::thread> threads;
+
+  std::atomic<int> queued;
+  std::mutex sleepMutex;
+  std::condition_variable wake;
+  bool stopping;
+
+  std::mutex mainMutex;
+  std::vector<Task> mainJobs;
+
+  // index of the calling thread's queue in this system, 0 if not a worker
+  std::size_t localIndex() const {
+    return workerOwner() == this ? workerIndex() : 0;
+  }
+  static const JobSystem *&workerOwner() {
+    static thread_local const JobSystem *owner = nullptr;
+    return owner;
+  }
+  static std::size_t &workerIndex() {
+    static thread_local std::size_t index = 0;
+    return index;
+  }
+
+  void push(Task task) {
+    WorkQueue &queue = *queues[localIndex()];
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+    }
+    queued.fetch_add(1, std::memory_order_release);
+    // pair with the predicate check of a worker about to sleep
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    wake.notify_one();
+  }
+
+  // pop the newest local job, or steal the oldest from another queue
+  bool take(std::size_t self, Task &task) {
+    if (queued.load(std::memory_order_acquire) == 0)
+      return false;
+    {
+      WorkQueue &queue = *queues[self];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    for (std::size_t i = 1; i < queues.size(); ++i) {
+      WorkQueue &victim = *queues[(self + i) % queues.size()];
+      std::lock_guard<std::mutex> lock(victim.mutex);
+      if (!victim.tasks.empty()) {
+        task = std::move(victim.tasks.front());
+        victim.tasks.pop_front();
+        queued.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void run(Task &task) {
+    task.job();
+    if (task.counter)
+      finish(*task.counter);
+  }
+
+  void finish(JobCounter &counter) {
+    std::vector<JobCounter::Continuation> ready;
+    {
+      std::lock_guard<std::mutex> lock(counter.mutex);
+      if (counter.pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+        return;
+      ready.swap(counter.continuations);
+    }
+    for (JobCounter::Continuation &continuation : ready)
+      push({std::move(continuation.job), continuation.counter});
+  }
+
+  void workerLoop(std::size_t index) {
+    workerOwner() = this;
+    workerIndex() = index;
+    for (;;) {
+      Task task;
+      if (take(index, task)) {
+        run(task);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleepMutex);
+      wake.wait(lock, [this] {
+        return stopping || queued.load(std::memory_order_acquire) > 0;
+      });
+      if (stopping && queued.load(std::memory_order_acquire) == 0)
+        return;
+    }
+  }
+};
+
+#endif
@@ -0,0 +1,222 @@
+#ifndef LIGHT_CLUSTERS_HPP
+#define LIGHT_CLUSTERS_HPP
+
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "job_system.hpp"
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define LIGHT_CLUSTERS_SSE 1
+#endif
+
+// light bounds in view space, depth grows away from the camera (-z)
+struct LightSphere {
+  float x, y, depth, radius;
+};
+
+// Splits the view frustum into TILES_X * TILES_Y screen tiles and SLICES
+// depth slices, spaced exponentially so clusters stay roughly cubic, and
+// lists the lights touching each cluster. Every light is first sorted into
+// the slices its depth range covers, then tested against each cluster box
+// of those slices, four lights at a time. Slices are independent and run in
+// parallel on the job system.
+class LightClusters {
+public:
+  static constexpr unsigned int TILES_X = 16;
+  static constexpr unsigned int TILES_Y = 9;
+  static constexpr unsigned int SLICES = 24;
+  static constexpr unsigned int COUNT = TILES_X * TILES_Y * SLICES;
+
+  LightClusters() : boxes(COUNT), slices(SLICES), grid(2 * COUNT) {}
+
+  // rebuild the cluster boxes when the projection changed
+  void setProjection(float fovy, float aspect, float near, float far) {
+    if (fovy == shape[0] && aspect == shape[1] && near == shape[2] &&
+        far == shape[3])
+      return;
+    shape[0] = fovy;
+    shape[1] = aspect;
+    shape[2] = near;
+    shape[3] = far;
+
+    const float tanY = std::tan(fovy * 0.5f), tanX = tanY * aspect;
+    const float logRatio = std::log(far / near);
+    scale = static_cast<float>(SLICES) / logRatio;
+    bias = -static_cast<float>(SLICES) * std::log(near) / logRatio;
+    for (unsigned int z = 0; z <= SLICES; ++z)
+      sliceDepth[z] = near * std::exp(static_cast<float>(z) / scale);
+
+    for (unsigned int z = 0; z < SLICES; ++z) {
+      const float zn = sliceDepth[z], zf = sliceDepth[z + 1];
+      for (unsigned int y = 0; y < TILES_Y; ++y) {
+        for (unsigned int x = 0; x < TILES_X; ++x) {
+          // tile edges in NDC, scaled out to both depths of the slice
+          const float x0 = tileEdge(x, TILES_X) * tanX;
+          const float x1 = tileEdge(x + 1, TILES_X) * tanX;
+          const float y0 = tileEdge(y, TILES_Y) * tanY;
+          const float y1 = tileEdge(y + 1, TILES_Y) * tanY;
+          Box &box = boxes[index(x, y, z)];
+          box.minX = std::min(x0 * zn, x0 * zf);
+          box.maxX = std::max(x1 * zn, x1 * zf);
+          box.minY = std::min(y0 * zn, y0 * zf);
+          box.maxY = std::max(y1 * zn, y1 * zf);
+          box.minZ = zn;
+          box.maxZ = zf;
+        }
+      }
+    }
+  }
+
+  // fill the grid and index list, light i of lights is referred to as i
+  void assign(const std::vector<LightSphere> &lights, JobSystem *jobs) {
+    auto assignSlices = [&](std::size_t first, std::size_t last) {
+      for (std::size_t z = first; z < last; ++z)
+        assignSlice(static_cast<unsigned int>(z), lights);
+    };
+    if (jobs)
+      jobs->parallelFor(0, SLICES, 1, assignSlices);
+    else
+      assignSlices(0, SLICES);
+
+    // concatenate the slices, offsets become global
+    lightIndices.clear();
+    for (unsigned int z = 0; z < SLICES; ++z) {
+      const Slice &slice = slices[z];
+      const std::uint32_t base =
+          static_cast<std::uint32_t>(lightIndices.size());
+      for (unsigned int c = 0; c < TILES_X * TILES_Y; ++c) {
+        const std::size_t cluster = z * TILES_X * TILES_Y + c;
+        grid[2 * cluster] = base + slice.offsets[c];
+        grid[2 * cluster + 1] = slice.counts[c];
+      }
+      lightIndices.insert(lightIndices.end(), slice.indices.begin(),
+                          slice.indices.end());
+    }
+  }
+
+  // first index and light count of every cluster, x fastest then y then z
+  const std::vector<std::uint32_t> &clusterGrid() const { return grid; }
+  // light references of all clusters back to back
+  const std::vector<std::uint32_t> &indices() const { return lightIndices; }
+  // slice of view depth d is floor(log(d) * sliceScale() + sliceBias())
+  float sliceScale() const { return scale; }
+  float sliceBias() const { return bias; }
+
+private:
+  struct Box {
+    float minX, maxX, minY, maxY, minZ, maxZ;
+  };
+  // per slice scratch, reused between frames
+  struct Slice {
+    // lights overlapping the slice's depth range, padded to four
+    std::vector<float> x, y, depth, radius;
+    std::vector<std::uint32_t> light;
+    std::vector<std::uint32_t> indices;
+    std::uint32_t offsets[TILES_X * TILES_Y];
+    std::uint32_t counts[TILES_X * TILES_Y];
+  };
+
+  float shape[4] = {};
+  float scale = 0.0f, bias = 0.0f;
+  float sliceDepth[SLICES + 1] = {};
+  std::vector<Box> boxes;
+  std::vector<Slice> slices;
+  std::vector<std::uint32_t> grid;
+  std::vector<std::uint32_t> lightIndices;
+
+  static float tileEdge(unsigned int i, unsigned int count) {
+    return -1.0f + 2.0f * static_cast<float>(i) / static_cast<float>(count);
+  }
+  static std::size_t index(unsigned int x, unsigned int y, unsigned int z) {
+    return (z * TILES_Y + y) * TILES_X + x;
+  }
+
+  void assignSlice(unsigned int z, const std::vector<LightSphere> &lights) {
+    Slice &slice = slices[z];
+    slice.x.clear();
+    slice.y.clear();
+    slice.depth.clear();
+    slice.radius.clear();
+    slice.light.clear();
+    slice.indices.clear();
+    for (std::size_t i = 0; i < lights.size(); ++i) {
+      const LightSphere &light = lights[i];
+      if (light.depth + light.radius < sliceDepth[z] ||
+          light.depth - light.radius > sliceDepth[z + 1])
+        continue;
+      slice.x.push_back(light.x);
+      slice.y.push_back(light.y);
+      slice.depth.push_back(light.depth);
+      slice.radius.push_back(light.radius);
+      slice.light.push_back(static_cast<std::uint32_t>(i));
+    }
+    // padding lights sit infinitely far away with no radius
+    while (slice.x.size() % 4 != 0) {
+      slice.x.push_back(INFINITY);
+      slice.y.push_back(INFINITY);
+      slice.depth.push_back(INFINITY);
+      slice.radius.push_back(0.0f);
+      slice.light.push_back(0);
+    }
+
+    for (unsigned int c = 0; c < TILES_X * TILES_Y; ++c) {
+      slice.offsets[c] = static_cast<std::uint32_t>(slice.indices.size());
+      testCluster(slice, boxes[z * TILES_X * TILES_Y + c]);
+      slice.counts[c] =
+          static_cast<std::uint32_t>(slice.indices.size()) - slice.offsets[c];
+    }
+  }
+
+  // append the slice's lights whose sphere touches box
+  static void testCluster(Slice &slice, const Box &box) {
+    const std::size_t count = slice.x.size();
+    std::size_t i = 0;
+#ifdef LIGHT_CLUSTERS_SSE
+    const __m128 minX = _mm_set1_ps(box.minX), maxX = _mm_set1_ps(box.maxX);
+    const __m128 minY = _mm_set1_ps(box.minY), maxY = _mm_set1_ps(box.maxY);
+    const __m128 minZ = _mm_set1_ps(box.minZ), maxZ = _mm_set1_ps(box.maxZ);
+    const __m128 zero = _mm_setzero_ps();
+    for (; i + 4 <= count; i += 4) {
+      // distance from the sphere center to the box along each axis
+      const __m128 x = _mm_loadu_ps(&slice.x[i]);
+      const __m128 y = _mm_loadu_ps(&slice.y[i]);
+      const __m128 z = _mm_loadu_ps(&slice.depth[i]);
+      const __m128 r = _mm_loadu_ps(&slice.radius[i]);
+      const __m128 dx = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minX, x), zero),
+                                   _mm_max_ps(_mm_sub_ps(x, maxX), zero));
+      const __m128 dy = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minY, y), zero),
+                                   _mm_max_ps(_mm_sub_ps(y, maxY), zero));
+      const __m128 dz = _mm_add_ps(_mm_max_ps(_mm_sub_ps(minZ, z), zero),
+                                   _mm_max_ps(_mm_sub_ps(z, maxZ), zero));
+      const __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+          _mm_mul_ps(dz, dz));
+      int hits = _mm_movemask_ps(_mm_cmple_ps(distance, _mm_mul_ps(r, r)));
+      while (hits) {
+        const int lane = std::countr_zero(static_cast<unsigned int>(hits));
+        slice.indices.push_back(
+            slice.light[i + static_cast<std::size_t>(lane)]);
+        hits &= hits - 1;
+      }
+    }
+#endif
+    for (; i < count; ++i) {
+      const float dx = std::max(box.minX - slice.x[i], 0.0f) +
+                       std::max(slice.x[i] - box.maxX, 0.0f);
+      const float dy = std::max(box.minY - slice.y[i], 0.0f) +
+                       std::max(slice.y[i] - box.maxY, 0.0f);
+      const float dz = std::max(box.minZ - slice.depth[i], 0.0f) +
+                       std::max(slice.depth[i] - box.maxZ, 0.0f);
+      if (dx * dx + dy * dy + dz * dz <= slice.radius[i] * slice.radius[i])
+        slice.indices.push_back(slice.light[i]);
+    }
+  }
+};
+
+#endif
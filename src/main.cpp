@@ -2,14 +2,49 @@
 
 #include <GLFW/glfw3.h>
 
+#include <atomic>
+#include <chrono>
 #include <cmath>
+#include <exception>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <numbers>
+#include <optional>
+#include <thread>
 #include <stdexcept>
 
 #include "camera.hpp"
+#include "camera_latch.hpp"
+#include "clustered_lighting.hpp"
+#include "deferred.hpp"
+#include "deletion_queue.hpp"
+#include "draw_list.hpp"
+#include "dynamic_resolution.hpp"
+#include "fragment_counter.hpp"
+#include "frustum.hpp"
+#include "frame_pacer.hpp"
+#include "frame_stats.hpp"
+#include "gl_queue.hpp"
+#include "gpu_timer.hpp"
+#include "headless_context.hpp"
+#include "input_queue.hpp"
+#include "instance_culling.hpp"
+#include "job_system.hpp"
 #include "model.hpp"
+#include "monotonic_clock.hpp"
+#include "occlusion.hpp"
+#include "options.hpp"
+#include "render_context.hpp"
+#include "render_on_demand.hpp"
 #include "shader.hpp"
+#include "shadow_cascades.hpp"
+#include "simulation.hpp"
 #include "stb_image.hpp"
+#include "transform_system.hpp"
+#include "upload_thread.hpp"
+#include "visibility.hpp"
+#include "window_context.hpp"
 
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
@@ -21,22 +56,51 @@ using namespace std::string_literals;
 unsigned int SCR_WIDTH = 800;
 unsigned int SCR_HEIGHT = 600;
 
-// gamepad
+// gamepad, it has no events and is polled this often
 GLFWgamepadstate gpadState;
+const double GAMEPAD_HZ = 250.0;
 
 // clang-format off
-// camera
-Camera camera(glm::vec3(0.0f, 0.0f, 3.0f));
+// input events from the callbacks on the main thread, consumed by the
+// simulation. The rest of this block belongs to the main thread
+InputQueue input;
 float lastX = static_cast<float>(SCR_WIDTH) / 2.0f;
 float lastY = static_cast<float>(SCR_HEIGHT) / 2.0f;
 bool firstMouse = true;
+// movement keys held on the keyboard and on the gamepad
+bool keysHeld[4] = {}, padHeld[4] = {};
 
-// timing
+// timing, measured in nanoseconds by the frame pacer
 float deltaTime = 0.0f;
-float lastFrame = 0.0f;
+// skips frames when nothing changed, callbacks request new ones
+RenderOnDemand onDemand;
 
-// lighting
+// set by the callbacks on the main thread, read by the render thread
+std::atomic<int> surfaceWidth{0}, surfaceHeight{0};
+// E key, held for wireframe
+std::atomic<bool> wireframe = false;
+
+// culling
+std::atomic<bool> occlusionCulling = false;
+std::atomic<CullMode> cullMode = CullMode::GPU;
+
+// draw list recording jobs, doubled by the T key up to one per thread
+std::atomic<unsigned int> recordSlices = 1;
+
+// lighting, the L key steps through the clustered light counts
 glm::vec3 lightPos(1.2f, 1.0f, 2.0f);
+std::atomic<unsigned int> pointLightCount = 4;
+// G key steps through forward, deferred and visibility buffer shading
+std::atomic<Shading> shading = Shading::Forward;
+// P key toggles the depth prepass of the forward and deferred paths
+std::atomic<bool> depthPrepass = false;
+// U key sets the shadow casting sun moving, which refreshes its cascades
+std::atomic<bool> sunMoving = false;
+float sunAngle = 0.6f;
+// R key toggles scaling the render resolution to hold the GPU frame time
+std::atomic<bool> dynamicResolution = false;
+// K key toggles latching the camera right before the draws
+std::atomic<bool> lateLatch = true;
 
 glm::vec3 pointLightPositions[] = {
   glm::vec3( 0.7f,  0.2f,  2.0f),
@@ -46,153 +110,742 @@ glm::vec3 pointLightPositions[] = {
 };
 // clang-format on
 
-void processInput(GLFWwindow *pWindow);
+void pumpEvents(GLFWwindow *pWindow);
+bool pollGamepad();
 void mouse_callback(GLFWwindow *pWindow, double xpos, double ypos);
 void scroll_callback(GLFWwindow *pWindow, double xoffset, double yoffset);
+void key_callback(GLFWwindow *pWindow, int key, int scancode, int action,
+                  int mods);
 void framebuffer_size_callback(GLFWwindow *pWindow, int width, int height);
-
-int main() {
-  glfwInit();
-
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-  auto pWindow = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "OpenGL Window",
-                                  nullptr, nullptr);
-  if (pWindow == nullptr) {
-    char description[1024];
-    glfwGetError(reinterpret_cast<const char **>(&description));
-    throw std::runtime_error("GLFW::WINDOW::ERROR "s + description);
+void window_refresh_callback(GLFWwindow *pWindow);
+void window_iconify_callback(GLFWwindow *pWindow, int iconified);
+void window_focus_callback(GLFWwindow *pWindow, int focused);
+
+int main(int argc, char **argv) {
+  Options options = parseOptions(argc, argv);
+  cullMode = options.cullMode;
+  pointLightCount = options.lights;
+  shading = options.shading;
+  depthPrepass = options.depthPrepass;
+  dynamicResolution = options.dynamicResolution;
+  lateLatch = options.lateLatch;
+  onDemand.enabled = options.onDemand;
+  onDemand.backgroundFps = options.backgroundFps;
+
+  SCR_WIDTH = static_cast<unsigned int>(options.width);
+  SCR_HEIGHT = static_cast<unsigned int>(options.height);
+  // headless, nothing changes the picture but time, and nothing waits on
+  // events
+  if (options.headless)
+    onDemand.enabled = false;
+
+  std::unique_ptr<RenderContext> context;
+  GLFWwindow *pWindow = nullptr;
+  if (options.headless) {
+    context = std::make_unique<HeadlessContext>(options.width, options.height);
+  } else {
+    glfwInit();
+    auto window = std::make_unique<WindowContext>(
+        options.width, options.height, "OpenGL Window");
+    pWindow = window->window();
+    context = std::move(window);
+
+    glfwSetFramebufferSizeCallback(pWindow, framebuffer_size_callback);
+    glfwSetCursorPosCallback(pWindow, mouse_callback);
+    glfwSetScrollCallback(pWindow, scroll_callback);
+    glfwSetKeyCallback(pWindow, key_callback);
+    glfwSetWindowRefreshCallback(pWindow, window_refresh_callback);
+
+    glfwSetInputMode(pWindow, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
+    // unaccelerated motion, straight from the device
+    if (glfwRawMouseMotionSupported())
+      glfwSetInputMode(pWindow, GLFW_RAW_MOUSE_MOTION, GLFW_TRUE);
+    glfwSetWindowIconifyCallback(pWindow, window_iconify_callback);
+    glfwSetWindowFocusCallback(pWindow, window_focus_callback);
   }
-  glfwMakeContextCurrent(pWindow);
-
-  glfwSetFramebufferSizeCallback(pWindow, framebuffer_size_callback);
-  glfwSetCursorPosCallback(pWindow, mouse_callback);
-  glfwSetScrollCallback(pWindow, scroll_callback);
+  context->makeCurrent();
 
-  glfwSetInputMode(pWindow, GLFW_CURSOR, GLFW_CURSOR_DISABLED);
-
-  if (gladLoadGL() != GL_TRUE) {
+  if (!context->loadGL()) {
     std::cerr << "Failed to initialize GLAD" << std::endl;
     return EXIT_FAILURE;
   }
 
   std::cout << "Loaded OpenGL: " << glGetString(GL_VERSION) << std::endl;
 
+  int width, height;
+  context->framebufferSize(width, height);
+  surfaceWidth = width;
+  surfaceHeight = height;
+  // windows are only made on the main thread
+  std::unique_ptr<RenderContext> uploadContext =
+      options.stressLoad == StressLoad::Async ? context->createShared()
+                                              : nullptr;
+
   stbi_set_flip_vertically_on_load(true);
-  {
+  // everything GL, on the render thread
+  auto render = [&] {
     glEnable(GL_DEPTH_TEST);
 
+    // GL objects released by any thread, deleted once the GPU is done
+    DeletionQueue deletions;
+    deletions.install();
+
+    JobSystem jobs(options.workers < 0
+                       ? JobSystem::defaultWorkers()
+                       : static_cast<unsigned int>(options.workers));
+    Simulation simulation(Camera(glm::vec3(0.0f, 0.0f, 3.0f)), lightPos, input,
+                          jobs);
+    simulation.animate = options.animate;
+
     Shader shader("shaders/shader.vs", "shaders/shader.fs");
-    Model backpack("models/backpack/backpack.obj");
+    // the same vertex stages writing the G-buffer instead
+    Shader gbufferShader("shaders/shader.vs", "shaders/gbuffer.fs");
+    // positions only, writing nothing but depth
+    Shader depthShader("shaders/depth.vs", "shaders/depth.fs");
+    DeferredRenderer deferred;
+    // the scene's vertex stages read view and projection from here
+    CameraLatch cameraLatch;
+    for (const Shader *camera : {&shader, &gbufferShader, &depthShader})
+      CameraLatch::attach(*camera);
+    Model sceneModel(options.modelPath.c_str(), &jobs);
+    VisibilityRenderer visibility(sceneModel);
+    OcclusionCuller culler;
+
+    // optional instanced scene for culling throughput comparisons
+    std::optional<Shader> instancedShader, gbufferInstancedShader,
+        depthInstancedShader;
+    std::optional<InstanceCuller> instanceCuller;
+    // or one draw per instance, recorded on the job system, the lists cache
+    // uniform locations so each shader gets its own
+    std::optional<DrawList> drawList, gbufferDrawList;
+    std::vector<InstanceData> staticInstances;
+    if (options.instances > 0) {
+      float spacing =
+          1.5f * glm::length(sceneModel.aabbMax - sceneModel.aabbMin);
+      for (const glm::vec3 &position : instanceGrid(options.instances, spacing))
+        simulation.instances.add(position);
+      simulation.instances.update();
+      staticInstances = simulation.instances.instances;
+      if (options.drawLists) {
+        drawList.emplace(sceneModel, shader);
+        gbufferDrawList.emplace(sceneModel, gbufferShader);
+        recordSlices = jobs.workerCount() + 1;
+      } else {
+        instancedShader.emplace("shaders/instanced.vs", "shaders/shader.fs");
+        gbufferInstancedShader.emplace("shaders/instanced.vs",
+                                       "shaders/gbuffer.fs");
+        depthInstancedShader.emplace("shaders/depth_instanced.vs",
+                                     "shaders/depth.fs");
+        for (const Shader *camera : {&*instancedShader,
+                                     &*gbufferInstancedShader,
+                                     &*depthInstancedShader})
+          CameraLatch::attach(*camera);
+        instanceCuller.emplace(sceneModel, simulation.instances.instances);
+      }
+    }
 
-    while (!glfwWindowShouldClose(pWindow)) {
+    // GL work requested by other threads, run once per frame
+    GLQueue glQueue;
+    glQueue.uploads().setBudget(
+        {.milliseconds = options.uploadMilliseconds,
+         .bytes = static_cast<std::size_t>(options.uploadMegabytes * 1048576)});
+
+    // models loaded over and over to expose loading hitches
+    std::optional<UploadThread> uploads;
+    if (options.stressLoad == StressLoad::Async)
+      uploads.emplace(*uploadContext, jobs);
+    std::shared_ptr<Model> streamed;
+    unsigned int streamedLoads = 0;
+    std::uint64_t loadStart = 0;
+
+    // point lights scattered over the scene, animated around their rest
+    // positions and assigned to clusters every frame
+    ClusteredLighting clustered;
+    std::vector<PointLight> restLights, pointLights;
+    glm::vec3 lightsMin = sceneModel.aabbMin, lightsMax = sceneModel.aabbMax;
+    for (std::size_t i = 0; i < simulation.instances.size(); ++i) {
+      glm::vec3 position(simulation.instances.px[i],
+                         simulation.instances.py[i],
+                         simulation.instances.pz[i]);
+      lightsMin = glm::min(lightsMin, position + sceneModel.aabbMin);
+      lightsMax = glm::max(lightsMax, position + sceneModel.aabbMax);
+    }
+
+    // cascaded shadows of the sun, the bounds grown so rotated instances
+    // stay inside
+    ShadowCascades shadows;
+    const glm::vec3 modelExtent =
+        glm::vec3(glm::length(sceneModel.aabbMax - sceneModel.aabbMin) * 0.5f);
+    shadows.setSceneBounds(lightsMin - modelExtent, lightsMax + modelExtent);
+    const std::vector<InstanceData> noCasters;
+
+    // offscreen target sized from the GPU frame time, upscaled to the window
+    DynamicResolution resolution(
+        {options.targetMs, options.minScale, options.maxScale},
+        dynamicResolution);
+    resolution.output = context->framebuffer();
+
+    // swap interval, frame rate limit and frames in flight
+    FramePacer pacer(
+        {options.swap, options.fpsLimit, options.framesInFlight});
+    const char *swapNames[] = {"off", "vsync", "adaptive"};
+
+    FrameStats stats;
+    stats.log("swap interval "s +
+              swapNames[static_cast<int>(pacer.applySwapInterval(*context))]);
+    GpuTimer cullTimer, sceneTimer;
+    // fragments shaded by the scene pass and by the depth prepass
+    FragmentCounter sceneFragments, prepassFragments;
+    std::optional<Shading> lastShading;
+    bool lastIdle = false;
+    // running totals at the previous frame, stats get the change
+    std::size_t lastStalls = 0, lastDropped = 0;
+    // what latching gained: how much later the camera was sampled, and how
+    // far it turned meanwhile
+    cameraLatch.hook = [&](const CameraLatch::Sample &sample) {
+      stats.add("latch.ms",
+                static_cast<double>(sample.latchNs - sample.frameNs) * 1e-6);
+      stats.add("latch.deg", static_cast<double>(sample.degrees));
+      if (sample.inputNs != 0)
+        stats.add("latch.input",
+                  static_cast<double>(sample.latchNs - sample.inputNs) *
+                      1e-6);
+    };
+    // drives the light orbits, paused with the frames that aren't drawn
+    double lightTime = 0.0;
+    bool lastPrepass = !depthPrepass;
+    // overdraw and triangle size are what set the shading paths apart
+    stats.log("triangles " +
+              std::to_string(visibility.modelTriangles() *
+                             std::max<std::size_t>(staticInstances.size(), 1)));
+
+    // from here on the simulation state is only read through snapshots
+    if (options.threaded)
+      simulation.start(options.simulationRate);
+
+    unsigned int framesDrawn = 0;
+    while (!context->shouldClose()) {
       // per frame time logic
       // --------------------
-      float currentFrame = static_cast<float>(glfwGetTime());
-      deltaTime = currentFrame - lastFrame;
-      lastFrame = currentFrame;
+      pacer.beginFrame();
+      stats.add("pace.fence", pacer.fenceMs());
+      stats.add("pace.limit", pacer.limitMs());
+      deltaTime = static_cast<float>(pacer.deltaSeconds());
+
+      // input is queued by the main thread, see pumpEvents
+      glPolygonMode(GL_FRONT_AND_BACK, wireframe ? GL_LINE : GL_FILL);
+
+      // GL work handed back by jobs and other threads
+      jobs.runMainThreadJobs();
+      const std::size_t drained = glQueue.drain();
+      stats.add("gl.queue", static_cast<double>(drained));
+      stats.add("upload.depth",
+                static_cast<double>(glQueue.uploads().pending()));
+      if (drained > 0 || glQueue.uploads().pending() > 0)
+        onDemand.request();
+      stats.add("upload.ms", glQueue.uploads().lastMilliseconds);
+      stats.peak("upload.max", glQueue.uploads().lastMilliseconds);
+
+      if (options.stressLoad != StressLoad::Off) {
+        if (!streamed) {
+          loadStart = monotonicNanoseconds();
+          if (options.stressLoad == StressLoad::Queue)
+            streamed = std::make_shared<Model>(options.modelPath.c_str(), jobs,
+                                               glQueue);
+          else
+            streamed = std::make_shared<Model>(
+                options.modelPath.c_str(), &jobs,
+                uploads ? &*uploads : nullptr);
+        }
+        if (streamed->ready()) {
+          stats.log("load " + std::to_string(++streamedLoads) + " took " +
+                    std::to_string(static_cast<double>(
+                                       monotonicNanoseconds() - loadStart) *
+                                   1e-6) +
+                    " ms");
+          // unload off the render thread, the deletion queue takes it
+          jobs.submit(
+              [model = std::move(streamed)]() mutable { model.reset(); });
+        }
+      }
 
-      // input
-      // -----
-      processInput(pWindow);
+      // newest simulation state
+      if (!simulation.running())
+        simulation.step();
+      bool fresh;
+      const FrameSnapshot &snapshot = simulation.acquire(&fresh);
+      if (fresh) {
+        stats.add("sim", snapshot.simulationMs);
+        stats.add("input.events", static_cast<double>(snapshot.inputEvents));
+      }
+      // events lost to a full queue since the last frame
+      const std::size_t dropped = input.dropped();
+      stats.add("input.dropped", static_cast<double>(dropped - lastDropped));
+      lastDropped = dropped;
+
+      // nothing changed since the last frame drawn: wait for events instead
+      onDemand.watch(snapshot.view, snapshot.zoom);
+      if (options.animate || sunMoving || streamed)
+        onDemand.request();
+      if (!onDemand.shouldDraw()) {
+        if (onDemand.idle() && !lastIdle) {
+          stats.log("idle, waiting for changes");
+          lastIdle = true;
+        }
+        deletions.frame();
+        continue;
+      }
+      if (lastIdle) {
+        stats.log("drawing, " + std::to_string(onDemand.skipped()) +
+                  " frames skipped so far");
+        lastIdle = false;
+      }
+      // a frame after a long wait moves the lights a frame's worth
+      lightTime = std::fmod(lightTime + std::min(pacer.deltaSeconds(), 0.1),
+                            2.0 * std::numbers::pi);
 
       // render
       // ------
+      // into the dynamic resolution target, at its scale of the window
+      const int framebufferWidth = surfaceWidth;
+      const int framebufferHeight = surfaceHeight;
+      const bool minimized = framebufferWidth <= 0 || framebufferHeight <= 0;
+      if (!minimized) {
+        if (resolution.enabled != dynamicResolution) {
+          stats.log(dynamicResolution ? "dynamic resolution on"
+                                      : "dynamic resolution off");
+          resolution.enabled = dynamicResolution;
+        }
+        resolution.begin(framebufferWidth, framebufferHeight);
+      }
       glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
       glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+      // deferred frames draw the scene into the G-buffer, visibility frames
+      // into their ID buffer, both fall back to forward while minimized
+      const Shading frameShading =
+          minimized ? Shading::Forward : shading.load();
+      const bool deferredFrame = frameShading == Shading::Deferred;
+      const bool visibilityFrame = frameShading == Shading::Visibility;
+      if (frameShading != lastShading) {
+        const char *names[] = {"forward", "deferred", "visibility"};
+        stats.log("shading "s + names[static_cast<int>(frameShading)]);
+        lastShading = frameShading;
+      }
+      if (visibilityFrame)
+        visibility.resize(resolution.width(), resolution.height(),
+                          resolution.allocatedWidth(),
+                          resolution.allocatedHeight());
+      if (deferredFrame) {
+        deferred.resize(resolution.width(), resolution.height(),
+                        resolution.allocatedWidth(),
+                        resolution.allocatedHeight());
+        deferred.beginGeometry();
+      }
+
+      // light properties, shared by the forward and deferred shaders
+      auto setLight = [&](Shader &target) {
+        target.setVec3("viewPos", snapshot.viewPos);
+        target.setVec3("light.position", snapshot.lightPos);
+        target.setVec3("light.ambient", 0.1f, 0.1f, 0.1f);
+        target.setVec3("light.diffuse", 0.9f, 0.9f, 0.9f);
+        target.setVec3("light.specular", 1.0f, 1.0f, 1.0f);
+        target.setFloat("light.constant", 1.0f);
+        target.setFloat("light.linear", 0.09f);
+        target.setFloat("light.quadratic", 0.032f);
+      };
+
       // activate shader
-      shader.use();
-      shader.setVec3("viewPos", camera.Position);
-      // light properties
-      shader.setVec3("light.position", lightPos);
-      shader.setVec3("light.ambient", 0.1f, 0.1f, 0.1f);
-      shader.setVec3("light.diffuse", 0.9f, 0.9f, 0.9f);
-      shader.setVec3("light.specular", 1.0f, 1.0f, 1.0f);
-      shader.setFloat("light.constant", 1.0f);
-      shader.setFloat("light.linear", 0.09f);
-      shader.setFloat("light.quadratic", 0.032f);
+      Shader &active =
+          visibilityFrame ? visibility.shadingShader()
+          : deferredFrame
+              ? (instanceCuller ? *gbufferInstancedShader : gbufferShader)
+              : (instanceCuller ? *instancedShader : shader);
+      active.use();
+      setLight(active);
 
       glm::mat4 projection = glm::perspective(
-          glm::radians(camera.Zoom),
+          glm::radians(snapshot.zoom),
           static_cast<float>(SCR_WIDTH) / static_cast<float>(SCR_HEIGHT), 0.1f,
           100.0f);
-      glm::mat4 view = camera.GetViewMatrix();
-      shader.setMat4("projection", projection);
-      shader.setMat4("view", view);
+      const glm::mat4 &view = snapshot.view;
+      cameraLatch.beginFrame(snapshot.camera, projection);
+      // the streamed model reloads the scene model's file at the origin, so
+      // its bounds are known before its own load has computed them. Queued
+      // uploads drain at the start of the frame and see this next frame
+      if (streamed)
+        streamed->setUploadPriority(
+            Frustum(projection * view)
+                .intersectsBox(sceneModel.aabbMin, sceneModel.aabbMax),
+            glm::length(snapshot.viewPos));
+      // the camera the draws see, turned by the input that arrived while the
+      // frame was built. Called right before each path submits its draws
+      glm::mat4 drawView = view;
+      auto latchCamera = [&] {
+        cameraLatch.enabled = lateLatch;
+        drawView = cameraLatch.latch(input.mouseTotal(), snapshot.mouseX,
+                                     snapshot.mouseY);
+      };
+
+      // shadow cascades, the static casters only when the cache is stale
+      if (sunMoving)
+        sunAngle += deltaTime * 0.1f;
+      const glm::vec3 sunDirection =
+          glm::normalize(glm::vec3(0.5f * std::cos(sunAngle), -1.0f,
+                                   0.5f * std::sin(sunAngle)));
+      shadows.update(sunDirection, view, glm::radians(snapshot.zoom),
+                     static_cast<float>(SCR_WIDTH) /
+                         static_cast<float>(SCR_HEIGHT),
+                     0.1f, 50.0f);
+      // the scene model alone or the instance grid, dynamic when animated
+      const std::vector<InstanceData> sceneCaster{snapshot.sceneTransform};
+      const std::vector<InstanceData> &casters =
+          staticInstances.empty()        ? sceneCaster
+          : snapshot.instances.empty() ? staticInstances
+                                       : snapshot.instances;
+      auto shadowStart = std::chrono::steady_clock::now();
+      shadows.render(sceneModel, options.animate ? noCasters : casters,
+                     options.animate ? casters : noCasters);
+      stats.add("shadow.cpu", std::chrono::duration<double, std::milli>(
+                                  std::chrono::steady_clock::now() -
+                                  shadowStart)
+                                  .count());
+      stats.add("shadow.refresh", static_cast<double>(shadows.refreshed()));
+      stats.add("shadow.casters", static_cast<double>(shadows.castersDrawn()));
+      active.use();
+      shadows.bind(active);
+
+      if (pointLightCount != restLights.size()) {
+        restLights = scatterLights(
+            pointLightCount,
+            std::vector<glm::vec3>(std::begin(pointLightPositions),
+                                   std::end(pointLightPositions)),
+            lightsMin, lightsMax);
+        stats.log("point lights " + std::to_string(pointLightCount));
+      }
+      orbitLights(restLights, pointLights, static_cast<float>(lightTime));
+      // forward shading needs the lights sorted into clusters
+      if (!deferredFrame) {
+        auto lightsStart = std::chrono::steady_clock::now();
+        clustered.update(pointLights, view, glm::radians(snapshot.zoom),
+                         static_cast<float>(SCR_WIDTH) /
+                             static_cast<float>(SCR_HEIGHT),
+                         0.1f, 100.0f, &jobs);
+        stats.add("lights.assign",
+                  std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - lightsStart)
+                      .count());
+        stats.add("lights.refs",
+                  static_cast<double>(clustered.assignments()));
+        clustered.bind(active);
+      }
 
-      glm::mat4 model(1.0f);
-      model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
-      model = glm::scale(model, glm::vec3(1.0f, 1.0f, 1.0f));
-      shader.setMat4("model", model);
+      // the depth prepass has nothing to save the visibility buffer and isn't
+      // wired into the draw lists
+      const bool prepassFrame = depthPrepass && !visibilityFrame && !drawList;
+      if (prepassFrame != lastPrepass) {
+        stats.log(prepassFrame ? "depth prepass on" : "depth prepass off");
+        lastPrepass = prepassFrame;
+      }
+      // depth only pass, then leave depth read only and tested for equality
+      // so the shading pass runs once per pixel
+      auto drawPrepass = [&](Shader &depth, auto &&draw) {
+        depth.use();
+        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+        prepassFragments.begin();
+        draw(depth);
+        prepassFragments.end();
+        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+        glDepthFunc(GL_EQUAL);
+        glDepthMask(GL_FALSE);
+      };
+      sceneTimer.begin();
+
+      if (visibilityFrame) {
+        // every instance, unculled, the ID pass is cheap per triangle
+        if (staticInstances.empty())
+          visibility.setInstances({snapshot.sceneTransform});
+        else
+          visibility.setInstances(snapshot.instances.empty()
+                                      ? staticInstances
+                                      : snapshot.instances);
+        latchCamera();
+        visibility.render(drawView, projection, snapshot.viewPos,
+                          resolution.target());
+      } else if (drawList) {
+        DrawList &list = deferredFrame ? *gbufferDrawList : *drawList;
+        // doubled past the thread count: stop at one slice per thread first,
+        // which isn't a power of two with, say, five workers, then wrap
+        const unsigned int threads = jobs.workerCount() + 1;
+        if (recordSlices > threads)
+          recordSlices = list.slices() < threads ? threads : 1;
+        if (recordSlices != list.slices()) {
+          list.setSlices(recordSlices);
+          stats.log("draw list slices " + std::to_string(recordSlices));
+        }
+        // animated transforms come with the snapshot, static ones don't
+        const std::vector<InstanceData> &instances =
+            snapshot.instances.empty() ? staticInstances : snapshot.instances;
+
+        auto recordStart = std::chrono::steady_clock::now();
+        list.record(instances, projection * view, jobs);
+        latchCamera();
+        auto submitStart = std::chrono::steady_clock::now();
+        sceneFragments.begin();
+        list.submit();
+        sceneFragments.end();
+        auto submitEnd = std::chrono::steady_clock::now();
+        stats.add("record", std::chrono::duration<double, std::milli>(
+                                submitStart - recordStart)
+                                .count());
+        stats.add("submit", std::chrono::duration<double, std::milli>(
+                                submitEnd - submitStart)
+                                .count());
+        stats.add("draws", static_cast<double>(list.size()));
+      } else if (instanceCuller) {
+        if (fresh && !snapshot.instances.empty()) {
+          auto updateStart = std::chrono::steady_clock::now();
+          instanceCuller->update(snapshot.instances);
+          stats.add("bounds",
+                    std::chrono::duration<double, std::milli>(
+                        std::chrono::steady_clock::now() - updateStart)
+                        .count());
+        }
+
+        auto cullStart = std::chrono::steady_clock::now();
+        cullTimer.begin();
+        instanceCuller->cull(projection * view, cullMode, &jobs);
+        cullTimer.end();
+        stats.add("cull.cpu",
+                  std::chrono::duration<double, std::milli>(
+                      std::chrono::steady_clock::now() - cullStart)
+                      .count());
+        double cullGPU;
+        if (cullTimer.result(cullGPU))
+          stats.add("cull.gpu", cullGPU);
+        if (instanceCuller->visibleKnown())
+          stats.add("visible", instanceCuller->visibleInstances());
+
+        latchCamera();
+
+        if (prepassFrame)
+          drawPrepass(*depthInstancedShader,
+                      [&](Shader &depth) { instanceCuller->DrawDepth(depth); });
+        active.use();
+        sceneFragments.begin();
+        instanceCuller->Draw(active);
+        sceneFragments.end();
+        // times the CPU path waited on the GPU for a free region this frame
+        const std::size_t stalls = instanceCuller->streamBuffer().stalls();
+        stats.add("stream.stalls", static_cast<double>(stalls - lastStalls));
+        lastStalls = stalls;
+      } else {
+        latchCamera();
+        if (prepassFrame) {
+          // the box queries would fail GL_EQUAL, so no occlusion culling
+          drawPrepass(depthShader, [&](Shader &depth) {
+            sceneModel.DrawDepth(depth, snapshot.sceneTransform);
+          });
+          active.use();
+          sceneFragments.begin();
+          sceneModel.Draw(active, snapshot.sceneTransform);
+          sceneFragments.end();
+        } else {
+          culler.enabled = occlusionCulling;
+          culler.beginFrame(drawView, projection, snapshot.viewPos);
+          // occlusion queries can't run inside the samples passed fallback
+          const bool countFragments =
+              sceneFragments.invocations() || !occlusionCulling;
+          if (countFragments)
+            sceneFragments.begin();
+          sceneModel.Draw(active, culler, snapshot.sceneTransform);
+          if (countFragments)
+            sceneFragments.end();
+        }
+      }
+      if (prepassFrame) {
+        glDepthMask(GL_TRUE);
+        glDepthFunc(GL_LESS);
+      }
+      double fragments;
+      if (sceneFragments.result(fragments)) {
+        stats.add("fragments", fragments);
+        // shaded fragments per pixel, 1 at best with the prepass on
+        const double pixels = static_cast<double>(resolution.width()) *
+                              static_cast<double>(resolution.height());
+        if (pixels > 0.0)
+          stats.add("overdraw", fragments / pixels);
+      }
+      if (prepassFragments.result(fragments))
+        stats.add("fragments.prepass", fragments);
+      if (deferredFrame) {
+        deferred.screenShader.use();
+        setLight(deferred.screenShader);
+        shadows.bind(deferred.screenShader);
+        deferred.shade(pointLights, drawView, projection, snapshot.viewPos,
+                       resolution.target());
+      }
+      sceneTimer.end();
+      double sceneGPU;
+      if (sceneTimer.result(sceneGPU))
+        stats.add("scene.gpu", sceneGPU);
+      // upscale, and pick the next frame's scale from the GPU frame time
+      if (!minimized) {
+        if (resolution.end())
+          stats.log("resolution scale " + std::to_string(resolution.scale()) +
+                    " at gpu " + std::to_string(resolution.gpuMs()) + " ms");
+        stats.add("resolution", resolution.scale());
+        stats.add("frame.gpu", resolution.gpuMs());
+      }
+
+      // retire objects released this frame, delete those the GPU is done with
+      stats.add("gl.deleted", static_cast<double>(deletions.frame()));
 
-      backpack.Draw(shader);
+      context->present();
+      pacer.endFrame();
+      onDemand.drawn(snapshot.view, snapshot.zoom);
+      if (options.frames > 0 && ++framesDrawn == options.frames)
+        context->requestClose();
 
-      glfwSwapBuffers(pWindow);
-      glfwPollEvents();
+      stats.add("frame", pacer.deltaSeconds() * 1000.0);
+      stats.peak("frame.max", pacer.deltaSeconds() * 1000.0);
+      stats.endFrame(pacer.seconds());
     }
+    simulation.stop();
+    // queued deletes still need the context
+    streamed.reset();
+    glQueue.drain();
+  };
+
+  std::exception_ptr renderError;
+  auto renderOn = [&] {
+    context->makeCurrent();
+    try {
+      render();
+    } catch (...) {
+      renderError = std::current_exception();
+    }
+    context->release();
+    // stop the event loop, it may be waiting
+    context->requestClose();
+  };
+  if (pWindow) {
+    context->release();
+    std::thread renderThread(renderOn);
+    pumpEvents(pWindow);
+    renderThread.join();
+  } else {
+    // no events to wait for
+    renderOn();
   }
 
-  glfwDestroyWindow(pWindow);
-  glfwTerminate();
+  // shared contexts first, windows before GLFW goes
+  uploadContext.reset();
+  context.reset();
+  if (pWindow)
+    glfwTerminate();
+  if (renderError)
+    std::rethrow_exception(renderError);
 }
 
-void processInput([[maybe_unused]] GLFWwindow *pWindow) {
-  if (glfwGetKey(pWindow, GLFW_KEY_ESCAPE) == GLFW_PRESS)
-    glfwSetWindowShouldClose(pWindow, 1);
+// GLFW processes events on the main thread only. With rendering on a thread
+// of its own, this one just waits for them, so the callbacks stamp and queue
+// input as it arrives instead of once per frame. Gamepads have no events and
+// are polled at GAMEPAD_HZ.
+void pumpEvents(GLFWwindow *pWindow) {
+  bool gamepad = false;
+  while (!glfwWindowShouldClose(pWindow)) {
+    // without a gamepad, only to notice one being plugged in
+    glfwWaitEventsTimeout(gamepad ? 1.0 / GAMEPAD_HZ : 0.1);
+    gamepad = pollGamepad();
+  }
+  // the render thread may be waiting for a change
+  onDemand.request();
+}
 
-  if (glfwGetKey(pWindow, GLFW_KEY_E) == GLFW_PRESS)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-  else if (glfwGetKey(pWindow, GLFW_KEY_E) == GLFW_RELEASE)
-    glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+// a movement key went down or up on the keyboard or the gamepad, queue the
+// change of their combined state
+void holdKey(bool (&source)[4], Camera_Movement key, bool down) {
+  const bool before = keysHeld[key] || padHeld[key];
+  source[key] = down;
+  const bool after = keysHeld[key] || padHeld[key];
+  if (before == after)
+    return;
+  input.push({.type = InputEvent::Type::Key,
+              .ns = monotonicNanoseconds(),
+              .key = key,
+              .down = after});
+  onDemand.request();
+}
 
-  // Gamepad input
+// returns whether a gamepad is connected
+bool pollGamepad() {
+  bool held[4] = {};
+  const bool present = glfwJoystickPresent(GLFW_JOYSTICK_1) &&
+                       glfwJoystickIsGamepad(GLFW_JOYSTICK_1) &&
+                       glfwGetGamepadState(GLFW_JOYSTICK_1, &gpadState);
   const double DEADZONE = 0.15;
-  if (glfwJoystickPresent(GLFW_JOYSTICK_1) &&
-      glfwJoystickIsGamepad(GLFW_JOYSTICK_1)) {
-    if (glfwGetGamepadState(GLFW_JOYSTICK_1, &gpadState)) {
-      double input = 0.0;
-      input = gpadState.axes[GLFW_GAMEPAD_AXIS_LEFT_Y];
-      if (input) {
-        if (input > DEADZONE)
-          camera.ProcessKeyboard(FORWARD, deltaTime);
-        else if (input < -DEADZONE)
-          camera.ProcessKeyboard(BACKWARD, deltaTime);
-      }
-      input = gpadState.axes[GLFW_GAMEPAD_AXIS_LEFT_X];
-      if (input) {
-        if (input > DEADZONE)
-          camera.ProcessKeyboard(RIGHT, deltaTime);
-        else if (input < -DEADZONE)
-          camera.ProcessKeyboard(LEFT, deltaTime);
-      }
-      input = gpadState.axes[GLFW_GAMEPAD_AXIS_RIGHT_Y];
-      if (input < -DEADZONE || input > DEADZONE) {
-        camera.ProcessMouseScroll(-static_cast<float>(input));
-      }
-      input = gpadState.axes[GLFW_GAMEPAD_AXIS_LEFT_X];
-      if (input < -DEADZONE || input > DEADZONE) {
-        camera.ProcessMouseMovement(static_cast<float>(input), 0.0);
-      }
+  // the stick rates used to apply once per frame, keep them at 60 fps worth
+  const double perPoll = 60.0 / GAMEPAD_HZ;
+  if (present) {
+    const std::uint64_t now = monotonicNanoseconds();
+    double axis = 0.0;
+    axis = gpadState.axes[GLFW_GAMEPAD_AXIS_LEFT_Y];
+    if (axis) {
+      if (axis > DEADZONE)
+        held[FORWARD] = true;
+      else if (axis < -DEADZONE)
+        held[BACKWARD] = true;
+    }
+    axis = gpadState.axes[GLFW_GAMEPAD_AXIS_LEFT_X];
+    if (axis) {
+      if (axis > DEADZONE)
+        held[RIGHT] = true;
+      else if (axis < -DEADZONE)
+        held[LEFT] = true;
+    }
+    axis = gpadState.axes[GLFW_GAMEPAD_AXIS_RIGHT_Y];
+    if (axis < -DEADZONE || axis > DEADZONE) {
+      input.push({.type = InputEvent::Type::Scroll,
+                  .ns = now,
+                  .y = -static_cast<float>(axis * perPoll)});
+      onDemand.request();
+    }
+    axis = gpadState.axes[GLFW_GAMEPAD_AXIS_RIGHT_X];
+    if (axis < -DEADZONE || axis > DEADZONE) {
+      input.push({.type = InputEvent::Type::Mouse,
+                  .ns = now,
+                  .x = static_cast<float>(axis * perPoll)});
+      onDemand.request();
     }
   }
+  // a disconnected gamepad lets go of everything
+  for (int i = 0; i < 4; ++i)
+    holdKey(padHeld, static_cast<Camera_Movement>(i), held[i]);
+  return present;
+}
+
+void framebuffer_size_callback([[maybe_unused]] GLFWwindow *pWindow,
+                               int width, int height) {
+  // the render thread sets its viewport from these every frame
+  surfaceWidth = width;
+  surfaceHeight = height;
+  onDemand.request();
+}
+
+// the window's contents were lost, e.g. uncovered, and must be drawn again
+void window_refresh_callback([[maybe_unused]] GLFWwindow *pWindow) {
+  onDemand.request();
+}
 
-  // Keyboard input
-  if (glfwGetKey(pWindow, GLFW_KEY_W) == GLFW_PRESS)
-    camera.ProcessKeyboard(FORWARD, deltaTime);
-  if (glfwGetKey(pWindow, GLFW_KEY_S) == GLFW_PRESS)
-    camera.ProcessKeyboard(BACKWARD, deltaTime);
-  if (glfwGetKey(pWindow, GLFW_KEY_A) == GLFW_PRESS)
-    camera.ProcessKeyboard(LEFT, deltaTime);
-  if (glfwGetKey(pWindow, GLFW_KEY_D) == GLFW_PRESS)
-    camera.ProcessKeyboard(RIGHT, deltaTime);
+void window_iconify_callback([[maybe_unused]] GLFWwindow *pWindow,
+                             int iconified) {
+  onDemand.setIconified(iconified == GLFW_TRUE);
 }
 
-void framebuffer_size_callback([[maybe_unused]] GLFWwindow *pWindow, int width,
-                               int height) {
-  glViewport(0, 0, width, height);
+void window_focus_callback([[maybe_unused]] GLFWwindow *pWindow,
+                           int focused) {
+  onDemand.setFocused(focused == GLFW_TRUE);
 }
 
 void mouse_callback([[maybe_unused]] GLFWwindow *pWindow, double xposIn,
@@ -212,10 +865,87 @@ void mouse_callback([[maybe_unused]] GLFWwindow *pWindow, double xposIn,
   lastX = xpos;
   lastY = ypos;
 
-  camera.ProcessMouseMovement(xoffset, yoffset);
+  input.push({.type = InputEvent::Type::Mouse,
+              .ns = monotonicNanoseconds(),
+              .x = xoffset,
+              .y = yoffset});
+  onDemand.request();
 }
 
 void scroll_callback([[maybe_unused]] GLFWwindow *pWindow,
                      [[maybe_unused]] double xoffset, double yoffset) {
-  camera.ProcessMouseScroll(static_cast<float>(yoffset));
+  input.push({.type = InputEvent::Type::Scroll,
+              .ns = monotonicNanoseconds(),
+              .y = static_cast<float>(yoffset)});
+  onDemand.request();
+}
+
+void key_callback([[maybe_unused]] GLFWwindow *pWindow, int key,
+                  [[maybe_unused]] int scancode, int action,
+                  [[maybe_unused]] int mods) {
+  // toggles and the wireframe key change the picture
+  onDemand.request();
+  // movement keys go down and up at their own times, see Simulation::step
+  if (action != GLFW_REPEAT) {
+    const bool down = action == GLFW_PRESS;
+    switch (key) {
+    case GLFW_KEY_W:
+      holdKey(keysHeld, FORWARD, down);
+      break;
+    case GLFW_KEY_S:
+      holdKey(keysHeld, BACKWARD, down);
+      break;
+    case GLFW_KEY_A:
+      holdKey(keysHeld, LEFT, down);
+      break;
+    case GLFW_KEY_D:
+      holdKey(keysHeld, RIGHT, down);
+      break;
+    case GLFW_KEY_E:
+      wireframe = down;
+      break;
+    case GLFW_KEY_ESCAPE:
+      if (down)
+        glfwSetWindowShouldClose(pWindow, 1);
+      break;
+    }
+  }
+  if (action != GLFW_PRESS)
+    return;
+
+  // toggles
+  if (key == GLFW_KEY_O) {
+    occlusionCulling = !occlusionCulling;
+    std::cout << "Occlusion culling: " << (occlusionCulling ? "on" : "off")
+              << std::endl;
+  } else if (key == GLFW_KEY_C) {
+    cullMode = cullMode == CullMode::CPU ? CullMode::GPU : CullMode::CPU;
+    std::cout << "Instance culling: "
+              << (cullMode == CullMode::CPU ? "cpu" : "gpu") << std::endl;
+  } else if (key == GLFW_KEY_T) {
+    // clamped to the thread count and wrapped back to one in the render loop
+    recordSlices = recordSlices * 2;
+  } else if (key == GLFW_KEY_G) {
+    shading = shading == Shading::Forward    ? Shading::Deferred
+              : shading == Shading::Deferred ? Shading::Visibility
+                                             : Shading::Forward;
+  } else if (key == GLFW_KEY_P) {
+    depthPrepass = !depthPrepass;
+  } else if (key == GLFW_KEY_U) {
+    sunMoving = !sunMoving;
+  } else if (key == GLFW_KEY_R) {
+    dynamicResolution = !dynamicResolution;
+  } else if (key == GLFW_KEY_K) {
+    lateLatch = !lateLatch;
+  } else if (key == GLFW_KEY_L) {
+    // the counts to compare frame times at
+    const unsigned int counts[] = {4, 64, 256, 1024};
+    unsigned int next = counts[0];
+    for (unsigned int count : counts)
+      if (count > pointLightCount) {
+        next = count;
+        break;
+      }
+    pointLightCount = next;
+  }
 }
@@ -4,9 +4,14 @@
 #include <glad/glad.h>
 
 #include <glm/glm.hpp>
+#include <string>
 #include <vector>
 
+#include "deletion_queue.hpp"
+#include "gl_queue.hpp"
+#include "gpu_resources.hpp"
 #include "shader.hpp"
+#include "transform_system.hpp"
 
 #define MAX_BONE_INFLUENCE 4
 
@@ -27,10 +32,36 @@ struct Vertex {
   float m_Weights[MAX_BONE_INFLUENCE];
 };
 
+// layout consumed by glDrawElementsIndirect
+struct DrawElementsIndirectCommand {
+  unsigned int count;
+  unsigned int instanceCount;
+  unsigned int firstIndex;
+  int baseVertex;
+  unsigned int baseInstance;
+};
+
+// how a material uses a texture, picks the sampler it is bound to
+enum class TextureType { Diffuse, Specular, Normal, Height };
+
+inline const char *samplerPrefix(TextureType type) {
+  switch (type) {
+  case TextureType::Specular:
+    return "texture_specular";
+  case TextureType::Normal:
+    return "texture_normal";
+  case TextureType::Height:
+    return "texture_height";
+  default:
+    return "texture_diffuse";
+  }
+}
+
+// textures are shared between meshes and owned by their model, a mesh only
+// keeps a handle that stops resolving once the model releases the texture
 struct Texture {
-  unsigned int id;
-  std::string path;
-  std::string type;
+  TextureHandle handle;
+  TextureType type;
 };
 
 class Mesh {
@@ -40,14 +71,33 @@ public:
   std::vector<unsigned int> indices;
   std::vector<Texture> textures;
   unsigned int VAO;
+  // VAO and index count, for draws recorded away from the mesh
+  MeshHandle handle;
+  // object space bounding box
+  glm::vec3 aabbMin, aabbMax;
+  // scene graph node whose world transform places this mesh
+  int node;
 
   Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices,
        std::vector<Texture> textures)
       : vertices(std::move(vertices)), indices(std::move(indices)),
-        textures(std::move(textures)), VAO(0), VBO(0), EBO(0) {
+        textures(std::move(textures)), VAO(0), aabbMin(0.0f), aabbMax(0.0f),
+        node(0), VBO(0), EBO(0) {
+    computeBounds();
     setupMesh();
   }
 
+  // adopt buffers filled by createBuffers() on another context, only the
+  // vertex array, which contexts don't share, is made here
+  Mesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices,
+       std::vector<Texture> textures, unsigned int VBO, unsigned int EBO)
+      : vertices(std::move(vertices)), indices(std::move(indices)),
+        textures(std::move(textures)), VAO(0), aabbMin(0.0f), aabbMax(0.0f),
+        node(0), VBO(VBO), EBO(EBO) {
+    computeBounds();
+    setupVertexArray();
+  }
+
   // Delete copy constructor and copy assignment (prevent accidental copies)
   Mesh(const Mesh &) = delete;
   Mesh &operator=(const Mesh &) = delete;
@@ -55,107 +105,289 @@ public:
   // Move constructor
   Mesh(Mesh &&other) noexcept
       : vertices(std::move(other.vertices)), indices(std::move(other.indices)),
-        textures(std::move(other.textures)), VAO(other.VAO), VBO(other.VBO),
-        EBO(other.EBO) {
+        textures(std::move(other.textures)), VAO(other.VAO),
+        handle(other.handle), aabbMin(other.aabbMin), aabbMax(other.aabbMax),
+        node(other.node), VBO(other.VBO), EBO(other.EBO),
+        depthVAO(other.depthVAO), positionVBO(other.positionVBO),
+        instanceBuffer(other.instanceBuffer),
+        instanceOffset(other.instanceOffset) {
     // Reset the source object's handles so its destructor won't delete our
     // resources
     other.VAO = 0;
+    other.handle = {};
     other.VBO = 0;
     other.EBO = 0;
+    other.depthVAO = 0;
+    other.positionVBO = 0;
   }
 
   // Move assignment operator
   Mesh &operator=(Mesh &&other) noexcept {
     if (this != &other) {
       // Clean up existing resources
-      if (VAO != 0) {
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-        glBindVertexArray(0);
-
-        glDeleteVertexArrays(1, &VAO);
-        glDeleteBuffers(1, &VBO);
-        glDeleteBuffers(1, &EBO);
-      }
+      release();
 
       // Move data
       vertices = std::move(other.vertices);
       indices = std::move(other.indices);
       textures = std::move(other.textures);
       VAO = other.VAO;
+      handle = other.handle;
+      aabbMin = other.aabbMin;
+      aabbMax = other.aabbMax;
+      node = other.node;
       VBO = other.VBO;
       EBO = other.EBO;
+      depthVAO = other.depthVAO;
+      positionVBO = other.positionVBO;
+      instanceBuffer = other.instanceBuffer;
+      instanceOffset = other.instanceOffset;
 
       // Reset source handles
       other.VAO = 0;
+      other.handle = {};
       other.VBO = 0;
       other.EBO = 0;
+      other.depthVAO = 0;
+      other.positionVBO = 0;
     }
     return *this;
   }
 
-  ~Mesh() {
-    if (VAO != 0) {
-      glBindBuffer(GL_ARRAY_BUFFER, 0);
-      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
-      glBindVertexArray(0);
+  // the objects go to the installed deletion queue, if any, so a mesh can
+  // be destroyed on any thread and while the GPU is still drawing it
+  ~Mesh() { release(); }
 
-      glDeleteVertexArrays(1, &VAO);
-      glDeleteBuffers(1, &VBO);
-      glDeleteBuffers(1, &EBO);
-    }
+  // hand the GL objects to queue for deletion instead of deleting them in
+  // the destructor, which then works on any thread
+  void destroy(GLQueue &queue) {
+    gpuResources().meshes.remove(handle);
+    handle = {};
+    queue.deleteObject(GLObject::VertexArray, VAO);
+    queue.deleteObject(GLObject::Buffer, VBO);
+    queue.deleteObject(GLObject::Buffer, EBO);
+    queue.deleteObject(GLObject::VertexArray, depthVAO);
+    queue.deleteObject(GLObject::Buffer, positionVBO);
+    VAO = VBO = EBO = depthVAO = positionVBO = 0;
   }
 
   void Draw(Shader &shader) {
+    bindTextures(shader);
+
+    glBindVertexArray(VAO);
+    glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()),
+                   GL_UNSIGNED_INT, 0);
+
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  void DrawInstanced(Shader &shader, unsigned int count) {
+    bindTextures(shader);
+
+    glBindVertexArray(VAO);
+    glDrawElementsInstanced(GL_TRIANGLES,
+                            static_cast<unsigned int>(indices.size()),
+                            GL_UNSIGNED_INT, 0, static_cast<GLsizei>(count));
+
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  // draw with the command at offset in the bound GL_DRAW_INDIRECT_BUFFER
+  void DrawIndirect(Shader &shader, std::size_t offset) {
+    bindTextures(shader);
+
+    glBindVertexArray(VAO);
+    glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void *)offset);
+
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+  }
+
+  // depth only versions of the draws above, reading nothing but positions
+  // from a packed buffer made on first use
+  void DrawDepth() {
+    bindDepthStream();
+    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(indices.size()),
+                   GL_UNSIGNED_INT, 0);
+    glBindVertexArray(0);
+  }
+
+  void DrawDepthInstanced(unsigned int count) {
+    bindDepthStream();
+    glDrawElementsInstanced(GL_TRIANGLES, static_cast<GLsizei>(indices.size()),
+                            GL_UNSIGNED_INT, 0, static_cast<GLsizei>(count));
+    glBindVertexArray(0);
+  }
+
+  void DrawDepthIndirect(std::size_t offset) {
+    bindDepthStream();
+    glDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (void *)offset);
+    glBindVertexArray(0);
+  }
+
+  DrawElementsIndirectCommand indirectCommand() const {
+    return {.count = static_cast<unsigned int>(indices.size()),
+            .instanceCount = 0,
+            .firstIndex = 0,
+            .baseVertex = 0,
+            .baseInstance = 0};
+  }
+
+  // source per instance InstanceData from buffer starting at offset, the
+  // model matrix at attributes 7 to 10 and the normal matrix at 11 to 13
+  void setInstanceBuffer(unsigned int buffer, std::size_t offset = 0) {
+    instanceBuffer = buffer;
+    instanceOffset = offset;
+    setInstanceAttributes(VAO);
+    if (depthVAO)
+      setInstanceAttributes(depthVAO);
+  }
+
+  // create and fill the vertex and index buffers, works on any context
+  static void createBuffers(const std::vector<Vertex> &vertices,
+                            const std::vector<unsigned int> &indices,
+                            unsigned int &VBO, unsigned int &EBO) {
+    glGenBuffers(1, &VBO);
+    glGenBuffers(1, &EBO);
+
+    // the element array binding belongs to a VAO, fill both through a
+    // target that doesn't need one
+    glBindBuffer(GL_COPY_WRITE_BUFFER, VBO);
+    glBufferData(GL_COPY_WRITE_BUFFER, vertices.size() * sizeof(Vertex),
+                 vertices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, EBO);
+    glBufferData(GL_COPY_WRITE_BUFFER, indices.size() * sizeof(unsigned int),
+                 indices.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+  }
+
+  // sampler uniform bound to each texture, texture unit i takes textures[i]
+  std::vector<std::string> samplerNames() const {
     unsigned int diffuseNr = 1;
     unsigned int specularNr = 1;
     unsigned int normalNr = 1;
     unsigned int heightNr = 1;
-    for (unsigned int i = 0; i < textures.size(); ++i) {
-      glActiveTexture(GL_TEXTURE0 + i);
-
+    std::vector<std::string> names;
+    for (const Texture &texture : textures) {
       std::string number;
-      if (textures[i].type == "texture_diffuse")
+      if (texture.type == TextureType::Diffuse)
         number = std::to_string(diffuseNr++);
-      else if (textures[i].type == "texture_specular")
+      else if (texture.type == TextureType::Specular)
         number = std::to_string(specularNr++);
-      else if (textures[i].type == "texture_normal")
+      else if (texture.type == TextureType::Normal)
         number = std::to_string(normalNr++);
-      else if (textures[i].type == "texture_height")
+      else if (texture.type == TextureType::Height)
         number = std::to_string(heightNr++);
-
-      shader.setInt((textures[i].type + number).c_str(), i);
-      glBindTexture(GL_TEXTURE_2D, textures[i].id);
+      names.push_back(samplerPrefix(texture.type) + number);
     }
-
-    glBindVertexArray(VAO);
-    glDrawElements(GL_TRIANGLES, static_cast<unsigned int>(indices.size()),
-                   GL_UNSIGNED_INT, 0);
-
-    glBindVertexArray(0);
-    glActiveTexture(GL_TEXTURE0);
+    return names;
   }
 
 private:
   // render data
   unsigned int VBO, EBO;
+  // positions only, for depth passes, 0 until first used
+  unsigned int depthVAO = 0, positionVBO = 0;
+  // last setInstanceBuffer(), applied to the depth VAO once it exists
+  unsigned int instanceBuffer = 0;
+  std::size_t instanceOffset = 0;
+
+  // model matrix at attributes 7 to 10 and normal matrix at 11 to 13
+  void setInstanceAttributes(unsigned int vao) {
+    const std::size_t offset = instanceOffset;
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    for (unsigned int i = 0; i < 4; ++i) {
+      glEnableVertexAttribArray(7 + i);
+      glVertexAttribPointer(7 + i, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                            (void *)(offset + i * sizeof(glm::vec4)));
+      glVertexAttribDivisor(7 + i, 1);
+    }
+    for (unsigned int i = 0; i < 3; ++i) {
+      glEnableVertexAttribArray(11 + i);
+      glVertexAttribPointer(11 + i, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+                            (void *)(offset + offsetof(InstanceData, normal) +
+                                     i * sizeof(glm::vec4)));
+      glVertexAttribDivisor(11 + i, 1);
+    }
+    glBindVertexArray(0);
+  }
+
+  void release() {
+    // stale before the vertex array goes away
+    gpuResources().meshes.remove(handle);
+    handle = {};
+    retireGLObject(GLObject::VertexArray, VAO);
+    retireGLObject(GLObject::Buffer, VBO);
+    retireGLObject(GLObject::Buffer, EBO);
+    retireGLObject(GLObject::VertexArray, depthVAO);
+    retireGLObject(GLObject::Buffer, positionVBO);
+    VAO = VBO = EBO = depthVAO = positionVBO = 0;
+  }
+
+  // bind the positions only VAO, packing the positions on first use. The
+  // mesh's own VBO would do, but every vertex would pull a whole Vertex
+  // through the cache for 12 bytes of it
+  void bindDepthStream() {
+    if (!depthVAO) {
+      std::vector<glm::vec3> positions;
+      positions.reserve(vertices.size());
+      for (const Vertex &vertex : vertices)
+        positions.push_back(vertex.Position);
+      glGenVertexArrays(1, &depthVAO);
+      glGenBuffers(1, &positionVBO);
+      glBindVertexArray(depthVAO);
+      glBindBuffer(GL_ARRAY_BUFFER, positionVBO);
+      glBufferData(GL_ARRAY_BUFFER,
+                   static_cast<GLsizeiptr>(positions.size() *
+                                           sizeof(glm::vec3)),
+                   positions.data(), GL_STATIC_DRAW);
+      glEnableVertexAttribArray(0);
+      glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3),
+                            (void *)0);
+      glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+      if (instanceBuffer)
+        setInstanceAttributes(depthVAO);
+    }
+    glBindVertexArray(depthVAO);
+  }
+
+  void bindTextures(Shader &shader) {
+    std::vector<std::string> names = samplerNames();
+    for (unsigned int i = 0; i < textures.size(); ++i) {
+      glActiveTexture(GL_TEXTURE0 + i);
+      shader.setInt(names[i], i);
+      // a released texture resolves to 0 and samples as black
+      glBindTexture(GL_TEXTURE_2D, textureId(textures[i].handle));
+    }
+  }
+
+  // compute the object space bounding box of the vertices
+  void computeBounds() {
+    if (vertices.empty())
+      return;
+    aabbMin = aabbMax = vertices[0].Position;
+    for (const Vertex &vertex : vertices) {
+      aabbMin = glm::min(aabbMin, vertex.Position);
+      aabbMax = glm::max(aabbMax, vertex.Position);
+    }
+  }
 
   // initialize all buffer objects/arrays
   void setupMesh() {
-    // create buffers/arrays
-    glGenVertexArrays(1, &VAO);
-    glGenBuffers(1, &VBO);
-    glGenBuffers(1, &EBO);
+    // load data into vertex buffers
+    createBuffers(vertices, indices, VBO, EBO);
+    setupVertexArray();
+  }
 
+  // describe the vertex layout of VBO and EBO in a new VAO
+  void setupVertexArray() {
+    glGenVertexArrays(1, &VAO);
     glBindVertexArray(VAO);
-    // load data into vertex buffers
     glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex),
-                 &vertices[0], GL_STATIC_DRAW);
-
     glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-                 &indices[0], GL_STATIC_DRAW);
 
     // set the vertex attribute pointers
     // vertex Positions
@@ -187,6 +419,9 @@ private:
     glVertexAttribPointer(6, 4, GL_FLOAT, GL_FALSE, sizeof(Vertex),
                           (void *)offsetof(Vertex, m_Weights));
     glBindVertexArray(0);
+
+    handle = gpuResources().meshes.insert(
+        {VAO, static_cast<GLsizei>(indices.size())});
   }
 };
 
@@ -1,38 +1,342 @@
 #ifndef MODEL_HPP
 #define MODEL_HPP
 
+#include "deletion_queue.hpp"
+#include "gl_queue.hpp"
+#include "gpu_resources.hpp"
+#include "image.hpp"
+#include "job_system.hpp"
 #include "mesh.hpp"
+#include "occlusion.hpp"
+#include "scene_graph.hpp"
 #include "shader.hpp"
-#include "stb_image.hpp"
+#include "upload_thread.hpp"
 
 #include <assimp/Importer.hpp>
 #include <assimp/postprocess.h>
 #include <assimp/scene.h>
 
+#include <algorithm>
 #include <iostream>
 #include <map>
+#include <memory>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 
+// CPU side result of importing one mesh
+struct MeshData {
+  std::vector<Vertex> vertices;
+  std::vector<unsigned int> indices;
+  // texture file and sampler type, turned into GL textures later
+  std::vector<std::pair<std::string, TextureType>> textures;
+  // scene graph node that places the mesh
+  int node = 0;
+};
+
 unsigned int TextureFromFile(const std::string &path, bool gamma = false);
 
 class Model {
 public:
-  Model(const char *path) { loadModel(path); }
-  void Draw(Shader &shader) {
-    for (unsigned int i = 0; i < meshes.size(); ++i)
+  // model space bounds of all meshes, placed by their nodes
+  glm::vec3 aabbMin{0.0f}, aabbMax{0.0f};
+  // node hierarchy of the source file, edit it to animate parts
+  SceneGraph nodes;
+
+  // with a job system, textures are decoded on workers and uploaded by main
+  // thread jobs, the constructor returns once all of them have finished.
+  // Given an upload thread as well, the constructor returns right away and
+  // the whole load happens in the background: the model draws nothing until
+  // ready(), and is adopted by the main thread's runMainThreadJobs().
+  Model(const char *path, JobSystem *jobs = nullptr,
+        UploadThread *uploads = nullptr)
+      : jobs(jobs) {
+    if (jobs && uploads)
+      loadModelAsync(path, *uploads);
+    else
+      loadModel(path);
+  }
+  // Background load that never touches GL off the render thread: GL work is
+  // queued and runs when the render thread drains queue, which also deletes
+  // the model's objects, so it can be destroyed from any thread
+  Model(const char *path, JobSystem &jobs, GLQueue &queue)
+      : jobs(&jobs), queue(&queue) {
+    loadModelQueued(path);
+  }
+  // false while a background load is still in flight
+  bool ready() const { return loading.done(); }
+  // order of queued uploads relative to other assets, may change until ready
+  void setUploadPriority(bool visible, float distance) {
+    priority->visible = visible;
+    priority->distance = distance;
+  }
+  // each mesh is drawn with "model" set to transform * its node's world
+  // matrix and "normalMatrix" to the matching product of normal matrices
+  void Draw(Shader &shader, const InstanceData &transform = identity()) {
+    nodes.update();
+    for (unsigned int i = 0; i < meshes.size(); ++i) {
+      setNodeUniforms(shader, transform, meshes[i].node);
       meshes[i].Draw(shader);
+    }
   }
+  // draw with heavy meshes tested against the depth buffer first
+  void Draw(Shader &shader, OcclusionCuller &culler,
+            const InstanceData &transform = identity()) {
+    nodes.update();
+    for (unsigned int i = 0; i < meshes.size(); ++i) {
+      setNodeUniforms(shader, transform, meshes[i].node);
+      culler.setModel(transform.model * nodes.world[meshes[i].node]);
+      culler.Draw(meshes[i], shader);
+    }
+  }
+  // instanced draws take the per instance transform from the instance
+  // buffer and the node transform from "model"
+  void DrawInstanced(Shader &shader, unsigned int count) {
+    nodes.update();
+    for (unsigned int i = 0; i < meshes.size(); ++i) {
+      setNodeUniforms(shader, identity(), meshes[i].node);
+      meshes[i].DrawInstanced(shader, count);
+    }
+  }
+  // mesh i draws with command i of the bound GL_DRAW_INDIRECT_BUFFER
+  void DrawIndirect(Shader &shader) {
+    nodes.update();
+    for (unsigned int i = 0; i < meshes.size(); ++i) {
+      setNodeUniforms(shader, identity(), meshes[i].node);
+      meshes[i].DrawIndirect(shader, i * sizeof(DrawElementsIndirectCommand));
+    }
+  }
+  // depth only passes of the draws above, for a shader reading positions
+  // alone, see shaders/depth.vs
+  void DrawDepth(Shader &shader, const InstanceData &transform = identity()) {
+    nodes.update();
+    for (unsigned int i = 0; i < meshes.size(); ++i) {
+      setNodeUniforms(shader, transform, meshes[i].node);
+      meshes[i].DrawDepth();
+    }
+  }
+  void DrawDepthInstanced(Shader &shader, unsigned int count) {
+    nodes.update();
+    for (unsigned int i = 0; i < meshes.size(); ++i) {
+      setNodeUniforms(shader, identity(), meshes[i].node);
+      meshes[i].DrawDepthInstanced(count);
+    }
+  }
+  void DrawDepthIndirect(Shader &shader) {
+    nodes.update();
+    for (unsigned int i = 0; i < meshes.size(); ++i) {
+      setNodeUniforms(shader, identity(), meshes[i].node);
+      meshes[i].DrawDepthIndirect(i * sizeof(DrawElementsIndirectCommand));
+    }
+  }
+  std::vector<DrawElementsIndirectCommand> indirectCommands() const {
+    std::vector<DrawElementsIndirectCommand> commands;
+    for (const Mesh &mesh : meshes)
+      commands.push_back(mesh.indirectCommand());
+    return commands;
+  }
+  void setInstanceBuffer(unsigned int buffer, std::size_t offset = 0) {
+    for (Mesh &mesh : meshes)
+      mesh.setInstanceBuffer(buffer, offset);
+  }
+  const std::vector<Mesh> &meshList() const { return meshes; }
+  // a pending background load is finished first, which takes the main
+  // thread unless it goes through a GLQueue. GL objects are deleted through
+  // the installed DeletionQueue, without one only the context thread may
+  // destroy a model.
   ~Model() {
+    if (queue) {
+      // only the render thread can move a queued load forward
+      while (!loading.done())
+        if (!(queue->onRenderThread() && queue->drain()))
+          std::this_thread::yield();
+      jobs->wait(loading);
+      for (Mesh &mesh : meshes)
+        mesh.destroy(*queue);
+      for (auto &[_, texture] : textures_loaded)
+        queue->deleteObject(GLObject::Texture, releaseTexture(texture));
+      return;
+    }
+    if (jobs)
+      jobs->wait(loading);
     for (auto &[_, texture] : textures_loaded)
-      glDeleteTextures(1, &texture.id);
+      retireGLObject(GLObject::Texture, releaseTexture(texture));
   }
 
 private:
+  // state of a background load, passed from the loading job to the upload
+  // thread and on to the main thread
+  struct PendingLoad {
+    SceneGraph nodes;
+    std::vector<MeshData> meshes;
+    // distinct texture files, decoded then uploaded
+    std::vector<std::string> texturePaths;
+    std::vector<Image> images;
+    std::vector<unsigned int> textureIds;
+    // vertex and index buffer of each mesh
+    std::vector<std::pair<unsigned int, unsigned int>> buffers;
+  };
+
   std::vector<Mesh> meshes;
-  std::string directory;
-  std::unordered_map<std::string, Texture> textures_loaded;
+  // every texture the meshes refer to, keyed by file
+  std::unordered_map<std::string, TextureHandle> textures_loaded;
+  JobSystem *jobs;
+  GLQueue *queue = nullptr;
+  std::shared_ptr<UploadPriority> priority =
+      std::make_shared<UploadPriority>();
+  JobCounter loading;
+
+  static const InstanceData &identity() {
+    static const InstanceData data{
+        glm::mat4(1.0f),
+        {glm::vec4(1.0f, 0.0f, 0.0f, 0.0f), glm::vec4(0.0f, 1.0f, 0.0f, 0.0f),
+         glm::vec4(0.0f, 0.0f, 1.0f, 0.0f)}};
+    return data;
+  }
+
+  void setNodeUniforms(Shader &shader, const InstanceData &transform,
+                       int node) {
+    shader.setMat4("model", transform.model * nodes.world[node]);
+    shader.setMat3("normalMatrix",
+                   normalMatrix(transform) * nodes.normal[node]);
+  }
 
   void loadModel(std::string path) {
+    std::vector<MeshData> imported;
+    if (!importScene(path, nodes, imported))
+      return;
+    for (MeshData &data : imported) {
+      std::vector<Texture> textures = loadMaterialTextures(data.textures);
+      meshes.push_back(Mesh(std::move(data.vertices), std::move(data.indices),
+                            std::move(textures)));
+      meshes.back().node = data.node;
+    }
+    if (jobs)
+      jobs->wait(loading);
+    nodes.update();
+    computeBounds();
+  }
+  // import and decode on a worker, create buffers and textures on the upload
+  // context, then make the VAOs and take ownership on the main thread
+  void loadModelAsync(std::string path, UploadThread &uploads) {
+    jobs->submit(
+        [this, path, &uploads] {
+          auto pending = std::make_shared<PendingLoad>();
+          if (!importPending(path, *pending))
+            return;
+          uploads.submit([pending] { uploadPending(*pending); },
+                         [this, pending] { adoptPending(*pending); },
+                         &loading);
+        },
+        &loading);
+  }
+  // import and decode on a worker and queue the uploads, the last one to
+  // complete adopts the results on the render thread
+  void loadModelQueued(std::string path) {
+    jobs->submit(
+        [this, path] {
+          auto pending = std::make_shared<PendingLoad>();
+          if (!importPending(path, *pending))
+            return;
+
+          jobs->retain(loading);
+          auto remaining = std::make_shared<std::size_t>(
+              pending->images.size() + 2 * pending->meshes.size());
+          auto created = [this, pending, remaining](unsigned int &slot) {
+            return [this, pending, remaining, &slot](unsigned int id) {
+              slot = id;
+              // callbacks all run on the render thread
+              if (--*remaining == 0)
+                finishQueued(*pending);
+            };
+          };
+          if (*remaining == 0) {
+            queue->call([this, pending] { finishQueued(*pending); });
+            return;
+          }
+
+          pending->textureIds.resize(pending->images.size());
+          for (std::size_t i = 0; i < pending->images.size(); ++i)
+            queue->uploadTexture(pending->images[i], pending->texturePaths[i],
+                                 created(pending->textureIds[i]), priority);
+          // the queue owns and frees the images now
+          pending->images.clear();
+
+          pending->buffers.resize(pending->meshes.size());
+          for (std::size_t i = 0; i < pending->meshes.size(); ++i) {
+            const MeshData &data = pending->meshes[i];
+            queue->createBuffer(data.vertices.data(),
+                                data.vertices.size() * sizeof(Vertex),
+                                GL_STATIC_DRAW,
+                                created(pending->buffers[i].first), priority);
+            queue->createBuffer(data.indices.data(),
+                                data.indices.size() * sizeof(unsigned int),
+                                GL_STATIC_DRAW,
+                                created(pending->buffers[i].second), priority);
+          }
+        },
+        &loading);
+  }
+  void finishQueued(PendingLoad &pending) {
+    adoptPending(pending);
+    jobs->release(loading);
+  }
+  // import the file and decode each distinct texture in parallel
+  bool importPending(const std::string &path, PendingLoad &pending) {
+    if (!importScene(path, pending.nodes, pending.meshes))
+      return false;
+    for (const MeshData &data : pending.meshes)
+      for (const auto &[file, type] : data.textures)
+        if (std::find(pending.texturePaths.begin(), pending.texturePaths.end(),
+                      file) == pending.texturePaths.end())
+          pending.texturePaths.push_back(file);
+    pending.images.resize(pending.texturePaths.size());
+    jobs->parallelFor(0, pending.texturePaths.size(), 1,
+                      [&](std::size_t first, std::size_t last) {
+                        for (std::size_t i = first; i < last; ++i)
+                          pending.images[i] =
+                              loadImage(pending.texturePaths[i]);
+                      });
+    return true;
+  }
+  // runs on the upload context
+  static void uploadPending(PendingLoad &pending) {
+    pending.textureIds.resize(pending.images.size());
+    for (std::size_t i = 0; i < pending.images.size(); ++i) {
+      glGenTextures(1, &pending.textureIds[i]);
+      uploadTexture(pending.textureIds[i], pending.images[i],
+                    pending.texturePaths[i]);
+      freeImage(pending.images[i]);
+    }
+    for (const MeshData &data : pending.meshes) {
+      unsigned int VBO, EBO;
+      Mesh::createBuffers(data.vertices, data.indices, VBO, EBO);
+      pending.buffers.push_back({VBO, EBO});
+    }
+  }
+  // runs on the main thread once the uploads have completed
+  void adoptPending(PendingLoad &pending) {
+    for (std::size_t i = 0; i < pending.texturePaths.size(); ++i) {
+      textures_loaded[pending.texturePaths[i]] =
+          registerTexture(pending.textureIds[i]);
+    }
+    for (std::size_t i = 0; i < pending.meshes.size(); ++i) {
+      MeshData &data = pending.meshes[i];
+      std::vector<Texture> textures;
+      for (const auto &[file, type] : data.textures)
+        textures.push_back({textures_loaded[file], type});
+      meshes.push_back(Mesh(std::move(data.vertices), std::move(data.indices),
+                            std::move(textures), pending.buffers[i].first,
+                            pending.buffers[i].second));
+      meshes.back().node = data.node;
+    }
+    nodes = std::move(pending.nodes);
+    nodes.update();
+    computeBounds();
+  }
+  // read a file into a node hierarchy and CPU side meshes, safe on any thread
+  static bool importScene(const std::string &path, SceneGraph &graph,
+                          std::vector<MeshData> &meshes) {
     Assimp::Importer importer;
     const aiScene *scene =
         importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
@@ -40,26 +344,54 @@ private:
     if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
         !scene->mRootNode) {
       std::cerr << "ERROR::ASSIMP::" << importer.GetErrorString() << std::endl;
-      return;
+      return false;
     }
-    directory = path.substr(0, path.find_last_of('/'));
-    processNode(scene->mRootNode, scene);
+    std::string directory = path.substr(0, path.find_last_of('/'));
+    processNode(scene->mRootNode, scene, -1, directory, graph, meshes);
+    return true;
   }
-  void processNode(aiNode *node, const aiScene *scene) {
+  static void processNode(aiNode *node, const aiScene *scene, int parent,
+                          const std::string &directory, SceneGraph &graph,
+                          std::vector<MeshData> &meshes) {
+    // depth first traversal keeps parents ahead of their children
+    aiVector3D scaling, position;
+    aiQuaternion rotation;
+    node->mTransformation.Decompose(scaling, rotation, position);
+    int index = graph.addNode(
+        parent, glm::vec3(position.x, position.y, position.z),
+        glm::quat(rotation.w, rotation.x, rotation.y, rotation.z),
+        glm::vec3(scaling.x, scaling.y, scaling.z));
+
     // process all the node's meshes (if any)
     for (unsigned int i = 0; i < node->mNumMeshes; ++i) {
       aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-      meshes.push_back(processMesh(mesh, scene));
+      meshes.push_back(processMesh(mesh, scene, directory));
+      meshes.back().node = index;
     }
     // then do the same for each of its children
     for (unsigned int i = 0; i < node->mNumChildren; ++i) {
-      processNode(node->mChildren[i], scene);
+      processNode(node->mChildren[i], scene, index, directory, graph, meshes);
     }
   }
-  Mesh processMesh(aiMesh *mesh, const aiScene *scene) {
-    std::vector<Vertex> vertices;
-    std::vector<unsigned int> indices;
-    std::vector<Texture> textures;
+  // union of the mesh boxes, each transformed by its node
+  void computeBounds() {
+    bool first = true;
+    for (const Mesh &mesh : meshes) {
+      const glm::mat4 &world = nodes.world[mesh.node];
+      for (int corner = 0; corner < 8; ++corner) {
+        glm::vec3 local(corner & 1 ? mesh.aabbMax.x : mesh.aabbMin.x,
+                        corner & 2 ? mesh.aabbMax.y : mesh.aabbMin.y,
+                        corner & 4 ? mesh.aabbMax.z : mesh.aabbMin.z);
+        glm::vec3 point = glm::vec3(world * glm::vec4(local, 1.0f));
+        aabbMin = first ? point : glm::min(aabbMin, point);
+        aabbMax = first ? point : glm::max(aabbMax, point);
+        first = false;
+      }
+    }
+  }
+  static MeshData processMesh(aiMesh *mesh, const aiScene *scene,
+                              const std::string &directory) {
+    MeshData data;
 
     // process vertex positions, normals, and texture coordinates
     for (unsigned int i = 0; i < mesh->mNumVertices; ++i) {
@@ -74,47 +406,66 @@ private:
       } else {
         vertex.TexCoords = glm::vec2(0.0f, 0.0f);
       }
-      vertices.push_back(vertex);
+      data.vertices.push_back(vertex);
     }
     // process indices
     for (unsigned int i = 0; i < mesh->mNumFaces; ++i) {
       aiFace face = mesh->mFaces[i];
       for (unsigned int j = 0; j < face.mNumIndices; ++j) {
-        indices.push_back(face.mIndices[j]);
+        data.indices.push_back(face.mIndices[j]);
       }
     }
     // process material
     aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-    std::vector<Texture> diffuseMaps = loadMaterialTextures(
-        material, aiTextureType_DIFFUSE, "texture_diffuse");
-    textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-    std::vector<Texture> specularMaps = loadMaterialTextures(
-        material, aiTextureType_SPECULAR, "texture_specular");
-    textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+    materialTextures(material, aiTextureType_DIFFUSE, TextureType::Diffuse,
+                     directory, data.textures);
+    materialTextures(material, aiTextureType_SPECULAR, TextureType::Specular,
+                     directory, data.textures);
 
-    return Mesh(vertices, indices, textures);
+    return data;
   }
-  std::vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type,
-                                            std::string typeName) {
-    std::vector<Texture> textures;
+  static void
+  materialTextures(aiMaterial *mat, aiTextureType type, TextureType typeName,
+                   const std::string &directory,
+                   std::vector<std::pair<std::string, TextureType>> &out) {
     for (unsigned int i = 0; i < mat->GetTextureCount(type); i++) {
       aiString str;
       mat->GetTexture(type, i, &str);
-      std::string path = directory + '/' + str.C_Str();
-
-      if (textures_loaded.contains(path)) {
-        textures.push_back(textures_loaded[path]);
-      } else {
-        std::cout << "Texture loading at path: " << str.C_Str() << std::endl;
-
-        Texture texture{
-            .id = TextureFromFile(path), .path = path, .type = typeName};
-        textures_loaded[path] = texture;
-        textures.push_back(texture);
+      out.push_back({directory + '/' + str.C_Str(), typeName});
+    }
+  }
+  std::vector<Texture> loadMaterialTextures(
+      const std::vector<std::pair<std::string, TextureType>> &files) {
+    std::vector<Texture> textures;
+    for (const auto &[path, typeName] : files) {
+      if (!textures_loaded.contains(path)) {
+        std::cout << "Texture loading at path: " << path << std::endl;
+        textures_loaded[path] = registerTexture(
+            jobs ? TextureFromFileAsync(path) : TextureFromFile(path));
       }
+      textures.push_back({textures_loaded[path], typeName});
     }
     return textures;
   }
+  // name the texture now, fill it in once a worker has decoded the file
+  unsigned int TextureFromFileAsync(const std::string &path) {
+    unsigned int textureID;
+    glGenTextures(1, &textureID);
+
+    JobSystem &system = *jobs;
+    jobs->submit(
+        [&system, counter = &loading, textureID, path] {
+          Image image = loadImage(path);
+          system.submitMain(
+              [textureID, image, path]() mutable {
+                uploadTexture(textureID, image, path);
+                freeImage(image);
+              },
+              counter);
+        },
+        &loading);
+    return textureID;
+  }
 };
 
 unsigned int TextureFromFile(const std::string &path,
@@ -122,35 +473,9 @@ unsigned int TextureFromFile(const std::string &path,
   unsigned int textureID;
   glGenTextures(1, &textureID);
 
-  int width, height, nrComponents;
-  unsigned char *data =
-      stbi_load(path.c_str(), &width, &height, &nrComponents, 0);
-  if (data) {
-    GLenum format;
-    if (nrComponents == 1)
-      format = GL_RED;
-    else if (nrComponents == 3)
-      format = GL_RGB;
-    else if (nrComponents == 4)
-      format = GL_RGBA;
-    else
-      std::cerr << "Invalid image format for image: " << path << std::endl;
-
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
-                 GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                    GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-  } else {
-    std::cerr << "Texture failed to load at path: " << path << std::endl;
-  }
-  stbi_image_free(data);
+  Image image = loadImage(path);
+  uploadTexture(textureID, image, path);
+  freeImage(image);
 
   return textureID;
 }
@@ -0,0 +1,16 @@
+#ifndef MONOTONIC_CLOCK_HPP
+#define MONOTONIC_CLOCK_HPP
+
+#include <chrono>
+#include <cstdint>
+
+// nanoseconds on a monotonic clock, exact over any uptime unlike the float
+// seconds of glfwGetTime
+inline std::uint64_t monotonicNanoseconds() {
+  return static_cast<std::uint64_t>(
+      std::chrono::duration_cast<std::chrono::nanoseconds>(
+          std::chrono::steady_clock::now().time_since_epoch())
+          .count());
+}
+
+#endif
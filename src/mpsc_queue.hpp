@@ -0,0 +1,57 @@
+#ifndef MPSC_QUEUE_HPP
+#define MPSC_QUEUE_HPP
+
+#include <atomic>
+#include <utility>
+
+// Unbounded lock-free queue for many producers and a single consumer. Each
+// push swaps itself in as the new head with one atomic exchange and then
+// links the previous head to it; the consumer follows the links from a
+// dummy node. A push that has exchanged but not linked yet is simply picked
+// up by the next pop, so the consumer never waits. Items pushed by one
+// thread come out in the order they went in.
+template <typename T> class MpscQueue {
+public:
+  MpscQueue() : head(new Node), tail(head.load(std::memory_order_relaxed)) {}
+
+  MpscQueue(const MpscQueue &) = delete;
+  MpscQueue &operator=(const MpscQueue &) = delete;
+
+  ~MpscQueue() {
+    T value;
+    while (pop(value))
+      ;
+    delete tail;
+  }
+
+  // any thread
+  void push(T value) {
+    Node *node = new Node;
+    node->value = std::move(value);
+    Node *previous = head.exchange(node, std::memory_order_acq_rel);
+    previous->next.store(node, std::memory_order_release);
+  }
+
+  // consumer thread only, false when nothing is ready
+  bool pop(T &value) {
+    Node *next = tail->next.load(std::memory_order_acquire);
+    if (next == nullptr)
+      return false;
+    // next becomes the new dummy once its value is taken
+    value = std::move(next->value);
+    delete tail;
+    tail = next;
+    return true;
+  }
+
+private:
+  struct Node {
+    std::atomic<Node *> next{nullptr};
+    T value{};
+  };
+
+  std::atomic<Node *> head;
+  Node *tail;
+};
+
+#endif
@@ -0,0 +1,172 @@
+#ifndef OCCLUSION_HPP
+#define OCCLUSION_HPP
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <vector>
+
+#include "mesh.hpp"
+#include "shader.hpp"
+
+// pool of query objects, recycled every frame instead of generated per draw
+class QueryPool {
+public:
+  QueryPool() : next(0) {}
+
+  QueryPool(const QueryPool &) = delete;
+  QueryPool &operator=(const QueryPool &) = delete;
+
+  ~QueryPool() {
+    if (!queries.empty())
+      glDeleteQueries(static_cast<GLsizei>(queries.size()), queries.data());
+  }
+
+  // hand out the next free query, growing the pool in batches when exhausted
+  GLuint acquire() {
+    if (next == queries.size()) {
+      const std::size_t batch = queries.empty() ? 64 : queries.size();
+      queries.resize(queries.size() + batch);
+      glGenQueries(static_cast<GLsizei>(batch), queries.data() + next);
+    }
+    return queries[next++];
+  }
+
+  // make every query available again, called once at the start of a frame
+  void reset() { next = 0; }
+
+private:
+  std::vector<GLuint> queries;
+  std::size_t next;
+};
+
+// Skips heavy meshes whose bounding box is hidden behind what has already been
+// drawn. The box is rasterized into a GL_ANY_SAMPLES_PASSED query with color
+// and depth writes masked, and the mesh itself is drawn inside a conditional
+// render on that query, so the GPU decides visibility and the CPU never reads
+// a query result back.
+class OcclusionCuller {
+public:
+  bool enabled = false;
+  // meshes with fewer indices than this are cheaper to draw than to test
+  unsigned int minIndices;
+
+  OcclusionCuller(unsigned int minIndices = 3000)
+      : minIndices(minIndices), boxShader("shaders/light.vs", "shaders/light.fs"),
+        boxVAO(0), boxVBO(0), boxEBO(0) {
+    setupBox();
+  }
+
+  OcclusionCuller(const OcclusionCuller &) = delete;
+  OcclusionCuller &operator=(const OcclusionCuller &) = delete;
+
+  ~OcclusionCuller() {
+    glDeleteVertexArrays(1, &boxVAO);
+    glDeleteBuffers(1, &boxVBO);
+    glDeleteBuffers(1, &boxEBO);
+  }
+
+  void beginFrame(const glm::mat4 &view, const glm::mat4 &projection,
+                  const glm::vec3 &viewPos) {
+    queries.reset();
+    this->view = view;
+    this->projection = projection;
+    this->viewPos = viewPos;
+  }
+
+  // set the model matrix used by the following Draw calls
+  void setModel(const glm::mat4 &model) {
+    this->model = model;
+    localViewPos = glm::vec3(glm::inverse(model) * glm::vec4(viewPos, 1.0f));
+  }
+
+  void Draw(Mesh &mesh, Shader &shader) {
+    if (!enabled || mesh.indices.size() < minIndices || isInside(mesh)) {
+      mesh.Draw(shader);
+      return;
+    }
+
+    GLuint query = queries.acquire();
+
+    // render the bounding box into the query without touching the framebuffer
+    glm::vec3 center = (mesh.aabbMin + mesh.aabbMax) * 0.5f;
+    glm::vec3 extent = (mesh.aabbMax - mesh.aabbMin) * 0.5f;
+    glm::mat4 box = glm::translate(model, center);
+    box = glm::scale(box, glm::max(extent, glm::vec3(1e-4f)));
+
+    boxShader.use();
+    boxShader.setMat4("model", box);
+    boxShader.setMat4("view", view);
+    boxShader.setMat4("projection", projection);
+
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    glBeginQuery(GL_ANY_SAMPLES_PASSED, query);
+    glBindVertexArray(boxVAO);
+    glDrawElements(GL_TRIANGLES, 36, GL_UNSIGNED_INT, 0);
+    glEndQuery(GL_ANY_SAMPLES_PASSED);
+    glDepthMask(GL_TRUE);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    // the GPU waits on the box result, the CPU carries on submitting
+    shader.use();
+    glBeginConditionalRender(query, GL_QUERY_WAIT);
+    mesh.Draw(shader);
+    glEndConditionalRender();
+  }
+
+private:
+  Shader boxShader;
+  unsigned int boxVAO, boxVBO, boxEBO;
+  QueryPool queries;
+
+  glm::mat4 model{1.0f}, view{1.0f}, projection{1.0f};
+  glm::vec3 viewPos{0.0f}, localViewPos{0.0f};
+
+  // a box clipped by the near plane can report zero samples while the mesh
+  // is still on screen, so never test a mesh the camera is inside of
+  bool isInside(const Mesh &mesh) const {
+    const glm::vec3 margin(0.2f);
+    glm::vec3 lo = mesh.aabbMin - margin, hi = mesh.aabbMax + margin;
+    return localViewPos.x > lo.x && localViewPos.y > lo.y &&
+           localViewPos.z > lo.z && localViewPos.x < hi.x &&
+           localViewPos.y < hi.y && localViewPos.z < hi.z;
+  }
+
+  // unit cube spanning [-1, 1] on every axis
+  void setupBox() {
+    // clang-format off
+    const float vertices[] = {
+      -1.0f, -1.0f, -1.0f,   1.0f, -1.0f, -1.0f,
+       1.0f,  1.0f, -1.0f,  -1.0f,  1.0f, -1.0f,
+      -1.0f, -1.0f,  1.0f,   1.0f, -1.0f,  1.0f,
+       1.0f,  1.0f,  1.0f,  -1.0f,  1.0f,  1.0f,
+    };
+    const unsigned int indices[] = {
+      0, 1, 2,  2, 3, 0,   4, 5, 6,  6, 7, 4,
+      0, 4, 7,  7, 3, 0,   1, 5, 6,  6, 2, 1,
+      0, 1, 5,  5, 4, 0,   3, 2, 6,  6, 7, 3,
+    };
+    // clang-format on
+
+    glGenVertexArrays(1, &boxVAO);
+    glGenBuffers(1, &boxVBO);
+    glGenBuffers(1, &boxEBO);
+
+    glBindVertexArray(boxVAO);
+    glBindBuffer(GL_ARRAY_BUFFER, boxVBO);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, boxEBO);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices,
+                 GL_STATIC_DRAW);
+
+    glEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float),
+                          (void *)0);
+    glBindVertexArray(0);
+  }
+};
+
+#endif
@@ -0,0 +1,226 @@
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+
+enum class CullMode { CPU, GPU };
+// keep reloading the model while rendering: on the upload thread, through
+// the GL queue, or inline
+enum class StressLoad { Off, Async, Queue, Sync };
+// how the scene is lit, see deferred.hpp and visibility.hpp
+enum class Shading { Forward, Deferred, Visibility };
+// swap interval: none, every vertical blank, or adaptive, which tears instead
+// of waiting a whole blank when a frame is late
+enum class SwapMode { Off, Vsync, Adaptive };
+
+struct Options {
+  std::string modelPath = "models/backpack/backpack.obj";
+  // draw this many instances of the model instead of a single one
+  unsigned int instances = 0;
+  CullMode cullMode = CullMode::GPU;
+  // draw instances one by one from parallel recorded draw lists
+  bool drawLists = false;
+  // spin every instance so transforms are recomputed each frame
+  bool animate = false;
+  // job system worker threads, negative picks one per spare core
+  int workers = -1;
+  // step the simulation on its own thread instead of once per frame
+  bool threaded = false;
+  // simulation steps per second when threaded, 0 for unlimited
+  double simulationRate = 120.0;
+  StressLoad stressLoad = StressLoad::Off;
+  // per frame limits for uploads queued from other threads
+  double uploadMilliseconds = 2.0;
+  double uploadMegabytes = 8.0;
+  // clustered point lights, the first four at pointLightPositions
+  unsigned int lights = 4;
+  Shading shading = Shading::Forward;
+  // lay down depth with a positions only pass before shading
+  bool depthPrepass = false;
+  // scale the render resolution between minScale and maxScale of the window
+  // to keep the GPU frame time under targetMs
+  bool dynamicResolution = false;
+  double targetMs = 16.6;
+  double minScale = 0.5;
+  double maxScale = 1.0;
+  SwapMode swap = SwapMode::Vsync;
+  // frames per second to cap at, 0 for unlimited
+  double fpsLimit = 0.0;
+  // frames the CPU may queue ahead of the GPU
+  unsigned int framesInFlight = 2;
+  // only draw when something changed
+  bool onDemand = false;
+  // frame rate while in the background, with or without onDemand
+  double backgroundFps = 10.0;
+  // turn the camera by late input right before the draws
+  bool lateLatch = true;
+  // render into an offscreen framebuffer of width by height without a
+  // window, see headless_context.hpp
+  bool headless = false;
+  int width = 800, height = 600;
+  // exit after drawing this many frames, 0 to run until closed
+  unsigned int frames = 0;
+};
+
+inline void printUsage(const char *program) {
+  std::cout << "usage: " << program << " [options]\n"
+            << "  --model <path>        model to load\n"
+            << "  --instances <count>   draw a grid of instanced copies\n"
+            << "  --cull <cpu|gpu>      instance culling path\n"
+            << "  --draw-lists          record per instance draws on workers\n"
+            << "  --animate             rotate instances every frame\n"
+            << "  --workers <count>     job system worker threads\n"
+            << "  --threaded            run the simulation on its own thread\n"
+            << "  --sim-rate <hz>       threaded simulation steps per second\n"
+            << "  --stress-load <async|queue|sync>\n"
+            << "                        reload the model over and over\n"
+            << "  --upload-ms <ms>      queued upload time per frame\n"
+            << "  --upload-mb <MB>      queued upload bytes per frame\n"
+            << "  --lights <count>      clustered point lights\n"
+            << "  --shading <forward|deferred|visibility>\n"
+            << "                        lighting path to start with\n"
+            << "  --depth-prepass       start with the depth prepass on\n"
+            << "  --dynamic-resolution  start with dynamic resolution on\n"
+            << "  --target-ms <ms>      GPU frame time to scale towards\n"
+            << "  --min-scale <scale>   smallest render scale, above 0\n"
+            << "  --max-scale <scale>   largest render scale, up to 1\n"
+            << "  --swap <off|vsync|adaptive>\n"
+            << "                        swap interval\n"
+            << "  --fps-limit <hz>      cap the frame rate\n"
+            << "  --frames-in-flight <1-3>\n"
+            << "                        frames queued ahead of the GPU\n"
+            << "  --on-demand           draw only when something changed\n"
+            << "  --background-fps <hz> frame rate while unfocused\n"
+            << "  --no-late-latch       start without latching the camera\n"
+            << "  --headless            render offscreen without a window\n"
+            << "  --width <px>          framebuffer width\n"
+            << "  --height <px>         framebuffer height\n"
+            << "  --frames <count>      exit after drawing this many frames\n"
+            << "  --help                show this message\n";
+}
+
+inline Options parseOptions(int argc, char **argv) {
+  Options options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    // fetch the value following a flag
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc)
+        throw std::runtime_error("OPTIONS::MISSING_VALUE " + arg);
+      return argv[++i];
+    };
+
+    if (arg == "--help") {
+      printUsage(argv[0]);
+      std::exit(EXIT_SUCCESS);
+    } else if (arg == "--model") {
+      options.modelPath = value();
+    } else if (arg == "--instances") {
+      options.instances = static_cast<unsigned int>(std::stoul(value()));
+    } else if (arg == "--draw-lists") {
+      options.drawLists = true;
+    } else if (arg == "--animate") {
+      options.animate = true;
+    } else if (arg == "--workers") {
+      options.workers = std::stoi(value());
+    } else if (arg == "--threaded") {
+      options.threaded = true;
+    } else if (arg == "--sim-rate") {
+      options.simulationRate = std::stod(value());
+    } else if (arg == "--cull") {
+      std::string mode = value();
+      if (mode == "cpu")
+        options.cullMode = CullMode::CPU;
+      else if (mode == "gpu")
+        options.cullMode = CullMode::GPU;
+      else
+        throw std::runtime_error("OPTIONS::INVALID_CULL_MODE " + mode);
+    } else if (arg == "--upload-ms") {
+      options.uploadMilliseconds = std::stod(value());
+    } else if (arg == "--upload-mb") {
+      options.uploadMegabytes = std::stod(value());
+    } else if (arg == "--shading") {
+      std::string mode = value();
+      if (mode == "forward")
+        options.shading = Shading::Forward;
+      else if (mode == "deferred")
+        options.shading = Shading::Deferred;
+      else if (mode == "visibility")
+        options.shading = Shading::Visibility;
+      else
+        throw std::runtime_error("OPTIONS::INVALID_SHADING " + mode);
+    } else if (arg == "--depth-prepass") {
+      options.depthPrepass = true;
+    } else if (arg == "--dynamic-resolution") {
+      options.dynamicResolution = true;
+    } else if (arg == "--target-ms") {
+      options.targetMs = std::stod(value());
+    } else if (arg == "--min-scale") {
+      options.minScale = std::stod(value());
+    } else if (arg == "--max-scale") {
+      options.maxScale = std::stod(value());
+    } else if (arg == "--swap") {
+      std::string mode = value();
+      if (mode == "off")
+        options.swap = SwapMode::Off;
+      else if (mode == "vsync")
+        options.swap = SwapMode::Vsync;
+      else if (mode == "adaptive")
+        options.swap = SwapMode::Adaptive;
+      else
+        throw std::runtime_error("OPTIONS::INVALID_SWAP " + mode);
+    } else if (arg == "--fps-limit") {
+      options.fpsLimit = std::stod(value());
+    } else if (arg == "--frames-in-flight") {
+      options.framesInFlight = static_cast<unsigned int>(std::stoul(value()));
+    } else if (arg == "--on-demand") {
+      options.onDemand = true;
+    } else if (arg == "--background-fps") {
+      options.backgroundFps = std::stod(value());
+    } else if (arg == "--no-late-latch") {
+      options.lateLatch = false;
+    } else if (arg == "--headless") {
+      options.headless = true;
+    } else if (arg == "--width") {
+      options.width = std::stoi(value());
+    } else if (arg == "--height") {
+      options.height = std::stoi(value());
+    } else if (arg == "--frames") {
+      options.frames = static_cast<unsigned int>(std::stoul(value()));
+    } else if (arg == "--lights") {
+      options.lights = static_cast<unsigned int>(std::stoul(value()));
+    } else if (arg == "--stress-load") {
+      std::string mode = value();
+      if (mode == "async")
+        options.stressLoad = StressLoad::Async;
+      else if (mode == "queue")
+        options.stressLoad = StressLoad::Queue;
+      else if (mode == "sync")
+        options.stressLoad = StressLoad::Sync;
+      else
+        throw std::runtime_error("OPTIONS::INVALID_STRESS_LOAD " + mode);
+    } else {
+      printUsage(argv[0]);
+      throw std::runtime_error("OPTIONS::UNKNOWN_ARGUMENT " + arg);
+    }
+  }
+  if (options.minScale <= 0.0 || options.minScale > options.maxScale ||
+      options.maxScale > 1.0)
+    throw std::runtime_error("OPTIONS::INVALID_SCALE");
+  if (options.targetMs <= 0.0)
+    throw std::runtime_error("OPTIONS::INVALID_TARGET_MS");
+  if (options.framesInFlight < 1 || options.framesInFlight > 3)
+    throw std::runtime_error("OPTIONS::INVALID_FRAMES_IN_FLIGHT");
+  if (options.fpsLimit < 0.0)
+    throw std::runtime_error("OPTIONS::INVALID_FPS_LIMIT");
+  if (options.backgroundFps <= 0.0)
+    throw std::runtime_error("OPTIONS::INVALID_BACKGROUND_FPS");
+  if (options.width < 1 || options.height < 1)
+    throw std::runtime_error("OPTIONS::INVALID_SIZE");
+  return options;
+}
+
+#endif
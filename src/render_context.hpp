@@ -0,0 +1,38 @@
+#ifndef RENDER_CONTEXT_HPP
+#define RENDER_CONTEXT_HPP
+
+#include <glad/glad.h>
+
+#include <memory>
+
+// A GL context and what its frames are presented to, so the renderer runs
+// the same in a window (window_context.hpp) or without any display
+// (headless_context.hpp). A context is current on one thread at a time.
+class RenderContext {
+public:
+  virtual ~RenderContext() = default;
+
+  // bind to or detach from the calling thread
+  virtual void makeCurrent() = 0;
+  virtual void release() = 0;
+  // load the GL functions, with this context current
+  virtual bool loadGL() = 0;
+
+  // framebuffer frames end up in, 0 for a window's
+  virtual GLuint framebuffer() const = 0;
+  virtual void framebufferSize(int &width, int &height) const = 0;
+  // show the finished frame
+  virtual void present() = 0;
+  // 1 to wait for vertical blanks, 0 not to, -1 for adaptive
+  virtual void setSwapInterval(int interval) = 0;
+  // whether the context's window system supports an extension
+  virtual bool extensionSupported(const char *name) const = 0;
+
+  virtual bool shouldClose() const = 0;
+  virtual void requestClose() = 0;
+
+  // a context sharing objects with this one, for another thread
+  virtual std::unique_ptr<RenderContext> createShared() = 0;
+};
+
+#endif
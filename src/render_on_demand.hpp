@@ -0,0 +1,128 @@
+#ifndef RENDER_ON_DEMAND_HPP
+#define RENDER_ON_DEMAND_HPP
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#include "monotonic_clock.hpp"
+
+// Skips frames nobody would see change. Minimized windows never draw and
+// unfocused ones draw at backgroundFps, always. When enabled, focused ones
+// only draw on request too: anything that changes the picture calls
+// request(), input callbacks, held keys, animations, uploads landing, and
+// the camera is compared against the last drawn frame by watch(). With
+// nothing requested the render thread sleeps until a request instead of
+// redrawing, so an idle viewer costs next to no CPU.
+class RenderOnDemand {
+public:
+  // frames still drawn after the last change, for results that land a few
+  // frames late: GPU timers and queries, threaded simulation snapshots
+  static constexpr unsigned int TRAILING_FRAMES = 4;
+
+  // draw only on request, the window state throttles regardless
+  bool enabled = false;
+  // longest sleep, so work queued without a request still gets picked up
+  double idleTimeout = 0.25;
+  double backgroundFps = 10.0;
+
+  // something changed, draw again. Any thread may call it
+  void request() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      requested = true;
+    }
+    wake.notify_one();
+  }
+
+  // window state from the GLFW callbacks, also drawn for
+  void setIconified(bool value) {
+    iconified.store(value, std::memory_order_relaxed);
+    request();
+  }
+  void setFocused(bool value) {
+    focused.store(value, std::memory_order_relaxed);
+    request();
+  }
+
+  // request a frame if the camera moved since the last drawn one
+  void watch(const glm::mat4 &view, float zoom) {
+    if (view != lastView || zoom != lastZoom)
+      request();
+  }
+
+  // whether to draw a frame now. Otherwise it sleeps until a request, up to
+  // idleTimeout, and the caller should skip to the next iteration
+  bool shouldDraw() {
+    if (iconified.load(std::memory_order_relaxed)) {
+      // nothing to see until restored, whatever else gets requested
+      wait(idleTimeout, [this] {
+        return !iconified.load(std::memory_order_relaxed);
+      });
+      return false;
+    }
+    const std::uint64_t now = monotonicNanoseconds();
+    if (!focused.load(std::memory_order_relaxed) && now < nextBackground) {
+      // requests only count at the next background frame
+      ++skippedFrames;
+      std::this_thread::sleep_for(std::chrono::nanoseconds(
+          std::min(nextBackground - now,
+                   static_cast<std::uint64_t>(idleTimeout * 1e9))));
+      return false;
+    }
+    if (!enabled)
+      return true;
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (requested)
+        trailing = TRAILING_FRAMES;
+      requested = false;
+    }
+    if (trailing == 0) {
+      wait(idleTimeout, [this] { return requested; });
+      return false;
+    }
+    return true;
+  }
+
+  // after drawing a frame with this camera
+  void drawn(const glm::mat4 &view, float zoom) {
+    lastView = view;
+    lastZoom = zoom;
+    if (trailing > 0)
+      --trailing;
+    nextBackground = monotonicNanoseconds() +
+                     static_cast<std::uint64_t>(1e9 / backgroundFps);
+  }
+
+  // whether the last shouldDraw() found nothing to draw
+  bool idle() const { return enabled && trailing == 0; }
+  // frames skipped in total
+  std::uint64_t skipped() const { return skippedFrames; }
+
+private:
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool requested = true;
+  std::atomic<bool> iconified{false}, focused{true};
+  unsigned int trailing = TRAILING_FRAMES;
+  glm::mat4 lastView = glm::mat4(1.0f);
+  float lastZoom = 0.0f;
+  std::uint64_t nextBackground = 0;
+  std::uint64_t skippedFrames = 0;
+
+  // sleep until woken with done() true, or timeout seconds
+  template <typename Done> void wait(double timeout, Done done) {
+    ++skippedFrames;
+    std::unique_lock<std::mutex> lock(mutex);
+    wake.wait_for(lock, std::chrono::duration<double>(timeout), done);
+  }
+};
+
+#endif
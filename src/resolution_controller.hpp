@@ -0,0 +1,94 @@
+#ifndef RESOLUTION_CONTROLLER_HPP
+#define RESOLUTION_CONTROLLER_HPP
+
+#include <algorithm>
+#include <cmath>
+
+// Picks the render scale (fraction of the window's width and height) that
+// keeps GPU frame time just under a target. GPU time is taken to grow with
+// the pixel count, the square of the scale, so one step aims straight at
+// the middle of a dead band below the target rather than creeping there.
+// Against oscillation:
+// - measurements are smoothed;
+// - nothing changes while the smoothed time stays inside the band;
+// - scales are quantized and steps limited;
+// - after a change, the results still in flight from the old scale are
+//   thrown away before measuring again.
+class ResolutionController {
+public:
+  struct Settings {
+    double targetMs = 16.6;
+    double minScale = 0.5;
+    double maxScale = 1.0;
+  };
+
+  // band kept around the aim, as fractions of the target
+  static constexpr double LOW = 0.82, AIM = 0.9, HIGH = 1.0;
+  // scales are multiples of QUANTUM, changed by at most MAX_STEP at once
+  static constexpr double QUANTUM = 0.025, MAX_STEP = 0.15;
+  // smoothing factor and samples needed before acting on them
+  static constexpr double SMOOTHING = 0.2;
+  static constexpr unsigned int WARMUP = 8;
+
+  // settle is the number of measurements to drop after a change, at least
+  // the GPU timer's latency
+  explicit ResolutionController(Settings settings, unsigned int settle = 6)
+      : settings(settings), currentScale(settings.maxScale),
+        settleFrames(settle) {}
+
+  double scale() const { return currentScale; }
+  // smoothed GPU time the last decision was based on
+  double smoothedMs() const { return smoothed; }
+
+  // feed one GPU frame time, returns whether the scale changed
+  bool update(double gpuMs) {
+    if (skip > 0) {
+      --skip;
+      return false;
+    }
+    smoothed = samples == 0 ? gpuMs : smoothed + SMOOTHING * (gpuMs - smoothed);
+    if (++samples < WARMUP)
+      return false;
+
+    const double ratio = smoothed / settings.targetMs;
+    if (ratio >= LOW && ratio <= HIGH)
+      return false;
+    // already as sharp or as coarse as allowed
+    if (ratio < LOW && currentScale >= settings.maxScale)
+      return false;
+    if (ratio > HIGH && currentScale <= settings.minScale)
+      return false;
+
+    double next = currentScale * std::sqrt(AIM / ratio);
+    next = std::clamp(next, currentScale - MAX_STEP, currentScale + MAX_STEP);
+    // round toward the current scale, under rather than overshooting
+    next = next > currentScale ? std::floor(next / QUANTUM) * QUANTUM
+                               : std::ceil(next / QUANTUM) * QUANTUM;
+    next = std::clamp(next, settings.minScale, settings.maxScale);
+    if (std::abs(next - currentScale) < QUANTUM * 0.5) {
+      // the needed change is under one quantum, take the smallest step
+      // toward it unless that would leave the band on the other side
+      const double step = ratio > HIGH ? -QUANTUM : QUANTUM;
+      const double predicted =
+          ratio * (currentScale + step) * (currentScale + step) /
+          (currentScale * currentScale);
+      if (ratio < LOW && predicted > HIGH)
+        return false;
+      next = std::clamp(currentScale + step, settings.minScale,
+                        settings.maxScale);
+    }
+    currentScale = next;
+    skip = settleFrames;
+    samples = 0;
+    return true;
+  }
+
+private:
+  Settings settings;
+  double currentScale;
+  unsigned int settleFrames;
+  double smoothed = 0.0;
+  unsigned int samples = 0, skip = 0;
+};
+
+#endif
@@ -0,0 +1,96 @@
+#ifndef SCENE_GRAPH_HPP
+#define SCENE_GRAPH_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <algorithm>
+#include <stdexcept>
+#include <vector>
+
+// Node transform hierarchy stored as parallel arrays in topological order:
+// every parent precedes its children, so world matrices can be brought up to
+// date in a single forward pass. Only nodes marked dirty and their
+// descendants are recomputed.
+class SceneGraph {
+public:
+  // parent index of each node, -1 for roots
+  std::vector<int> parent;
+  // local transform, composed as translation * rotation * scale
+  std::vector<glm::vec3> translation;
+  std::vector<glm::quat> rotation;
+  std::vector<glm::vec3> scale;
+  // world transform and its normal matrix, valid after update()
+  std::vector<glm::mat4> world;
+  std::vector<glm::mat3> normal;
+
+  std::size_t size() const { return parent.size(); }
+
+  // append a node, its parent must already exist
+  int addNode(int parentIndex, const glm::vec3 &t, const glm::quat &r,
+              const glm::vec3 &s) {
+    if (parentIndex >= static_cast<int>(size()))
+      throw std::runtime_error("SCENE_GRAPH::PARENT_NOT_IN_ORDER");
+
+    parent.push_back(parentIndex);
+    translation.push_back(t);
+    rotation.push_back(r);
+    scale.push_back(s);
+    world.push_back(glm::mat4(1.0f));
+    normal.push_back(glm::mat3(1.0f));
+    dirty.push_back(1);
+    firstDirty = std::min(firstDirty, size() - 1);
+    return static_cast<int>(size() - 1);
+  }
+
+  void setTranslation(int node, const glm::vec3 &t) {
+    translation[node] = t;
+    markDirty(node);
+  }
+  void setRotation(int node, const glm::quat &r) {
+    rotation[node] = r;
+    markDirty(node);
+  }
+  void setScale(int node, const glm::vec3 &s) {
+    scale[node] = s;
+    markDirty(node);
+  }
+
+  // recompute world matrices of changed subtrees, returns whether any moved
+  bool update() {
+    const std::size_t count = size();
+    if (firstDirty >= count)
+      return false;
+
+    for (std::size_t i = firstDirty; i < count; ++i) {
+      const int p = parent[i];
+      // parents come first, so their flag already covers the whole chain
+      if (p >= 0 && dirty[p])
+        dirty[i] = 1;
+      if (!dirty[i])
+        continue;
+
+      glm::mat4 local = glm::translate(glm::mat4(1.0f), translation[i]) *
+                        glm::mat4_cast(rotation[i]);
+      local = glm::scale(local, scale[i]);
+      world[i] = p >= 0 ? world[p] * local : local;
+      normal[i] = glm::transpose(glm::inverse(glm::mat3(world[i])));
+    }
+    std::fill(dirty.begin() + static_cast<std::ptrdiff_t>(firstDirty),
+              dirty.end(), 0);
+    firstDirty = count;
+    return true;
+  }
+
+private:
+  std::vector<unsigned char> dirty;
+  std::size_t firstDirty = 0;
+
+  void markDirty(int node) {
+    dirty[node] = 1;
+    firstDirty = std::min(firstDirty, static_cast<std::size_t>(node));
+  }
+};
+
+#endif
@@ -7,66 +7,65 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <vector>
 
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
 
+#include "deletion_queue.hpp"
+#include "gpu_resources.hpp"
+
 class Shader {
 public:
   unsigned int ID;
-  // constructor generates the shader on the fly
+  // the program, for code that must not outlive the shader
+  ProgramHandle handle;
+  // constructor generates the shader on the fly. The fragment stage may be
+  // null for transform feedback programs, which capture the listed varyings
   // ------------------------------------------------------------------------
-  Shader(const char *vertexPath, const char *fragmentPath) {
-    // 1. retrieve the vertex/fragment source code from filePath
-    std::string vertexCode;
-    std::string fragmentCode;
-    std::ifstream vShaderFile;
-    std::ifstream fShaderFile;
-    // ensure ifstream objects can throw exceptions:
-    vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-    try {
-      // open files
-      vShaderFile.open(vertexPath);
-      fShaderFile.open(fragmentPath);
-      std::stringstream vShaderStream, fShaderStream;
-      // read file's buffer contents into streams
-      vShaderStream << vShaderFile.rdbuf();
-      fShaderStream << fShaderFile.rdbuf();
-      // close file handlers
-      vShaderFile.close();
-      fShaderFile.close();
-      // convert stream into string
-      vertexCode = vShaderStream.str();
-      fragmentCode = fShaderStream.str();
-    } catch (std::ifstream::failure &e) {
-      std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what()
-                << std::endl;
-    }
-    const char *vShaderCode = vertexCode.c_str();
-    const char *fShaderCode = fragmentCode.c_str();
-    // 2. compile shaders
-    unsigned int vertex, fragment;
-    // vertex shader
-    vertex = glCreateShader(GL_VERTEX_SHADER);
-    glShaderSource(vertex, 1, &vShaderCode, NULL);
-    glCompileShader(vertex);
-    checkCompileErrors(vertex, "VERTEX");
-    // fragment Shader
-    fragment = glCreateShader(GL_FRAGMENT_SHADER);
-    glShaderSource(fragment, 1, &fShaderCode, NULL);
-    glCompileShader(fragment);
-    checkCompileErrors(fragment, "FRAGMENT");
-    // shader Program
+  Shader(const char *vertexPath, const char *fragmentPath,
+         const char *geometryPath = nullptr,
+         const std::vector<const char *> &feedbackVaryings = {}) {
+    // 1. retrieve the source code from filePath and compile each stage
+    unsigned int vertex = compileShader(GL_VERTEX_SHADER, vertexPath, "VERTEX");
+    unsigned int fragment =
+        fragmentPath
+            ? compileShader(GL_FRAGMENT_SHADER, fragmentPath, "FRAGMENT")
+            : 0;
+    unsigned int geometry =
+        geometryPath
+            ? compileShader(GL_GEOMETRY_SHADER, geometryPath, "GEOMETRY")
+            : 0;
+    // 2. shader Program
     ID = glCreateProgram();
     glAttachShader(ID, vertex);
-    glAttachShader(ID, fragment);
+    if (fragment)
+      glAttachShader(ID, fragment);
+    if (geometry)
+      glAttachShader(ID, geometry);
+    // varyings must be declared before linking
+    if (!feedbackVaryings.empty())
+      glTransformFeedbackVaryings(
+          ID, static_cast<GLsizei>(feedbackVaryings.size()),
+          feedbackVaryings.data(), GL_INTERLEAVED_ATTRIBS);
     glLinkProgram(ID);
     checkCompileErrors(ID, "PROGRAM");
     // delete the shaders as they're linked into our program now and no longer
     // necessary
     glDeleteShader(vertex);
-    glDeleteShader(fragment);
+    if (fragment)
+      glDeleteShader(fragment);
+    if (geometry)
+      glDeleteShader(geometry);
+    handle = gpuResources().programs.insert({ID});
+  }
+  // the program is owned, so no copies
+  Shader(const Shader &) = delete;
+  Shader &operator=(const Shader &) = delete;
+  // the program goes to the deletion queue like any other GL object
+  ~Shader() {
+    gpuResources().programs.remove(handle);
+    retireGLObject(GLObject::Program, ID);
   }
   // activate the shader
   // ------------------------------------------------------------------------
@@ -81,10 +80,19 @@ public:
     glUniform1i(glGetUniformLocation(ID, name.c_str()), value);
   }
   // ------------------------------------------------------------------------
+  void setUint(const std::string &name, unsigned int value) const {
+    glUniform1ui(glGetUniformLocation(ID, name.c_str()), value);
+  }
+  // ------------------------------------------------------------------------
   void setFloat(const std::string &name, float value) const {
     glUniform1f(glGetUniformLocation(ID, name.c_str()), value);
   }
   // ------------------------------------------------------------------------
+  void setMat3(const std::string &name, const glm::mat3 &value) const {
+    glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE,
+                       glm::value_ptr(value));
+  }
+  // ------------------------------------------------------------------------
   void setMat4(const std::string &name, const glm::mat4 &value,
                bool isNormalized = false) const {
     glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1,
@@ -92,6 +100,10 @@ public:
                        glm::value_ptr(value));
   }
   // ------------------------------------------------------------------------
+  void setVec2(const std::string &name, const glm::vec2 &value) const {
+    glUniform2f(glGetUniformLocation(ID, name.c_str()), value.x, value.y);
+  }
+  // ------------------------------------------------------------------------
   void setVec3(const std::string &name, const glm::vec3 &value) {
     glUniform3f(glGetUniformLocation(ID, name.c_str()), value.x, value.y,
                 value.z);
@@ -100,8 +112,66 @@ public:
   void setVec3(const std::string &name, float x, float y, float z) {
     glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
   }
+  // ------------------------------------------------------------------------
+  void setVec4(const std::string &name, const glm::vec4 &value) const {
+    glUniform4f(glGetUniformLocation(ID, name.c_str()), value.x, value.y,
+                value.z, value.w);
+  }
 
 private:
+  // read a single stage from disk and compile it
+  // ------------------------------------------------------------------------
+  unsigned int compileShader(GLenum stage, const char *path,
+                             const std::string &type) {
+    const std::string code = readSource(path);
+    const char *shaderCode = code.c_str();
+    unsigned int shader = glCreateShader(stage);
+    glShaderSource(shader, 1, &shaderCode, NULL);
+    glCompileShader(shader);
+    checkCompileErrors(shader, type);
+    return shader;
+  }
+  // read a source file, replacing every #include "file" line with the
+  // contents of file, looked up next to path. Code shared between shaders
+  // lives in such files, see shaders/sun_light.glsl. #line directives keep
+  // compile errors at the lines of the file they are in
+  // ------------------------------------------------------------------------
+  static std::string readSource(const std::string &path) {
+    std::string code;
+    std::ifstream shaderFile;
+    // ensure ifstream objects can throw exceptions:
+    shaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+    try {
+      // open file and read its buffer contents into a stream
+      shaderFile.open(path);
+      std::stringstream shaderStream;
+      shaderStream << shaderFile.rdbuf();
+      shaderFile.close();
+      // convert stream into string
+      code = shaderStream.str();
+    } catch (std::ifstream::failure &e) {
+      std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << path
+                << " " << e.what() << std::endl;
+      return code;
+    }
+
+    const std::string directive = "#include \"";
+    const std::string directory = path.substr(0, path.find_last_of('/') + 1);
+    std::istringstream lines(code);
+    std::string line, source;
+    for (int number = 1; std::getline(lines, line); ++number) {
+      if (line.compare(0, directive.size(), directive) != 0) {
+        source += line + '\n';
+        continue;
+      }
+      const std::size_t end = line.find('"', directive.size());
+      source += "#line 1\n" +
+                readSource(directory + line.substr(directive.size(),
+                                                   end - directive.size())) +
+                "#line " + std::to_string(number + 1) + '\n';
+    }
+    return source;
+  }
   // utility function for checking shader compilation/linking errors.
   // ------------------------------------------------------------------------
   void checkCompileErrors(unsigned int shader, std::string type) {
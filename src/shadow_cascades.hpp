@@ -0,0 +1,350 @@
+#ifndef SHADOW_CASCADES_HPP
+#define SHADOW_CASCADES_HPP
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "deletion_queue.hpp"
+#include "frustum.hpp"
+#include "model.hpp"
+#include "shader.hpp"
+#include "transform_system.hpp"
+
+// Cascaded shadow maps for the directional sun. The view frustum up to the
+// shadow distance is split into CASCADES slices, each covered by an
+// orthographic light frustum rendered into a layer of a depth texture
+// array.
+//
+// Static casters are rendered into a cache of their own, and only when a
+// cascade's light frustum changes. Cascades are therefore fitted loosely:
+// each is a square somewhat larger than its slice's bounding sphere,
+// snapped to whole texels, and it is only moved once the slice leaves it.
+// The depth range spans the scene bounds and stays fixed. Dynamic casters
+// are drawn every frame on top of a copy of the cache. Frames without any
+// skip the copy and sample the cache directly.
+//
+// Casters are culled against each cascade's light frustum. They are drawn
+// through the meshes' packed position streams, with instance transforms
+// read from a buffer texture.
+class ShadowCascades {
+public:
+  static constexpr unsigned int CASCADES = 3;
+  static constexpr GLsizei SIZE = 2048;
+  // texture unit of the shadow map, below the light clusters
+  static constexpr GLint UNIT = 7;
+
+  ShadowCascades() : shader("shaders/shadow.vs", "shaders/depth.fs") {
+    for (unsigned int &map : maps) {
+      glGenTextures(1, &map);
+      glBindTexture(GL_TEXTURE_2D_ARRAY, map);
+      glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT32F, SIZE, SIZE,
+                   CASCADES, 0, GL_DEPTH_COMPONENT, GL_FLOAT, nullptr);
+      // hardware 2x2 percentage closer filtering
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S,
+                      GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T,
+                      GL_CLAMP_TO_EDGE);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE,
+                      GL_COMPARE_REF_TO_TEXTURE);
+      glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC,
+                      GL_LEQUAL);
+    }
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+    // one framebuffer per layer of either array
+    glGenFramebuffers(2 * CASCADES, framebuffers.data());
+    for (unsigned int i = 0; i < 2 * CASCADES; ++i) {
+      glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[i]);
+      glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                                maps[i / CASCADES], 0,
+                                static_cast<GLint>(i % CASCADES));
+      glDrawBuffer(GL_NONE);
+      glReadBuffer(GL_NONE);
+      if (glCheckFramebufferStatus(GL_FRAMEBUFFER) !=
+          GL_FRAMEBUFFER_COMPLETE)
+        throw std::runtime_error("SHADOW::FRAMEBUFFER_INCOMPLETE " +
+                                 std::to_string(i));
+    }
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+
+    glGenBuffers(1, &casterBuffer);
+    glGenTextures(1, &casterTexture);
+    glBindBuffer(GL_TEXTURE_BUFFER, casterBuffer);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(InstanceData), nullptr,
+                 GL_STREAM_DRAW);
+    glBindTexture(GL_TEXTURE_BUFFER, casterTexture);
+    glTexBuffer(GL_TEXTURE_BUFFER, GL_RGBA32F, casterBuffer);
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  }
+
+  ShadowCascades(const ShadowCascades &) = delete;
+  ShadowCascades &operator=(const ShadowCascades &) = delete;
+
+  ~ShadowCascades() {
+    for (unsigned int map : maps)
+      retireGLObject(GLObject::Texture, map);
+    retireGLObject(GLObject::Texture, casterTexture);
+    retireGLObject(GLObject::Buffer, casterBuffer);
+    glDeleteFramebuffers(2 * CASCADES, framebuffers.data());
+  }
+
+  // world space box every caster stays inside, sets the depth range
+  void setSceneBounds(const glm::vec3 &min, const glm::vec3 &max) {
+    sceneMin = min;
+    sceneMax = max;
+    invalidate();
+  }
+
+  // re-render the static casters of every cascade on the next render()
+  void invalidate() {
+    for (Cascade &cascade : cascades)
+      cascade.valid = false;
+  }
+
+  // fit the cascades to the camera, direction points from the sun into the
+  // scene. Cascades that have to move lose their cached static casters
+  void update(const glm::vec3 &direction, const glm::mat4 &view, float fovy,
+              float aspect, float near, float shadowDistance) {
+    if (direction != sunDirection) {
+      sunDirection = direction;
+      const glm::vec3 up = std::abs(direction.y) > 0.99f
+                               ? glm::vec3(0.0f, 0.0f, 1.0f)
+                               : glm::vec3(0.0f, 1.0f, 0.0f);
+      lightView = glm::lookAt(glm::vec3(0.0f), direction, up);
+      // depth range of the scene seen from the sun
+      lightNear = INFINITY;
+      lightFar = -INFINITY;
+      for (int corner = 0; corner < 8; ++corner) {
+        glm::vec3 point((corner & 1) ? sceneMax.x : sceneMin.x,
+                        (corner & 2) ? sceneMax.y : sceneMin.y,
+                        (corner & 4) ? sceneMax.z : sceneMin.z);
+        const float z = -(lightView * glm::vec4(point, 1.0f)).z;
+        lightNear = std::min(lightNear, z);
+        lightFar = std::max(lightFar, z);
+      }
+      // every cascade is refitted in the new light space
+      for (Cascade &cascade : cascades)
+        cascade.extent = 0.0f;
+    }
+
+    const glm::mat4 inverseView = glm::inverse(view);
+    const float tanY = std::tan(fovy * 0.5f), tanX = tanY * aspect;
+    float sliceNear = near;
+    for (unsigned int i = 0; i < CASCADES; ++i) {
+      // blend of logarithmic and uniform splits
+      const float t = static_cast<float>(i + 1) / CASCADES;
+      const float sliceFar =
+          0.75f * near * std::pow(shadowDistance / near, t) +
+          0.25f * (near + (shadowDistance - near) * t);
+
+      // bounding sphere of the slice, in light space
+      glm::vec3 corners[8];
+      glm::vec3 center(0.0f);
+      for (int c = 0; c < 8; ++c) {
+        const float depth = (c & 4) ? sliceFar : sliceNear;
+        const glm::vec4 point((c & 1 ? 1.0f : -1.0f) * tanX * depth,
+                              (c & 2 ? 1.0f : -1.0f) * tanY * depth, -depth,
+                              1.0f);
+        corners[c] = glm::vec3(lightView * inverseView * point);
+        center += corners[c] * 0.125f;
+      }
+      float radius = 0.0f;
+      for (const glm::vec3 &corner : corners)
+        radius = std::max(radius, glm::length(corner - center));
+      sliceNear = sliceFar;
+
+      Cascade &cascade = cascades[i];
+      const bool inside =
+          std::abs(center.x - cascade.center.x) + radius <= cascade.extent &&
+          std::abs(center.y - cascade.center.y) + radius <= cascade.extent;
+      if (inside && cascade.extent <= 1.5f * MARGIN * radius)
+        continue;
+      // room to move before the cascade has to follow
+      cascade.extent = MARGIN * radius;
+      const float texel = 2.0f * cascade.extent / static_cast<float>(SIZE);
+      cascade.center = glm::vec2(std::floor(center.x / texel) * texel,
+                                 std::floor(center.y / texel) * texel);
+      cascade.matrix =
+          glm::ortho(cascade.center.x - cascade.extent,
+                     cascade.center.x + cascade.extent,
+                     cascade.center.y - cascade.extent,
+                     cascade.center.y + cascade.extent, lightNear, lightFar) *
+          lightView;
+      cascade.valid = false;
+    }
+  }
+
+  // render the cascades, static casters only where their cache is stale.
+  // Restores the framebuffer and viewport bound before
+  void render(Model &model, const std::vector<InstanceData> &staticCasters,
+              const std::vector<InstanceData> &dynamicCasters) {
+    GLint framebuffer, viewport[4];
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &framebuffer);
+    glGetIntegerv(GL_VIEWPORT, viewport);
+
+    // cull every pass first, so all casters go up in one upload
+    std::vector<Pass> passes;
+    casters.clear();
+    refreshedCascades = 0;
+    for (unsigned int i = 0; i < CASCADES; ++i) {
+      if (!cascades[i].valid) {
+        passes.push_back({i, true, 0, 0});
+        cull(model, cascades[i].matrix, staticCasters, passes.back());
+        ++refreshedCascades;
+      }
+    }
+    dynamicFrame = !dynamicCasters.empty();
+    if (dynamicFrame)
+      for (unsigned int i = 0; i < CASCADES; ++i) {
+        passes.push_back({i, false, 0, 0});
+        cull(model, cascades[i].matrix, dynamicCasters, passes.back());
+      }
+    if (passes.empty())
+      return;
+
+    glBindBuffer(GL_TEXTURE_BUFFER, casterBuffer);
+    glBufferData(GL_TEXTURE_BUFFER,
+                 static_cast<GLsizeiptr>(
+                     std::max<std::size_t>(casters.size(), 1) *
+                     sizeof(InstanceData)),
+                 casters.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(UNIT));
+    glBindTexture(GL_TEXTURE_BUFFER, casterTexture);
+    glActiveTexture(GL_TEXTURE0);
+
+    shader.use();
+    shader.setInt("casterTransforms", UNIT);
+    glViewport(0, 0, SIZE, SIZE);
+    glEnable(GL_DEPTH_CLAMP);
+    glEnable(GL_POLYGON_OFFSET_FILL);
+    glPolygonOffset(2.0f, 4.0f);
+    for (const Pass &pass : passes) {
+      const unsigned int cascade = pass.cascade;
+      if (pass.cached) {
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[CASCADES + cascade]);
+        glClear(GL_DEPTH_BUFFER_BIT);
+        cascades[cascade].valid = true;
+      } else {
+        // the cached static casters, then the dynamic ones over them
+        glBindFramebuffer(GL_READ_FRAMEBUFFER,
+                          framebuffers[CASCADES + cascade]);
+        glBindFramebuffer(GL_DRAW_FRAMEBUFFER, framebuffers[cascade]);
+        glBlitFramebuffer(0, 0, SIZE, SIZE, 0, 0, SIZE, SIZE,
+                          GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+        glBindFramebuffer(GL_FRAMEBUFFER, framebuffers[cascade]);
+      }
+      if (pass.count == 0)
+        continue;
+      shader.setMat4("lightViewProjection", cascades[cascade].matrix);
+      shader.setInt("casterBase", pass.first);
+      model.DrawDepthInstanced(shader, static_cast<unsigned int>(pass.count));
+    }
+    glDisable(GL_POLYGON_OFFSET_FILL);
+    glDisable(GL_DEPTH_CLAMP);
+
+    glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(UNIT));
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glActiveTexture(GL_TEXTURE0);
+    glBindFramebuffer(GL_FRAMEBUFFER, static_cast<GLuint>(framebuffer));
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+  }
+
+  // bind the shadow map and set the sun uniforms, shader must be in use
+  void bind(Shader &shader) const {
+    glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(UNIT));
+    glBindTexture(GL_TEXTURE_2D_ARRAY, maps[dynamicFrame ? 0 : 1]);
+    glActiveTexture(GL_TEXTURE0);
+    shader.setInt("shadowMap", UNIT);
+    shader.setVec3("sunDirection", sunDirection);
+    shader.setVec3("sunColor", color);
+    glm::vec3 texels;
+    for (unsigned int i = 0; i < CASCADES; ++i) {
+      shader.setMat4("cascadeMatrices[" + std::to_string(i) + "]",
+                     cascades[i].matrix);
+      texels[static_cast<int>(i)] =
+          2.0f * cascades[i].extent / static_cast<float>(SIZE);
+    }
+    shader.setVec3("cascadeTexels", texels);
+  }
+
+  // cascades whose static casters were drawn by the last render()
+  unsigned int refreshed() const { return refreshedCascades; }
+  // caster instances drawn by the last render(), over all cascades
+  std::size_t castersDrawn() const { return casters.size(); }
+
+  glm::vec3 color{0.4f, 0.38f, 0.33f};
+
+private:
+  // how much larger than its slice a cascade is made
+  static constexpr float MARGIN = 1.25f;
+
+  struct Cascade {
+    glm::mat4 matrix{1.0f};
+    // light space center and half size of the square it covers
+    glm::vec2 center{0.0f};
+    float extent = 0.0f;
+    // whether the static cache holds this light frustum
+    bool valid = false;
+  };
+
+  // casters of one cascade, first is where they start in casters
+  struct Pass {
+    unsigned int cascade;
+    // drawn into the static cache, or over a copy of it
+    bool cached;
+    GLint first;
+    GLsizei count;
+  };
+
+  Shader shader;
+  std::array<Cascade, CASCADES> cascades;
+  glm::vec3 sunDirection{0.0f};
+  glm::mat4 lightView{1.0f};
+  float lightNear = 0.0f, lightFar = 1.0f;
+  glm::vec3 sceneMin{-1.0f}, sceneMax{1.0f};
+  // cascades with dynamic casters, then the static cache
+  unsigned int maps[2];
+  std::array<unsigned int, 2 * CASCADES> framebuffers;
+  unsigned int casterBuffer, casterTexture;
+  std::vector<InstanceData> casters;
+  unsigned int refreshedCascades = 0;
+  bool dynamicFrame = false;
+
+  // append the instances whose model bounds touch the light frustum
+  void cull(const Model &model, const glm::mat4 &lightViewProjection,
+            const std::vector<InstanceData> &instances, Pass &pass) {
+    const Frustum frustum(lightViewProjection);
+    const glm::vec3 center = (model.aabbMin + model.aabbMax) * 0.5f;
+    const glm::vec3 extent = (model.aabbMax - model.aabbMin) * 0.5f;
+    pass.first = static_cast<GLint>(casters.size());
+    for (const InstanceData &instance : instances) {
+      // world bounds of the transformed model box
+      const glm::mat3 axes(instance.model);
+      const glm::vec3 worldCenter =
+          glm::vec3(instance.model * glm::vec4(center, 1.0f));
+      const glm::vec3 worldExtent =
+          glm::abs(axes[0]) * extent.x + glm::abs(axes[1]) * extent.y +
+          glm::abs(axes[2]) * extent.z;
+      if (frustum.intersectsBox(worldCenter - worldExtent,
+                                worldCenter + worldExtent))
+        casters.push_back(instance);
+    }
+    pass.count = static_cast<GLsizei>(casters.size()) - pass.first;
+  }
+};
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef SIMULATION_HPP
+#define SIMULATION_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+#include "camera.hpp"
+#include "input_queue.hpp"
+#include "job_system.hpp"
+#include "monotonic_clock.hpp"
+#include "transform_system.hpp"
+#include "triple_buffer.hpp"
+
+// everything the renderer needs from one simulation step
+struct FrameSnapshot {
+  glm::mat4 view = glm::mat4(1.0f);
+  float zoom = ZOOM;
+  glm::vec3 viewPos = glm::vec3(0.0f);
+  // the camera view came from and the mouse motion it has consumed in
+  // total, for late latching newer motion onto it
+  Camera camera;
+  double mouseX = 0.0, mouseY = 0.0;
+  glm::vec3 lightPos = glm::vec3(0.0f);
+  InstanceData sceneTransform = {glm::mat4(1.0f), {}};
+  // instanced scene transforms, only filled when they are animated
+  std::vector<InstanceData> instances;
+  std::uint64_t tick = 0;
+  // input events applied by this step
+  std::size_t inputEvents = 0;
+  // time spent producing this snapshot
+  double simulationMs = 0.0;
+};
+
+// Owns the state that changes over time: camera, light and entity
+// transforms. step() advances it and publishes a snapshot through a triple
+// buffer, so it can run inline on the render thread or on a thread of its own
+// via start(). In the latter case the renderer only ever reads snapshots and
+// neither side waits for the other, a frame costs max(update, render) instead
+// of their sum. Once started, the members belong to the simulation thread.
+class Simulation {
+public:
+  Camera camera;
+  glm::vec3 lightPos;
+  // the single scene model is entity 0
+  TransformSystem scene;
+  TransformSystem instances;
+  // spin every instance each step
+  bool animate = false;
+
+  Simulation(const Camera &camera, const glm::vec3 &lightPos,
+             InputQueue &input, JobSystem &jobs)
+      : camera(camera), lightPos(lightPos), input(input), jobs(jobs),
+        epoch(std::chrono::steady_clock::now()),
+        inputNs(monotonicNanoseconds()) {
+    scene.add(glm::vec3(0.0f));
+  }
+
+  Simulation(const Simulation &) = delete;
+  Simulation &operator=(const Simulation &) = delete;
+
+  ~Simulation() { stop(); }
+
+  // apply the input queued since the previous step, each event at the time
+  // it arrived, and publish the result
+  void step() {
+    using clock = std::chrono::steady_clock;
+    const clock::time_point start = clock::now();
+    const float time = std::chrono::duration<float>(start - epoch).count();
+
+    // held keys move the camera along wherever it faced at the time, so
+    // the result doesn't depend on how often steps run
+    std::size_t events = 0;
+    InputEvent event;
+    while (input.pop(event)) {
+      ++events;
+      integrate(event.ns);
+      switch (event.type) {
+      case InputEvent::Type::Key:
+        held[event.key] = event.down;
+        break;
+      case InputEvent::Type::Mouse:
+        camera.ProcessMouseMovement(event.x, event.y);
+        mouseX += event.x;
+        mouseY += event.y;
+        break;
+      case InputEvent::Type::Scroll:
+        camera.ProcessMouseScroll(event.y);
+        break;
+      }
+    }
+    integrate(monotonicNanoseconds());
+
+    scene.update();
+    if (animate)
+      jobs.parallelFor(0, instances.size(), 4096,
+                       [&](std::size_t first, std::size_t end) {
+                         spin(time, first, end);
+                       });
+
+    FrameSnapshot &snapshot = buffer.back();
+    snapshot.view = camera.GetViewMatrix();
+    snapshot.zoom = camera.Zoom;
+    snapshot.viewPos = camera.Position;
+    snapshot.camera = camera;
+    snapshot.mouseX = mouseX;
+    snapshot.mouseY = mouseY;
+    snapshot.inputEvents = events;
+    snapshot.lightPos = lightPos;
+    snapshot.sceneTransform = scene.instances[0];
+    if (animate)
+      snapshot.instances = instances.instances;
+    snapshot.tick = ++tick;
+    snapshot.simulationMs =
+        std::chrono::duration<double, std::milli>(clock::now() - start)
+            .count();
+    buffer.publish();
+  }
+
+  // newest published snapshot, valid until the next call; fresh tells
+  // whether it changed since then
+  const FrameSnapshot &acquire(bool *fresh = nullptr) {
+    return buffer.acquire(fresh);
+  }
+
+  // keep stepping on a separate thread at rate steps per second, as fast as
+  // possible if rate isn't positive
+  void start(double rate) {
+    if (thread.joinable())
+      return;
+    // something to render before the thread's first step lands
+    step();
+    stopping.store(false, std::memory_order_relaxed);
+    thread = std::thread([this, rate] { run(rate); });
+  }
+
+  void stop() {
+    if (!thread.joinable())
+      return;
+    stopping.store(true, std::memory_order_relaxed);
+    thread.join();
+  }
+
+  bool running() const { return thread.joinable(); }
+
+private:
+  InputQueue &input;
+  JobSystem &jobs;
+  TripleBuffer<FrameSnapshot> buffer;
+  std::chrono::steady_clock::time_point epoch;
+  std::uint64_t tick = 0;
+  // input applied up to inputNs: keys held then and mouse motion in total
+  std::uint64_t inputNs;
+  bool held[4] = {};
+  double mouseX = 0.0, mouseY = 0.0;
+
+  std::thread thread;
+  std::atomic<bool> stopping{false};
+
+  // move the camera for the keys held from inputNs until ns
+  void integrate(std::uint64_t ns) {
+    // events pushed after the previous step started may be older than it
+    if (ns <= inputNs)
+      return;
+    const float deltaTime = static_cast<float>(ns - inputNs) * 1e-9f;
+    inputNs = ns;
+    for (int i = 0; i < 4; ++i)
+      if (held[i])
+        camera.ProcessKeyboard(static_cast<Camera_Movement>(i), deltaTime);
+  }
+
+  void spin(float time, std::size_t first, std::size_t end) {
+    for (std::size_t i = first; i < end; ++i)
+      instances.setRotation(
+          i, glm::angleAxis(time + static_cast<float>(i % 64),
+                            glm::vec3(0.0f, 1.0f, 0.0f)));
+    instances.update(first, end);
+  }
+
+  void run(double rate) {
+    using clock = std::chrono::steady_clock;
+    const clock::duration period =
+        std::chrono::duration_cast<clock::duration>(
+            std::chrono::duration<double>(rate > 0.0 ? 1.0 / rate : 0.0));
+    clock::time_point next = clock::now();
+    while (!stopping.load(std::memory_order_relaxed)) {
+      step();
+      next += period;
+      // fell behind, start over instead of stepping in a burst
+      const clock::time_point now = clock::now();
+      if (next < now)
+        next = now;
+      if (period > clock::duration::zero())
+        std::this_thread::sleep_until(next);
+      else
+        std::this_thread::yield();
+    }
+  }
+};
+
+#endif
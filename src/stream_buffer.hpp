@@ -0,0 +1,151 @@
+#ifndef STREAM_BUFFER_HPP
+#define STREAM_BUFFER_HPP
+
+#include <glad/glad.h>
+
+#include <array>
+#include <cstddef>
+#include <stdexcept>
+
+#include "deletion_queue.hpp"
+
+// Ring of per frame regions for data rewritten every frame. beginFrame()
+// waits until the GPU is done with the region written FRAMES frames ago,
+// allocate() hands out pointers into it and endFrame() fences it after the
+// last draw reading it, so the driver never has to copy or synchronize.
+//
+// On GL 4.4 (or ARB_buffer_storage) the whole buffer is mapped once,
+// persistent and coherent, and allocate() returns a pointer into that
+// mapping. GL 3.3 can't draw from a mapped buffer, so there every
+// allocation maps just its own range, unsynchronized since the fences
+// already keep the GPU away from it, and commit() unmaps it again.
+class StreamBuffer {
+public:
+  static constexpr std::size_t FRAMES = 3;
+
+  StreamBuffer(GLenum target, std::size_t frameSize)
+      : target(target), regionSize(frameSize) {
+    persistentMap = GLAD_GL_VERSION_4_4 || GLAD_GL_ARB_buffer_storage;
+    const GLsizeiptr size = static_cast<GLsizeiptr>(FRAMES * regionSize);
+
+    glGenBuffers(1, &id);
+    glBindBuffer(target, id);
+    if (persistentMap) {
+      const GLbitfield flags =
+          GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+      glBufferStorage(target, size, nullptr, flags);
+      mapping = static_cast<char *>(glMapBufferRange(target, 0, size, flags));
+      if (!mapping)
+        throw std::runtime_error("STREAM_BUFFER::MAP_FAILED");
+    } else {
+      glBufferData(target, size, nullptr, GL_STREAM_DRAW);
+    }
+    glBindBuffer(target, 0);
+  }
+
+  StreamBuffer(const StreamBuffer &) = delete;
+  StreamBuffer &operator=(const StreamBuffer &) = delete;
+
+  ~StreamBuffer() {
+    for (GLsync fence : fences)
+      if (fence)
+        glDeleteSync(fence);
+    if (persistentMap) {
+      glBindBuffer(target, id);
+      glUnmapBuffer(target);
+      glBindBuffer(target, 0);
+    }
+    retireGLObject(GLObject::Buffer, id);
+  }
+
+  bool persistent() const { return persistentMap; }
+  unsigned int buffer() const { return id; }
+  std::size_t frameSize() const { return regionSize; }
+  // frames that had to wait for the GPU to release their region
+  std::size_t stalls() const { return stallCount; }
+
+  // start writing the next region, waiting for the GPU if it still reads it.
+  // Does nothing if a frame is already open
+  void beginFrame() {
+    if (open)
+      return;
+    open = true;
+    used = 0;
+    GLsync &fence = fences[region];
+    if (!fence)
+      return;
+    GLenum status = glClientWaitSync(fence, 0, 0);
+    if (status == GL_TIMEOUT_EXPIRED) {
+      ++stallCount;
+      do
+        status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                  1000000000);
+      while (status == GL_TIMEOUT_EXPIRED);
+    }
+    glDeleteSync(fence);
+    fence = nullptr;
+  }
+
+  // reserve bytes in this frame's region and return where to write them,
+  // offset receives their position in buffer(). Null if the region is full.
+  // Without a persistent mapping the range stays mapped until commit()
+  void *allocate(std::size_t bytes, GLintptr &offset,
+                 std::size_t alignment = 16) {
+    if (!open)
+      throw std::runtime_error("STREAM_BUFFER::FRAME_NOT_STARTED");
+    if (mapped)
+      throw std::runtime_error("STREAM_BUFFER::PREVIOUS_NOT_COMMITTED");
+    const std::size_t start = (used + alignment - 1) / alignment * alignment;
+    if (bytes == 0 || start + bytes > regionSize)
+      return nullptr;
+    used = start + bytes;
+    offset = static_cast<GLintptr>(region * regionSize + start);
+    if (persistentMap)
+      return mapping + offset;
+
+    glBindBuffer(target, id);
+    void *data = glMapBufferRange(target, offset,
+                                  static_cast<GLsizeiptr>(bytes),
+                                  GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT |
+                                      GL_MAP_INVALIDATE_RANGE_BIT);
+    glBindBuffer(target, 0);
+    mapped = data != nullptr;
+    return data;
+  }
+
+  // finish the last allocation, before anything reads it. Coherent
+  // persistent writes are visible as they are, mapped ranges get unmapped
+  void commit() {
+    if (!mapped)
+      return;
+    glBindBuffer(target, id);
+    glUnmapBuffer(target);
+    glBindBuffer(target, 0);
+    mapped = false;
+  }
+
+  // after the last command reading this frame's data
+  void endFrame() {
+    if (!open)
+      return;
+    commit();
+    fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    region = (region + 1) % FRAMES;
+    open = false;
+  }
+
+private:
+  GLenum target;
+  std::size_t regionSize;
+  bool persistentMap;
+  unsigned int id = 0;
+  char *mapping = nullptr;
+  std::array<GLsync, FRAMES> fences{};
+  std::size_t region = 0;
+  std::size_t used = 0;
+  bool open = false;
+  bool mapped = false;
+  std::size_t stallCount = 0;
+};
+
+#endif
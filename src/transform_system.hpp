@@ -0,0 +1,185 @@
+#ifndef TRANSFORM_SYSTEM_HPP
+#define TRANSFORM_SYSTEM_HPP
+
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstddef>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <xmmintrin.h>
+#define TRANSFORM_SYSTEM_SSE 1
+#endif
+
+// per instance data as the vertex shader consumes it: the world matrix and
+// its normal matrix, stored as three vec4 columns (std140 mat3 layout)
+struct InstanceData {
+  glm::mat4 model;
+  glm::vec4 normal[3];
+};
+
+inline glm::mat3 normalMatrix(const InstanceData &instance) {
+  return glm::mat3(glm::vec3(instance.normal[0]), glm::vec3(instance.normal[1]),
+                   glm::vec3(instance.normal[2]));
+}
+
+// Entity transforms stored as structure of arrays so that four entities at a
+// time fit the lanes of an SSE register. update() turns position, rotation
+// and scale into world and normal matrices in one batch per frame. Rotation
+// and scale are kept separate precisely so the normal matrix never needs a
+// general inverse: for M = T * R * S it is simply R * S^-1.
+class TransformSystem {
+public:
+  // position
+  std::vector<float> px, py, pz;
+  // rotation quaternion
+  std::vector<float> qx, qy, qz, qw;
+  // scale
+  std::vector<float> sx, sy, sz;
+  // output of update(), one per entity
+  std::vector<InstanceData> instances;
+
+  std::size_t size() const { return px.size(); }
+
+  std::size_t add(const glm::vec3 &position,
+                  const glm::quat &rotation = glm::quat(1.0f, 0.0f, 0.0f, 0.0f),
+                  const glm::vec3 &scale = glm::vec3(1.0f)) {
+    px.push_back(position.x);
+    py.push_back(position.y);
+    pz.push_back(position.z);
+    qx.push_back(rotation.x);
+    qy.push_back(rotation.y);
+    qz.push_back(rotation.z);
+    qw.push_back(rotation.w);
+    sx.push_back(scale.x);
+    sy.push_back(scale.y);
+    sz.push_back(scale.z);
+    instances.push_back({glm::mat4(1.0f), {}});
+    return size() - 1;
+  }
+
+  void setPosition(std::size_t i, const glm::vec3 &position) {
+    px[i] = position.x;
+    py[i] = position.y;
+    pz[i] = position.z;
+  }
+  void setRotation(std::size_t i, const glm::quat &rotation) {
+    qx[i] = rotation.x;
+    qy[i] = rotation.y;
+    qz[i] = rotation.z;
+    qw[i] = rotation.w;
+  }
+  void setScale(std::size_t i, const glm::vec3 &scale) {
+    sx[i] = scale.x;
+    sy[i] = scale.y;
+    sz[i] = scale.z;
+  }
+
+  // recompute the matrices of every entity
+  void update() { update(0, size()); }
+
+  // recompute the matrices of entities [first, last), ranges may be updated
+  // concurrently as long as they don't overlap
+  void update(std::size_t first, std::size_t last) {
+    std::size_t i = first;
+#ifdef TRANSFORM_SYSTEM_SSE
+    for (; i + 4 <= last; i += 4)
+      updateSSE(i);
+#endif
+    for (; i < last; ++i)
+      updateScalar(i);
+  }
+
+private:
+  void updateScalar(std::size_t i) {
+    const float x = qx[i], y = qy[i], z = qz[i], w = qw[i];
+    const float xx = x * x, yy = y * y, zz = z * z;
+    const float xy = x * y, xz = x * z, yz = y * z;
+    const float wx = w * x, wy = w * y, wz = w * z;
+
+    // rotation columns
+    const glm::vec3 r0(1.0f - 2.0f * (yy + zz), 2.0f * (xy + wz),
+                       2.0f * (xz - wy));
+    const glm::vec3 r1(2.0f * (xy - wz), 1.0f - 2.0f * (xx + zz),
+                       2.0f * (yz + wx));
+    const glm::vec3 r2(2.0f * (xz + wy), 2.0f * (yz - wx),
+                       1.0f - 2.0f * (xx + yy));
+
+    InstanceData &out = instances[i];
+    out.model[0] = glm::vec4(r0 * sx[i], 0.0f);
+    out.model[1] = glm::vec4(r1 * sy[i], 0.0f);
+    out.model[2] = glm::vec4(r2 * sz[i], 0.0f);
+    out.model[3] = glm::vec4(px[i], py[i], pz[i], 1.0f);
+    out.normal[0] = glm::vec4(r0 / sx[i], 0.0f);
+    out.normal[1] = glm::vec4(r1 / sy[i], 0.0f);
+    out.normal[2] = glm::vec4(r2 / sz[i], 0.0f);
+  }
+
+#ifdef TRANSFORM_SYSTEM_SSE
+  // four entities per call, one entity per lane
+  void updateSSE(std::size_t i) {
+    const __m128 one = _mm_set1_ps(1.0f), two = _mm_set1_ps(2.0f);
+    const __m128 zero = _mm_setzero_ps();
+
+    const __m128 x = _mm_loadu_ps(&qx[i]), y = _mm_loadu_ps(&qy[i]);
+    const __m128 z = _mm_loadu_ps(&qz[i]), w = _mm_loadu_ps(&qw[i]);
+    const __m128 xx = _mm_mul_ps(x, x), yy = _mm_mul_ps(y, y);
+    const __m128 zz = _mm_mul_ps(z, z);
+    const __m128 xy = _mm_mul_ps(x, y), xz = _mm_mul_ps(x, z);
+    const __m128 yz = _mm_mul_ps(y, z);
+    const __m128 wx = _mm_mul_ps(w, x), wy = _mm_mul_ps(w, y);
+    const __m128 wz = _mm_mul_ps(w, z);
+
+    // rotation matrix, rc = column c row r
+    const __m128 r00 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(yy, zz)));
+    const __m128 r01 = _mm_mul_ps(two, _mm_add_ps(xy, wz));
+    const __m128 r02 = _mm_mul_ps(two, _mm_sub_ps(xz, wy));
+    const __m128 r10 = _mm_mul_ps(two, _mm_sub_ps(xy, wz));
+    const __m128 r11 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, zz)));
+    const __m128 r12 = _mm_mul_ps(two, _mm_add_ps(yz, wx));
+    const __m128 r20 = _mm_mul_ps(two, _mm_add_ps(xz, wy));
+    const __m128 r21 = _mm_mul_ps(two, _mm_sub_ps(yz, wx));
+    const __m128 r22 = _mm_sub_ps(one, _mm_mul_ps(two, _mm_add_ps(xx, yy)));
+
+    const __m128 scaleX = _mm_loadu_ps(&sx[i]);
+    const __m128 scaleY = _mm_loadu_ps(&sy[i]);
+    const __m128 scaleZ = _mm_loadu_ps(&sz[i]);
+    const __m128 inverseX = _mm_div_ps(one, scaleX);
+    const __m128 inverseY = _mm_div_ps(one, scaleY);
+    const __m128 inverseZ = _mm_div_ps(one, scaleZ);
+
+    // world = R * S, then translation
+    storeColumn(i, 0, _mm_mul_ps(r00, scaleX), _mm_mul_ps(r01, scaleX),
+                _mm_mul_ps(r02, scaleX), zero, false);
+    storeColumn(i, 1, _mm_mul_ps(r10, scaleY), _mm_mul_ps(r11, scaleY),
+                _mm_mul_ps(r12, scaleY), zero, false);
+    storeColumn(i, 2, _mm_mul_ps(r20, scaleZ), _mm_mul_ps(r21, scaleZ),
+                _mm_mul_ps(r22, scaleZ), zero, false);
+    storeColumn(i, 3, _mm_loadu_ps(&px[i]), _mm_loadu_ps(&py[i]),
+                _mm_loadu_ps(&pz[i]), one, false);
+    // normal = R * S^-1
+    storeColumn(i, 0, _mm_mul_ps(r00, inverseX), _mm_mul_ps(r01, inverseX),
+                _mm_mul_ps(r02, inverseX), zero, true);
+    storeColumn(i, 1, _mm_mul_ps(r10, inverseY), _mm_mul_ps(r11, inverseY),
+                _mm_mul_ps(r12, inverseY), zero, true);
+    storeColumn(i, 2, _mm_mul_ps(r20, inverseZ), _mm_mul_ps(r21, inverseZ),
+                _mm_mul_ps(r22, inverseZ), zero, true);
+  }
+
+  // transpose rows of four entities into that column of each entity
+  void storeColumn(std::size_t i, int column, __m128 row0, __m128 row1,
+                   __m128 row2, __m128 row3, bool normal) {
+    _MM_TRANSPOSE4_PS(row0, row1, row2, row3);
+    const __m128 columns[4] = {row0, row1, row2, row3};
+    for (std::size_t lane = 0; lane < 4; ++lane) {
+      InstanceData &out = instances[i + lane];
+      float *target =
+          normal ? &out.normal[column].x : &out.model[column].x;
+      _mm_storeu_ps(target, columns[lane]);
+    }
+  }
+#endif
+};
+
+#endif
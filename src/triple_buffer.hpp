@@ -0,0 +1,45 @@
+#ifndef TRIPLE_BUFFER_HPP
+#define TRIPLE_BUFFER_HPP
+
+#include <atomic>
+
+// Lock-free single producer, single consumer hand-off of the newest value.
+// The writer fills back() and publish()es it, the reader acquire()s the most
+// recent published value. Neither side ever waits: the middle slot is swapped
+// atomically with whichever side touches it, and a flag in the shared index
+// tells the reader whether it holds something newer than its current slot.
+template <typename T> class TripleBuffer {
+public:
+  // slot owned by the writer
+  T &back() { return slots[backIndex]; }
+
+  // hand back() to the reader and take over a free slot
+  void publish() {
+    backIndex = middle.exchange(backIndex | FRESH, std::memory_order_acq_rel) &
+                INDEX;
+  }
+
+  // newest published value, stays valid until the next acquire()
+  const T &acquire(bool *fresh = nullptr) {
+    bool swapped = false;
+    if (middle.load(std::memory_order_relaxed) & FRESH) {
+      frontIndex =
+          middle.exchange(frontIndex, std::memory_order_acq_rel) & INDEX;
+      swapped = true;
+    }
+    if (fresh)
+      *fresh = swapped;
+    return slots[frontIndex];
+  }
+
+private:
+  static constexpr unsigned int INDEX = 3;
+  static constexpr unsigned int FRESH = 4;
+
+  T slots[3];
+  unsigned int backIndex = 0;
+  std::atomic<unsigned int> middle{1};
+  unsigned int frontIndex = 2;
+};
+
+#endif
@@ -0,0 +1,240 @@
+#ifndef UPLOAD_SCHEDULER_HPP
+#define UPLOAD_SCHEDULER_HPP
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "image.hpp"
+
+// How urgently an upload is needed. All uploads of one asset share one, so
+// its owner can update it while they are still pending.
+struct UploadPriority {
+  bool visible = true;
+  // distance from the camera
+  float distance = 0.0f;
+};
+
+// Spreads buffer and texture creation over frames. run() is called once per
+// frame on the render thread and works through the pending uploads, visible
+// before hidden and nearest first, until the frame's time or byte budget is
+// spent. Large uploads don't have to fit in one frame: buffers are filled in
+// byte ranges with glBufferSubData and textures in row ranges of the base
+// level with glTexSubImage2D, the mip chain is generated once the last rows
+// are in. The created callback runs when an object is complete.
+class UploadScheduler {
+public:
+  using Created = std::function<void(unsigned int)>;
+
+  struct Budget {
+    double milliseconds = 2.0;
+    std::size_t bytes = 8u << 20;
+  };
+
+  UploadScheduler() = default;
+  UploadScheduler(const UploadScheduler &) = delete;
+  UploadScheduler &operator=(const UploadScheduler &) = delete;
+
+  // images of textures that never completed are still ours
+  ~UploadScheduler() {
+    for (Task &task : tasks)
+      if (task.texture)
+        freeImage(task.image);
+  }
+
+  void setBudget(const Budget &budget) { this->budget = budget; }
+
+  // data must stay valid until created runs
+  void addBuffer(const void *data, std::size_t size, GLenum usage,
+                 Created created,
+                 std::shared_ptr<const UploadPriority> priority = nullptr) {
+    Task task = makeTask(std::move(created), std::move(priority));
+    task.texture = false;
+    task.data = static_cast<const unsigned char *>(data);
+    task.size = size;
+    task.usage = usage;
+    tasks.push_back(std::move(task));
+  }
+
+  // the scheduler frees image once the texture is complete
+  void addTexture(const Image &image, std::string path, Created created,
+                  std::shared_ptr<const UploadPriority> priority = nullptr) {
+    Task task = makeTask(std::move(created), std::move(priority));
+    task.texture = true;
+    task.image = image;
+    task.path = std::move(path);
+    tasks.push_back(std::move(task));
+  }
+
+  // upload within budget, returns the number of objects completed
+  std::size_t run() {
+    using clock = std::chrono::steady_clock;
+    const clock::time_point start = clock::now();
+    lastBytes = 0;
+    std::size_t completed = 0;
+
+    // priorities may have changed since the last frame
+    std::sort(tasks.begin(), tasks.end(), before);
+
+    std::size_t i = 0;
+    for (; i < tasks.size(); ++i) {
+      // always make some progress, even when one chunk exceeds the budget
+      const std::size_t allowance =
+          budget.bytes > lastBytes ? budget.bytes - lastBytes : 0;
+      if (i > 0 && (allowance == 0 || elapsed(start) >= budget.milliseconds))
+        break;
+      Task &task = tasks[i];
+      lastBytes += task.texture ? stepTexture(task, allowance)
+                                : stepBuffer(task, allowance);
+      if (task.done) {
+        task.created(task.id);
+        ++completed;
+      } else {
+        // partially uploaded, the budget is gone
+        ++i;
+        break;
+      }
+    }
+    tasks.erase(std::remove_if(tasks.begin(), tasks.begin() + i,
+                               [](const Task &task) { return task.done; }),
+                tasks.begin() + i);
+    lastMilliseconds = elapsed(start);
+    return completed;
+  }
+
+  // objects still waiting for (part of) their data
+  std::size_t pending() const { return tasks.size(); }
+  // cost of the last run()
+  double lastMilliseconds = 0.0;
+  std::size_t lastBytes = 0;
+
+private:
+  struct Task {
+    std::uint64_t sequence = 0;
+    std::shared_ptr<const UploadPriority> priority;
+    Created created;
+    unsigned int id = 0;
+    bool done = false;
+    // bytes (buffers) or rows (textures) uploaded so far
+    std::size_t progress = 0;
+
+    bool texture = false;
+    const unsigned char *data = nullptr;
+    std::size_t size = 0;
+    GLenum usage = GL_STATIC_DRAW;
+    Image image;
+    std::string path;
+  };
+
+  // smallest piece worth a separate call
+  static constexpr std::size_t MIN_CHUNK = 64 * 1024;
+
+  Budget budget;
+  std::vector<Task> tasks;
+  std::uint64_t nextSequence = 0;
+
+  Task makeTask(Created created,
+                std::shared_ptr<const UploadPriority> priority) {
+    static const auto standard = std::make_shared<const UploadPriority>();
+    Task task;
+    task.sequence = nextSequence++;
+    task.priority = priority ? std::move(priority) : standard;
+    task.created = std::move(created);
+    return task;
+  }
+
+  // visible first, then nearest, then oldest
+  static bool before(const Task &a, const Task &b) {
+    const UploadPriority &pa = *a.priority, &pb = *b.priority;
+    if (pa.visible != pb.visible)
+      return pa.visible;
+    if (pa.distance != pb.distance)
+      return pa.distance < pb.distance;
+    return a.sequence < b.sequence;
+  }
+
+  template <typename TimePoint> static double elapsed(TimePoint start) {
+    return std::chrono::duration<double, std::milli>(
+               std::chrono::steady_clock::now() - start)
+        .count();
+  }
+
+  std::size_t stepBuffer(Task &task, std::size_t allowance) {
+    if (task.id == 0) {
+      glGenBuffers(1, &task.id);
+      glBindBuffer(GL_COPY_WRITE_BUFFER, task.id);
+      glBufferData(GL_COPY_WRITE_BUFFER, static_cast<GLsizeiptr>(task.size),
+                   nullptr, task.usage);
+    } else {
+      glBindBuffer(GL_COPY_WRITE_BUFFER, task.id);
+    }
+    const std::size_t chunk =
+        std::min(task.size - task.progress, std::max(allowance, MIN_CHUNK));
+    if (chunk > 0)
+      glBufferSubData(GL_COPY_WRITE_BUFFER,
+                      static_cast<GLintptr>(task.progress),
+                      static_cast<GLsizeiptr>(chunk),
+                      task.data + task.progress);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    task.progress += chunk;
+    task.done = task.progress == task.size;
+    return chunk;
+  }
+
+  std::size_t stepTexture(Task &task, std::size_t allowance) {
+    const GLenum format = imageFormat(task.image);
+    if (task.id == 0) {
+      glGenTextures(1, &task.id);
+      if (!task.image.data || format == 0) {
+        std::cerr << "Texture failed to load at path: " << task.path
+                  << std::endl;
+        freeImage(task.image);
+        task.done = true;
+        return 0;
+      }
+      // storage for the base level, filled in below
+      glBindTexture(GL_TEXTURE_2D, task.id);
+      glTexImage2D(GL_TEXTURE_2D, 0, static_cast<GLint>(format),
+                   task.image.width, task.image.height, 0, format,
+                   GL_UNSIGNED_BYTE, nullptr);
+      setTextureParameters();
+    } else {
+      glBindTexture(GL_TEXTURE_2D, task.id);
+    }
+
+    const std::size_t rowBytes =
+        static_cast<std::size_t>(task.image.width) *
+        static_cast<std::size_t>(task.image.components);
+    const std::size_t height = static_cast<std::size_t>(task.image.height);
+    // as many whole rows as the allowance covers, at least one
+    std::size_t rows =
+        std::max(allowance, MIN_CHUNK) / std::max<std::size_t>(rowBytes, 1);
+    rows = std::min(height - task.progress, std::max<std::size_t>(rows, 1));
+    // stb rows are tightly packed
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTexSubImage2D(GL_TEXTURE_2D, 0, 0, static_cast<GLint>(task.progress),
+                    task.image.width, static_cast<GLsizei>(rows), format,
+                    GL_UNSIGNED_BYTE,
+                    task.image.data + task.progress * rowBytes);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    task.progress += rows;
+
+    if (task.progress == height) {
+      glGenerateMipmap(GL_TEXTURE_2D);
+      freeImage(task.image);
+      task.done = true;
+    }
+    return rows * rowBytes;
+  }
+};
+
+#endif
@@ -0,0 +1,111 @@
+#ifndef UPLOAD_THREAD_HPP
+#define UPLOAD_THREAD_HPP
+
+#include <glad/glad.h>
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#include "job_system.hpp"
+#include "render_context.hpp"
+
+// Runs GL uploads on a second context shared with the render context, so
+// creating buffers and textures no longer stalls a frame. Every upload is
+// followed by a fence, and a main thread job polls that fence each frame:
+// only once the GPU has consumed the upload does the ready callback hand the
+// objects over to the render thread. Buffers and textures are shared between
+// the contexts, container objects such as VAOs are not and have to be made
+// in the ready callback.
+class UploadThread {
+public:
+  // context from RenderContext::createShared() on the render context, left
+  // to the caller to destroy after the UploadThread is gone, since window
+  // contexts are only destroyed on the main thread. The GL function pointers
+  // loaded for the render context are valid for the shared one as well.
+  UploadThread(RenderContext &context, JobSystem &jobs)
+      : jobs(jobs), context(context), stopping(false) {
+    thread = std::thread([this] { run(); });
+  }
+
+  UploadThread(const UploadThread &) = delete;
+  UploadThread &operator=(const UploadThread &) = delete;
+
+  // finishes queued uploads, their ready callbacks still run on the main
+  // thread afterwards
+  ~UploadThread() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      stopping = true;
+    }
+    wake.notify_one();
+    thread.join();
+  }
+
+  // run upload on the upload context and ready on the main thread once the
+  // GPU is done with it, counter (if any) stays pending until then
+  void submit(Job upload, Job ready, JobCounter *counter = nullptr) {
+    if (counter)
+      jobs.retain(*counter);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      tasks.push_back({std::move(upload), std::move(ready), counter});
+    }
+    wake.notify_one();
+  }
+
+private:
+  struct Task {
+    Job upload;
+    Job ready;
+    JobCounter *counter = nullptr;
+  };
+
+  JobSystem &jobs;
+  RenderContext &context;
+  std::thread thread;
+  std::mutex mutex;
+  std::condition_variable wake;
+  std::deque<Task> tasks;
+  bool stopping;
+
+  void run() {
+    context.makeCurrent();
+    for (;;) {
+      Task task;
+      {
+        std::unique_lock<std::mutex> lock(mutex);
+        wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+        if (tasks.empty())
+          break;
+        task = std::move(tasks.front());
+        tasks.pop_front();
+      }
+      task.upload();
+      GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+      // the fence has to reach the GPU before another context can see it
+      glFlush();
+      adoptWhenSignaled(jobs, fence, std::move(task.ready), task.counter);
+    }
+    context.release();
+  }
+
+  // check the fence without blocking, try again next frame if it's pending
+  static void adoptWhenSignaled(JobSystem &jobs, GLsync fence, Job ready,
+                                JobCounter *counter) {
+    jobs.submitMain([&jobs, fence, ready = std::move(ready), counter] {
+      if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+        adoptWhenSignaled(jobs, fence, ready, counter);
+        return;
+      }
+      glDeleteSync(fence);
+      ready();
+      if (counter)
+        jobs.release(*counter);
+    });
+  }
+};
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef VISIBILITY_HPP
+#define VISIBILITY_HPP
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "deletion_queue.hpp"
+#include "model.hpp"
+#include "shader.hpp"
+#include "transform_system.hpp"
+
+// Visibility buffer alternative to forward shading. The ID pass draws every
+// instance of the model with positions only and writes nothing but which
+// triangle covers each pixel (triangle, mesh, instance) into an RG32UI
+// target, so overdraw costs a depth test and an integer write. Shading then
+// runs once per pixel: the resolve pass fetches the three vertices of the
+// pixel's triangle from buffer textures, intersects them with the pixel's
+// ray for the barycentrics and interpolates position, normal and texture
+// coordinates itself.
+//
+// Without bindless textures a single full screen pass can't sample every
+// mesh's material, so each mesh gets its own resolve pass. A material depth
+// pass first writes (mesh + 1) / 256 as the depth of every pixel, and each
+// mesh's pass draws a full screen triangle at its own depth with GL_EQUAL:
+// early depth testing drops the other meshes' pixels before they are shaded.
+class VisibilityRenderer {
+public:
+  // texture units of the IDs and buffer textures, after the light clusters
+  static constexpr GLint FIRST_UNIT = 11;
+  // mesh indices share a word with the instance
+  static constexpr std::size_t MAX_MESHES = 255;
+
+  // packs the model's vertices and indices into buffer textures, the model
+  // must be loaded and outlive the renderer
+  explicit VisibilityRenderer(Model &model)
+      : model(model),
+        idShader("shaders/visibility.vs", "shaders/visibility.fs"),
+        materialShader("shaders/fullscreen.vs", "shaders/material_depth.fs"),
+        resolveShader("shaders/fullscreen.vs",
+                      "shaders/visibility_resolve.fs") {
+    const std::vector<Mesh> &meshes = model.meshList();
+    if (meshes.size() > MAX_MESHES)
+      throw std::runtime_error("VISIBILITY::TOO_MANY_MESHES " +
+                               std::to_string(meshes.size()));
+
+    std::vector<glm::vec4> vertexTexels;
+    std::vector<std::uint32_t> indices;
+    for (const Mesh &mesh : meshes) {
+      const std::uint32_t baseVertex =
+          static_cast<std::uint32_t>(vertexTexels.size() / 2);
+      firstIndices.push_back(static_cast<GLint>(indices.size()));
+      for (const Vertex &vertex : mesh.vertices) {
+        vertexTexels.push_back(
+            glm::vec4(vertex.Position, vertex.TexCoords.x));
+        vertexTexels.push_back(glm::vec4(vertex.Normal, vertex.TexCoords.y));
+      }
+      for (unsigned int index : mesh.indices)
+        indices.push_back(baseVertex + index);
+      triangles += mesh.indices.size() / 3;
+    }
+
+    glGenBuffers(3, buffers);
+    glGenTextures(4, textures);
+    const GLenum formats[3] = {GL_RGBA32F, GL_R32UI, GL_RGBA32F};
+    const void *data[3] = {vertexTexels.data(), indices.data(), nullptr};
+    const std::size_t sizes[3] = {vertexTexels.size() * sizeof(glm::vec4),
+                                  indices.size() * sizeof(std::uint32_t),
+                                  sizeof(InstanceData)};
+    for (int i = 0; i < 3; ++i) {
+      glBindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+      glBufferData(GL_TEXTURE_BUFFER, static_cast<GLsizeiptr>(sizes[i]),
+                   data[i], i < 2 ? GL_STATIC_DRAW : GL_STREAM_DRAW);
+      glBindTexture(GL_TEXTURE_BUFFER, textures[i + 1]);
+      glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+    }
+    glBindTexture(GL_TEXTURE_BUFFER, 0);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+
+    glGenFramebuffers(1, &idFramebuffer);
+    glGenFramebuffers(1, &resolveFramebuffer);
+    glGenTextures(1, &color);
+    glGenRenderbuffers(1, &depth);
+    glGenRenderbuffers(1, &materialDepth);
+    glGenVertexArrays(1, &screenVAO);
+
+    // samplers never move, set them once
+    const char *samplers[4] = {"visibilityIds", "vertices", "indices",
+                               "instanceTransforms"};
+    for (Shader *shader : {&idShader, &materialShader, &resolveShader}) {
+      shader->use();
+      for (int i = 0; i < 4; ++i)
+        shader->setInt(samplers[i], FIRST_UNIT + i);
+    }
+  }
+
+  VisibilityRenderer(const VisibilityRenderer &) = delete;
+  VisibilityRenderer &operator=(const VisibilityRenderer &) = delete;
+
+  ~VisibilityRenderer() {
+    for (unsigned int buffer : buffers)
+      retireGLObject(GLObject::Buffer, buffer);
+    for (unsigned int texture : textures)
+      retireGLObject(GLObject::Texture, texture);
+    retireGLObject(GLObject::Texture, color);
+    retireGLObject(GLObject::VertexArray, screenVAO);
+    glDeleteRenderbuffers(1, &depth);
+    glDeleteRenderbuffers(1, &materialDepth);
+    glDeleteFramebuffers(1, &idFramebuffer);
+    glDeleteFramebuffers(1, &resolveFramebuffer);
+  }
+
+  // used and allocated size, see DynamicResolution::allocatedWidth()
+  void resize(int width, int height, int allocatedWidth, int allocatedHeight) {
+    this->width = width;
+    this->height = height;
+    if (allocatedWidth == this->allocatedWidth &&
+        allocatedHeight == this->allocatedHeight)
+      return;
+    this->allocatedWidth = allocatedWidth;
+    this->allocatedHeight = allocatedHeight;
+
+    glBindTexture(GL_TEXTURE_2D, textures[0]);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RG32UI, allocatedWidth, allocatedHeight,
+                 0, GL_RG_INTEGER, GL_UNSIGNED_INT, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, color);
+    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, allocatedWidth, allocatedHeight,
+                 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    glBindRenderbuffer(GL_RENDERBUFFER, depth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, allocatedWidth,
+                          allocatedHeight);
+    // 32 bit float holds (mesh + 1) / 256 exactly
+    glBindRenderbuffer(GL_RENDERBUFFER, materialDepth);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT32F,
+                          allocatedWidth, allocatedHeight);
+    glBindRenderbuffer(GL_RENDERBUFFER, 0);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, idFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           textures[0], 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, depth);
+    checkFramebuffer("IDS");
+
+    glBindFramebuffer(GL_FRAMEBUFFER, resolveFramebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           color, 0);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
+                              GL_RENDERBUFFER, materialDepth);
+    checkFramebuffer("RESOLVE");
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  }
+
+  // replace the instance transforms, each instance draws the whole model
+  void setInstances(const std::vector<InstanceData> &instances) {
+    instanceCount = instances.size();
+    glBindBuffer(GL_TEXTURE_BUFFER, buffers[2]);
+    glBufferData(GL_TEXTURE_BUFFER,
+                 static_cast<GLsizeiptr>(instances.size() *
+                                         sizeof(InstanceData)),
+                 instances.data(), GL_STREAM_DRAW);
+    glBindBuffer(GL_TEXTURE_BUFFER, 0);
+  }
+
+  // write the IDs of everything visible, then shade output, left bound,
+  // with resolveShader, which must have its light uniforms set already
+  void render(const glm::mat4 &view, const glm::mat4 &projection,
+              const glm::vec3 &viewPos, GLuint output = 0) {
+    const std::vector<Mesh> &meshes = model.meshList();
+    model.nodes.update();
+    for (int i = 0; i < 4; ++i) {
+      glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(FIRST_UNIT + i));
+      glBindTexture(i == 0 ? GL_TEXTURE_2D : GL_TEXTURE_BUFFER, textures[i]);
+    }
+
+    // IDs, depth tested as usual
+    glBindFramebuffer(GL_FRAMEBUFFER, idFramebuffer);
+    glViewport(0, 0, width, height);
+    const GLuint none[4] = {0, 0, 0, 0};
+    glClearBufferuiv(GL_COLOR, 0, none);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    idShader.use();
+    idShader.setMat4("view", view);
+    idShader.setMat4("projection", projection);
+    for (std::size_t i = 0; i < meshes.size(); ++i) {
+      idShader.setMat4("model", model.nodes.world[meshes[i].node]);
+      idShader.setUint("meshIndex", static_cast<unsigned int>(i));
+      glBindVertexArray(meshes[i].VAO);
+      glDrawElementsInstanced(GL_TRIANGLES,
+                              static_cast<GLsizei>(meshes[i].indices.size()),
+                              GL_UNSIGNED_INT, 0,
+                              static_cast<GLsizei>(instanceCount));
+    }
+
+    // material depth, pixels without geometry keep the cleared 1
+    glBindFramebuffer(GL_FRAMEBUFFER, resolveFramebuffer);
+    glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    glDepthFunc(GL_ALWAYS);
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    materialShader.use();
+    glBindVertexArray(screenVAO);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+
+    // one resolve per mesh, each only where the material depth matches
+    glDepthFunc(GL_EQUAL);
+    glDepthMask(GL_FALSE);
+    resolveShader.use();
+    resolveShader.setVec3("viewPos", viewPos);
+    resolveShader.setMat4("view", view);
+    resolveShader.setMat4("inverseViewProjection",
+                          glm::inverse(projection * view));
+    resolveShader.setVec4("viewport",
+                          glm::vec4(0.0f, 0.0f, static_cast<float>(width),
+                                    static_cast<float>(height)));
+    for (std::size_t i = 0; i < meshes.size(); ++i) {
+      const Mesh &mesh = meshes[i];
+      resolveShader.setFloat("screenDepth",
+                             static_cast<float>(i + 1) / 256.0f);
+      resolveShader.setInt("firstIndex", firstIndices[i]);
+      resolveShader.setMat4("model", model.nodes.world[mesh.node]);
+      resolveShader.setMat3("normalMatrix", model.nodes.normal[mesh.node]);
+      std::vector<std::string> names = mesh.samplerNames();
+      for (std::size_t t = 0; t < mesh.textures.size(); ++t) {
+        glActiveTexture(GL_TEXTURE0 + static_cast<GLenum>(t));
+        resolveShader.setInt(names[t], static_cast<int>(t));
+        glBindTexture(GL_TEXTURE_2D, textureId(mesh.textures[t].handle));
+      }
+      glDrawArrays(GL_TRIANGLES, 0, 3);
+    }
+    glDepthMask(GL_TRUE);
+    glDepthFunc(GL_LESS);
+    glBindVertexArray(0);
+    glActiveTexture(GL_TEXTURE0);
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, resolveFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, output);
+    glBlitFramebuffer(0, 0, width, height, 0, 0, width, height,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+    glBindFramebuffer(GL_FRAMEBUFFER, output);
+  }
+
+  // the mesh resolve passes, for clustered lighting and the light uniforms
+  Shader &shadingShader() { return resolveShader; }
+  // triangles drawn per instance
+  std::size_t modelTriangles() const { return triangles; }
+
+private:
+  Model &model;
+  Shader idShader, materialShader, resolveShader;
+  // size in use and allocated
+  int width = 0, height = 0;
+  int allocatedWidth = 0, allocatedHeight = 0;
+  std::size_t instanceCount = 0, triangles = 0;
+  // first entry of each mesh in the index buffer texture
+  std::vector<GLint> firstIndices;
+  // vertices, indices and instance transforms
+  unsigned int buffers[3];
+  // IDs, then the buffer textures in the order of buffers
+  unsigned int textures[4];
+  unsigned int idFramebuffer, resolveFramebuffer, color, depth, materialDepth;
+  unsigned int screenVAO;
+
+  static void checkFramebuffer(const char *name) {
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+      throw std::runtime_error(
+          std::string("VISIBILITY::FRAMEBUFFER_INCOMPLETE ") + name);
+  }
+};
+
+#endif
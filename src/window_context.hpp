@@ -0,0 +1,74 @@
+#ifndef WINDOW_CONTEXT_HPP
+#define WINDOW_CONTEXT_HPP
+
+#include <glad/glad.h>
+
+#include <GLFW/glfw3.h>
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+#include "render_context.hpp"
+
+// A GLFW window and its context. GLFW must be initialized, and like every
+// GLFW window call, construction and destruction happen on the main thread.
+class WindowContext : public RenderContext {
+public:
+  WindowContext(int width, int height, const char *title,
+                GLFWwindow *share = nullptr, bool visible = true) {
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    glfwWindowHint(GLFW_VISIBLE, visible ? GLFW_TRUE : GLFW_FALSE);
+    pWindow = glfwCreateWindow(width, height, title, nullptr, share);
+    glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
+    if (pWindow == nullptr) {
+      char description[1024];
+      glfwGetError(reinterpret_cast<const char **>(&description));
+      throw std::runtime_error(std::string("GLFW::WINDOW::ERROR ") +
+                               description);
+    }
+  }
+
+  WindowContext(const WindowContext &) = delete;
+  WindowContext &operator=(const WindowContext &) = delete;
+
+  ~WindowContext() override { glfwDestroyWindow(pWindow); }
+
+  GLFWwindow *window() const { return pWindow; }
+
+  void makeCurrent() override { glfwMakeContextCurrent(pWindow); }
+  void release() override { glfwMakeContextCurrent(nullptr); }
+  bool loadGL() override { return gladLoadGL() == GL_TRUE; }
+
+  GLuint framebuffer() const override { return 0; }
+  // main thread only
+  void framebufferSize(int &width, int &height) const override {
+    glfwGetFramebufferSize(pWindow, &width, &height);
+  }
+  void present() override { glfwSwapBuffers(pWindow); }
+  void setSwapInterval(int interval) override { glfwSwapInterval(interval); }
+  bool extensionSupported(const char *name) const override {
+    return glfwExtensionSupported(name) == GLFW_TRUE;
+  }
+
+  bool shouldClose() const override {
+    return glfwWindowShouldClose(pWindow) == GLFW_TRUE;
+  }
+  // from any thread, wakes the main thread if it waits for events
+  void requestClose() override {
+    glfwSetWindowShouldClose(pWindow, GLFW_TRUE);
+    glfwPostEmptyEvent();
+  }
+
+  // a hidden window, main thread only
+  std::unique_ptr<RenderContext> createShared() override {
+    return std::make_unique<WindowContext>(1, 1, "shared", pWindow, false);
+  }
+
+private:
+  GLFWwindow *pWindow;
+};
+
+#endif
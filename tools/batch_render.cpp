@@ -0,0 +1,396 @@
+// Renders many views of one model offscreen as fast as it can and writes
+// them as images, for thumbnails and turntables. The model is loaded once
+// into a headless context. Each view is read back into one of a ring of
+// pixel buffers while the following views render, then copied out once its
+// fence has passed and encoded on the job system's workers, so drawing,
+// readback and encoding all overlap.
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <atomic>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <numbers>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "camera_latch.hpp"
+#include "headless_context.hpp"
+#include "image_writer.hpp"
+#include "job_system.hpp"
+#include "model.hpp"
+#include "monotonic_clock.hpp"
+#include "shader.hpp"
+#include "stb_image.hpp"
+
+namespace {
+
+struct BatchOptions {
+  std::string modelPath;
+  // one view per line, or turntable views spread around the model
+  std::string posesPath;
+  unsigned int turntable = 0;
+  std::string outputDir;
+  int width = 256, height = 256;
+  // PPM instead of PNG, bigger files for less encoding
+  bool ppm = false;
+  // job system worker threads, negative picks one per spare core
+  int workers = -1;
+  // views read back in flight
+  unsigned int readbacks = 3;
+  // vertical field of view and turntable elevation, in degrees
+  float fov = 45.0f;
+  float elevation = 20.0f;
+};
+
+// where the eye is, what it looks at and its vertical field of view
+struct Pose {
+  glm::vec3 eye, target;
+  float fov;
+};
+
+// a view in flight from the GPU
+struct Readback {
+  GLuint buffer = 0;
+  GLsync fence = nullptr;
+  std::size_t view = 0;
+};
+
+void printUsage(const char *program) {
+  std::cout << "usage: " << program
+            << " --model <path> (--poses <file> | --turntable <count>)"
+               " --out <dir> [options]\n"
+            << "  --model <path>        model to render\n"
+            << "  --poses <file>        one view per line:\n"
+            << "                        eye x y z, target x y z [fov]\n"
+            << "  --turntable <count>   views around the model instead\n"
+            << "  --elevation <deg>     turntable eye above the horizon\n"
+            << "  --out <dir>           directory to write images to\n"
+            << "  --width <px>          image width\n"
+            << "  --height <px>         image height\n"
+            << "  --fov <deg>           vertical field of view\n"
+            << "  --format <png|ppm>    image format\n"
+            << "  --workers <count>     encoding threads\n"
+            << "  --readbacks <count>   views read back in flight\n"
+            << "  --help                show this message\n";
+}
+
+BatchOptions parseBatchOptions(int argc, char **argv) {
+  BatchOptions options;
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    // fetch the value following a flag
+    auto value = [&]() -> std::string {
+      if (i + 1 >= argc)
+        throw std::runtime_error("BATCH_RENDER::MISSING_VALUE " + arg);
+      return argv[++i];
+    };
+
+    if (arg == "--help") {
+      printUsage(argv[0]);
+      std::exit(EXIT_SUCCESS);
+    } else if (arg == "--model") {
+      options.modelPath = value();
+    } else if (arg == "--poses") {
+      options.posesPath = value();
+    } else if (arg == "--turntable") {
+      options.turntable = static_cast<unsigned int>(std::stoul(value()));
+    } else if (arg == "--elevation") {
+      options.elevation = std::stof(value());
+    } else if (arg == "--out") {
+      options.outputDir = value();
+    } else if (arg == "--width") {
+      options.width = std::stoi(value());
+    } else if (arg == "--height") {
+      options.height = std::stoi(value());
+    } else if (arg == "--fov") {
+      options.fov = std::stof(value());
+    } else if (arg == "--format") {
+      std::string format = value();
+      if (format == "png")
+        options.ppm = false;
+      else if (format == "ppm")
+        options.ppm = true;
+      else
+        throw std::runtime_error("BATCH_RENDER::INVALID_FORMAT " + format);
+    } else if (arg == "--workers") {
+      options.workers = std::stoi(value());
+    } else if (arg == "--readbacks") {
+      options.readbacks = static_cast<unsigned int>(std::stoul(value()));
+    } else {
+      printUsage(argv[0]);
+      throw std::runtime_error("BATCH_RENDER::UNKNOWN_ARGUMENT " + arg);
+    }
+  }
+  if (options.modelPath.empty() || options.outputDir.empty() ||
+      options.posesPath.empty() == (options.turntable == 0)) {
+    printUsage(argv[0]);
+    throw std::runtime_error("BATCH_RENDER::MISSING_ARGUMENT");
+  }
+  if (options.width < 1 || options.height < 1)
+    throw std::runtime_error("BATCH_RENDER::INVALID_SIZE");
+  if (options.fov <= 0.0f || options.fov >= 180.0f)
+    throw std::runtime_error("BATCH_RENDER::INVALID_FOV");
+  if (options.readbacks < 1)
+    throw std::runtime_error("BATCH_RENDER::INVALID_READBACKS");
+  return options;
+}
+
+// blank lines and lines starting with # are skipped
+std::vector<Pose> loadPoses(const std::string &path, float fov) {
+  std::ifstream file(path);
+  if (!file)
+    throw std::runtime_error("BATCH_RENDER::POSES_NOT_READ " + path);
+  std::vector<Pose> poses;
+  std::string line;
+  for (unsigned int number = 1; std::getline(file, line); ++number) {
+    std::istringstream fields(line);
+    std::string first;
+    if (!(fields >> first) || first[0] == '#')
+      continue;
+    fields.seekg(0);
+    Pose pose{glm::vec3(0.0f), glm::vec3(0.0f), fov};
+    if (!(fields >> pose.eye.x >> pose.eye.y >> pose.eye.z >> pose.target.x >>
+          pose.target.y >> pose.target.z))
+      throw std::runtime_error("BATCH_RENDER::INVALID_POSE line " +
+                               std::to_string(number));
+    if (float value; fields >> value)
+      pose.fov = value;
+    poses.push_back(pose);
+  }
+  return poses;
+}
+
+// count views at even angles around the model, far enough out to fit it
+std::vector<Pose> turntablePoses(const Model &model, unsigned int count,
+                                 float fov, float elevation) {
+  const glm::vec3 center = (model.aabbMin + model.aabbMax) * 0.5f;
+  const float radius =
+      std::max(glm::length(model.aabbMax - model.aabbMin) * 0.5f, 1e-3f);
+  const float distance = radius / std::sin(glm::radians(fov) * 0.5f);
+  const float pitch = glm::radians(elevation);
+  std::vector<Pose> poses;
+  for (unsigned int i = 0; i < count; ++i) {
+    const float angle = 2.0f * std::numbers::pi_v<float> *
+                        static_cast<float>(i) / static_cast<float>(count);
+    const glm::vec3 direction(std::cos(pitch) * std::sin(angle),
+                              std::sin(pitch),
+                              std::cos(pitch) * std::cos(angle));
+    poses.push_back({center + direction * distance, center, fov});
+  }
+  return poses;
+}
+
+std::string imagePath(const BatchOptions &options, std::size_t view) {
+  char name[32];
+  std::snprintf(name, sizeof(name), "view_%05zu.%s", view,
+                options.ppm ? "ppm" : "png");
+  return (std::filesystem::path(options.outputDir) / name).string();
+}
+
+double elapsedMs(std::uint64_t start) {
+  return static_cast<double>(monotonicNanoseconds() - start) * 1e-6;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+  const BatchOptions options = parseBatchOptions(argc, argv);
+  std::filesystem::create_directories(options.outputDir);
+
+  HeadlessContext context(options.width, options.height);
+  context.makeCurrent();
+  if (!context.loadGL()) {
+    std::cerr << "Failed to initialize GLAD" << std::endl;
+    return EXIT_FAILURE;
+  }
+  std::cout << "Loaded OpenGL: " << glGetString(GL_VERSION) << std::endl;
+
+  JobSystem jobs(options.workers < 0
+                     ? JobSystem::defaultWorkers()
+                     : static_cast<unsigned int>(options.workers));
+
+  const std::uint64_t loadStart = monotonicNanoseconds();
+  stbi_set_flip_vertically_on_load(true);
+  // textures decoded on the workers
+  Model model(options.modelPath.c_str(), &jobs);
+  Shader shader("shaders/shader.vs", "shaders/thumbnail.fs");
+  CameraLatch::attach(shader);
+  const double loadMs = elapsedMs(loadStart);
+
+  const std::vector<Pose> poses =
+      options.turntable > 0 ? turntablePoses(model, options.turntable,
+                                             options.fov, options.elevation)
+                            : loadPoses(options.posesPath, options.fov);
+  if (poses.empty())
+    throw std::runtime_error("BATCH_RENDER::NO_POSES");
+
+  // the Camera block of shader.vs, written once per view
+  GLuint cameraBuffer;
+  glGenBuffers(1, &cameraBuffer);
+  glBindBuffer(GL_UNIFORM_BUFFER, cameraBuffer);
+  glBufferData(GL_UNIFORM_BUFFER, 2 * sizeof(glm::mat4), nullptr,
+               GL_DYNAMIC_DRAW);
+  glBindBufferBase(GL_UNIFORM_BUFFER, CameraLatch::BINDING, cameraBuffer);
+
+  const std::size_t imageBytes = static_cast<std::size_t>(options.width) *
+                                 static_cast<std::size_t>(options.height) * 4;
+  std::vector<Readback> readbacks(options.readbacks);
+  for (Readback &readback : readbacks) {
+    glGenBuffers(1, &readback.buffer);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    glBufferData(GL_PIXEL_PACK_BUFFER, static_cast<GLsizeiptr>(imageBytes),
+                 nullptr, GL_STREAM_READ);
+  }
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, context.framebuffer());
+  glViewport(0, 0, options.width, options.height);
+  glEnable(GL_DEPTH_TEST);
+  // transparent where the model isn't
+  glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+
+  const glm::vec3 center = (model.aabbMin + model.aabbMax) * 0.5f;
+  const float radius =
+      std::max(glm::length(model.aabbMax - model.aabbMin) * 0.5f, 1e-3f);
+  const float aspect =
+      static_cast<float>(options.width) / static_cast<float>(options.height);
+
+  JobCounter encoding;
+  // encodes queued and not yet finished, bounded so a GPU far ahead of the
+  // encoders can't queue every image in memory
+  std::atomic<unsigned int> queued{0};
+  std::atomic<unsigned int> failures{0};
+  const unsigned int maxQueued = 2 * (jobs.workerCount() + 1);
+  std::uint64_t fenceNs = 0, encodeWaitNs = 0;
+
+  // wait for a view to arrive, copy it out and queue its encode
+  auto collect = [&](Readback &readback) {
+    std::uint64_t start = monotonicNanoseconds();
+    GLenum status;
+    do
+      status = glClientWaitSync(readback.fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                1000000000);
+    while (status == GL_TIMEOUT_EXPIRED);
+    glDeleteSync(readback.fence);
+    readback.fence = nullptr;
+    fenceNs += monotonicNanoseconds() - start;
+
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    const void *mapped =
+        glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+                         static_cast<GLsizeiptr>(imageBytes), GL_MAP_READ_BIT);
+    if (!mapped) {
+      std::cerr << "view " << readback.view
+                << " not read back, GL error 0x" << std::hex << glGetError()
+                << std::dec << std::endl;
+      failures.fetch_add(1, std::memory_order_relaxed);
+      return;
+    }
+    std::vector<unsigned char> pixels(imageBytes);
+    std::memcpy(pixels.data(), mapped, imageBytes);
+    glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+
+    // help encoding while over the cap, the only way anything gets encoded
+    // without workers
+    start = monotonicNanoseconds();
+    while (queued.load(std::memory_order_acquire) >= maxQueued)
+      if (!jobs.runOne())
+        std::this_thread::yield();
+    encodeWaitNs += monotonicNanoseconds() - start;
+
+    queued.fetch_add(1, std::memory_order_relaxed);
+    jobs.submit(
+        [&, path = imagePath(options, readback.view),
+         pixels = std::move(pixels)] {
+          const bool written =
+              options.ppm ? writePpm(path, options.width, options.height,
+                                     pixels.data())
+                          : writePng(path, options.width, options.height,
+                                     pixels.data());
+          if (!written) {
+            std::cerr << path << " not written" << std::endl;
+            failures.fetch_add(1, std::memory_order_relaxed);
+          }
+          queued.fetch_sub(1, std::memory_order_release);
+        },
+        &encoding);
+  };
+
+  const std::uint64_t start = monotonicNanoseconds();
+  for (std::size_t view = 0; view < poses.size(); ++view) {
+    Readback &readback = readbacks[view % readbacks.size()];
+    if (readback.fence)
+      collect(readback);
+
+    const Pose &pose = poses[view];
+    const glm::vec3 forward = glm::normalize(pose.target - pose.eye);
+    const glm::vec3 up = std::abs(forward.y) > 0.999f
+                             ? glm::vec3(0.0f, 0.0f, -1.0f)
+                             : glm::vec3(0.0f, 1.0f, 0.0f);
+    const glm::mat4 viewMatrix = glm::lookAt(pose.eye, pose.target, up);
+    // depth range just around the model's bounding sphere
+    const float distance = glm::length(center - pose.eye);
+    const glm::mat4 projection =
+        glm::perspective(glm::radians(pose.fov), aspect,
+                         std::max(distance - radius, radius * 1e-3f),
+                         distance + radius);
+    glBindBuffer(GL_UNIFORM_BUFFER, cameraBuffer);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(glm::mat4),
+                    &viewMatrix[0][0]);
+    glBufferSubData(GL_UNIFORM_BUFFER, sizeof(glm::mat4), sizeof(glm::mat4),
+                    &projection[0][0]);
+
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    shader.use();
+    shader.setVec3("viewPos", pose.eye);
+    model.Draw(shader);
+
+    // into the buffer without waiting, collected readbacks.size() views on
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, readback.buffer);
+    glReadPixels(0, 0, options.width, options.height, GL_RGBA,
+                 GL_UNSIGNED_BYTE, nullptr);
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    readback.view = view;
+  }
+  // the views still in flight, oldest first
+  for (std::size_t i = 0; i < readbacks.size(); ++i) {
+    Readback &readback = readbacks[(poses.size() + i) % readbacks.size()];
+    if (readback.fence)
+      collect(readback);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  jobs.wait(encoding);
+  const double totalMs = elapsedMs(start);
+
+  for (Readback &readback : readbacks)
+    glDeleteBuffers(1, &readback.buffer);
+  glDeleteBuffers(1, &cameraBuffer);
+
+  std::cout << "load took " << loadMs << " ms\n"
+            << poses.size() << " views of " << options.width << "x"
+            << options.height << " in " << totalMs << " ms, "
+            << static_cast<double>(poses.size()) / (totalMs * 1e-3)
+            << " views/s\n"
+            << "waited " << static_cast<double>(fenceNs) * 1e-6
+            << " ms on readbacks and "
+            << static_cast<double>(encodeWaitNs) * 1e-6
+            << " ms on encoders with " << jobs.workerCount() << " workers"
+            << std::endl;
+  if (failures > 0) {
+    std::cerr << failures << " images not written to " << options.outputDir
+              << std::endl;
+    return EXIT_FAILURE;
+  }
+}